@@ -0,0 +1,337 @@
+/**
+ * affinity.h
+ * ----------
+ * Thread placement for the examples. Left alone, the scheduler is free to
+ * put a writer and its reader on different sockets, and then every handoff
+ * through the shared buffer is a cross-socket cache-line transfer. A
+ * placement pins each created thread, through the pthread_attr_t it is
+ * created with, according to one of these policies:
+ *
+ *   none        leave placement to the scheduler (the default)
+ *   compact     fill one core's SMT siblings, then the next core of the same
+ *               package, then the next package, so neighbouring threads
+ *               share as much cache as possible
+ *   scatter     one thread per package in turn, and only go back for SMT
+ *               siblings once every core has one, so threads share as
+ *               little as possible
+ *   list:CPUS   thread i runs on the i-th CPU of an explicit list such as
+ *               list:0,2,8-11 (wrapping around if there are more threads)
+ *   numa[:N]    every thread may run on any CPU of NUMA node N, by default
+ *               the node main is running on
+ *
+ * Only the CPUs in the process's own affinity mask are ever used. The
+ * topology comes from sysfs, so no NUMA library is needed; a machine
+ * without /sys/devices/system/node is treated as a single node.
+ *
+ * Memory follows the kernel's first-touch rule: a page is placed on the
+ * node of the thread that first writes it. PlacementEnterNode temporarily
+ * moves the calling thread onto a node so that whatever it allocates and
+ * writes in the meantime lands there. Users must define _GNU_SOURCE
+ * before their first #include for the affinity calls to be visible.
+ */
+
+#ifndef _AFFINITY_H
+#define _AFFINITY_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#define MAX_PLACEMENT_CPUS 1024
+#define MAX_NUMA_NODES 64
+
+typedef enum {
+    PLACE_NONE,
+    PLACE_COMPACT,
+    PLACE_SCATTER,
+    PLACE_LIST,
+    PLACE_NUMA
+} placementKind;
+
+static const char* const placementNames[] = {"none", "compact", "scatter", "list", "numa"};
+
+typedef struct {
+    int cpu;
+    int node;
+    int package;
+    int core;
+    int coreRank;       // rank of the core within its package
+    int sibling;        // rank of the CPU among its core's SMT siblings
+} cpuInfo;
+
+typedef struct {
+    placementKind kind;
+    int order[MAX_PLACEMENT_CPUS];  // thread i runs on order[i % numOrder]
+    int numOrder;
+    int node;                       // numa: the node every thread runs on
+    cpuInfo cpus[MAX_PLACEMENT_CPUS];
+    int numCpus;
+} placement;
+
+static inline int ReadSysInt(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    int value = -1;
+
+    if (f == NULL) return -1;
+    if (fscanf(f, "%d", &value) != 1) value = -1;
+    fclose(f);
+    return value;
+}
+
+/**
+ * ParseCpuList
+ * ------------
+ * Parses a list in the kernel's cpulist format, "0,2,8-11", into cpus[0..max)
+ * and returns how many there were, or -1 if the list is malformed.
+ */
+
+static inline int ParseCpuList(const char* list, int* cpus, int max)
+{
+    int count = 0, first, last;
+    char* end;
+
+    while (*list != '\0' && *list != '\n') {
+        first = (int) strtol(list, &end, 10);
+        if (end == list || first < 0) return -1;
+        last = first;
+        if (*end == '-') {
+            list = end + 1;
+            last = (int) strtol(list, &end, 10);
+            if (end == list || last < first) return -1;
+        }
+        for (; first <= last; first++) {
+            if (count == max) return -1;
+            cpus[count++] = first;
+        }
+        if (*end == ',') end++;
+        else if (*end != '\0' && *end != '\n') return -1;
+        list = end;
+    }
+    return count;
+}
+
+static inline cpuInfo* PlacementCpu(placement* p, int cpu)
+{
+    int i;
+
+    for (i = 0; i < p->numCpus; i++)
+        if (p->cpus[i].cpu == cpu) return p->cpus + i;
+    return NULL;
+}
+
+static inline int CompareCompact(const void* a, const void* b)
+{
+    const cpuInfo* x = (const cpuInfo*) a;
+    const cpuInfo* y = (const cpuInfo*) b;
+
+    if (x->node != y->node) return x->node - y->node;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->core != y->core) return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+static inline int CompareScatter(const void* a, const void* b)
+{
+    const cpuInfo* x = (const cpuInfo*) a;
+    const cpuInfo* y = (const cpuInfo*) b;
+
+    if (x->sibling != y->sibling) return x->sibling - y->sibling;
+    if (x->coreRank != y->coreRank) return x->coreRank - y->coreRank;
+    if (x->node != y->node) return x->node - y->node;
+    if (x->package != y->package) return x->package - y->package;
+    return x->cpu - y->cpu;
+}
+
+/**
+ * PlacementTopology
+ * -----------------
+ * Fills p->cpus with the node, package and core of every CPU we are
+ * allowed to run on, and works out each core's rank within its package and
+ * each CPU's rank among its SMT siblings.
+ */
+
+static inline void PlacementTopology(placement* p)
+{
+    cpu_set_t allowed;
+    char path[96], list[4096];
+    int nodeCpus[MAX_PLACEMENT_CPUS];
+    int cpu, node, n, i, j;
+    cpuInfo* info;
+    FILE* f;
+
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    p->numCpus = 0;
+    for (cpu = 0; cpu < CPU_SETSIZE && p->numCpus < MAX_PLACEMENT_CPUS; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        info = p->cpus + p->numCpus++;
+        info->cpu = cpu;
+        info->node = 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        if ((info->package = ReadSysInt(path)) < 0) info->package = 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        if ((info->core = ReadSysInt(path)) < 0) info->core = cpu;
+    }
+    for (node = 0; node < MAX_NUMA_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if ((f = fopen(path, "r")) == NULL) continue;
+        if (fgets(list, sizeof(list), f) != NULL && (n = ParseCpuList(list, nodeCpus, MAX_PLACEMENT_CPUS)) > 0)
+            for (i = 0; i < n; i++)
+                if ((info = PlacementCpu(p, nodeCpus[i])) != NULL) info->node = node;
+        fclose(f);
+    }
+    for (i = 0; i < p->numCpus; i++) {
+        p->cpus[i].sibling = 0;
+        for (j = 0; j < p->numCpus; j++)
+            if (p->cpus[j].package == p->cpus[i].package && p->cpus[j].core == p->cpus[i].core &&
+                p->cpus[j].cpu < p->cpus[i].cpu) p->cpus[i].sibling++;
+    }
+    // each lower core of the same package is counted once, through its first sibling
+    for (i = 0; i < p->numCpus; i++) {
+        p->cpus[i].coreRank = 0;
+        for (j = 0; j < p->numCpus; j++)
+            if (p->cpus[j].package == p->cpus[i].package && p->cpus[j].core < p->cpus[i].core &&
+                p->cpus[j].sibling == 0) p->cpus[i].coreRank++;
+    }
+}
+
+/**
+ * PlacementFromSpec
+ * -----------------
+ * Sets up a placement from one of the policy names listed above, reading
+ * the topology for those that need it. Returns false if the spec is not
+ * understood or names CPUs or a node we cannot run on.
+ */
+
+static inline bool PlacementFromSpec(const char* spec, placement* p)
+{
+    int list[MAX_PLACEMENT_CPUS];
+    int i, n, cpu;
+    char* end;
+
+    memset(p, 0, sizeof(*p));
+    p->kind = PLACE_NONE;
+    if (strcmp(spec, "none") == 0) return true;
+    PlacementTopology(p);
+    if (strcmp(spec, "compact") == 0 || strcmp(spec, "scatter") == 0) {
+        p->kind = spec[0] == 'c' ? PLACE_COMPACT : PLACE_SCATTER;
+        qsort(p->cpus, p->numCpus, sizeof(cpuInfo), p->kind == PLACE_COMPACT ? CompareCompact : CompareScatter);
+        for (i = 0; i < p->numCpus; i++) p->order[i] = p->cpus[i].cpu;
+        p->numOrder = p->numCpus;
+    } else if (strncmp(spec, "list:", 5) == 0) {
+        p->kind = PLACE_LIST;
+        if ((n = ParseCpuList(spec + 5, list, MAX_PLACEMENT_CPUS)) <= 0) return false;
+        for (i = 0; i < n; i++) {
+            if (PlacementCpu(p, list[i]) == NULL) return false;
+            p->order[i] = list[i];
+        }
+        p->numOrder = n;
+    } else if (strcmp(spec, "numa") == 0 || strncmp(spec, "numa:", 5) == 0) {
+        p->kind = PLACE_NUMA;
+        if (spec[4] == ':') {
+            p->node = (int) strtol(spec + 5, &end, 10);
+            if (end == spec + 5 || *end != '\0') return false;
+        } else {
+            cpu = sched_getcpu();
+            p->node = PlacementCpu(p, cpu) != NULL ? PlacementCpu(p, cpu)->node : p->cpus[0].node;
+        }
+        for (i = 0; i < p->numCpus; i++)
+            if (p->cpus[i].node == p->node) p->order[p->numOrder++] = p->cpus[i].cpu;
+        if (p->numOrder == 0) return false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * PlacementCpuSet
+ * ---------------
+ * The CPUs the given thread may run on, or false if it is left to the
+ * scheduler. A numa placement allows the whole node; every other policy
+ * allows exactly one CPU.
+ */
+
+static inline bool PlacementCpuSet(const placement* p, int thread, cpu_set_t* set)
+{
+    int i;
+
+    CPU_ZERO(set);
+    if (p->kind == PLACE_NONE) return false;
+    if (p->kind == PLACE_NUMA) {
+        for (i = 0; i < p->numOrder; i++) CPU_SET(p->order[i], set);
+    } else {
+        CPU_SET(p->order[thread % p->numOrder], set);
+    }
+    return true;
+}
+
+/**
+ * PlacementApply
+ * --------------
+ * Sets the affinity in the attr the given thread is about to be created
+ * with. pthread_create copies what it needs, so one attr can be reused for
+ * every thread.
+ */
+
+static inline void PlacementApply(const placement* p, pthread_attr_t* attr, int thread)
+{
+    cpu_set_t set;
+
+    if (PlacementCpuSet(p, thread, &set)) pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+/**
+ * PlacementNodeOf
+ * ---------------
+ * The NUMA node the given thread will run on, or -1 if it isn't pinned.
+ */
+
+static inline int PlacementNodeOf(const placement* p, int thread)
+{
+    const cpuInfo* info;
+
+    if (p->kind == PLACE_NONE) return -1;
+    if (p->kind == PLACE_NUMA) return p->node;
+    info = PlacementCpu((placement*) p, p->order[thread % p->numOrder]);
+    return info != NULL ? info->node : -1;
+}
+
+/**
+ * PlacementEnterNode
+ * ------------------
+ * Moves the calling thread onto the CPUs of the given node, saving its old
+ * affinity in *saved, so that memory it first touches from now on is
+ * allocated there. Returns false, and changes nothing, if node is -1 or
+ * has no CPUs we may use. PlacementLeaveNode restores the saved affinity.
+ */
+
+static inline bool PlacementEnterNode(const placement* p, int node, cpu_set_t* saved)
+{
+    cpu_set_t set;
+    int i, count = 0;
+
+    if (node < 0) return false;
+    CPU_ZERO(&set);
+    for (i = 0; i < p->numCpus; i++)
+        if (p->cpus[i].node == node) {
+            CPU_SET(p->cpus[i].cpu, &set);
+            count++;
+        }
+    if (count == 0) return false;
+    pthread_getaffinity_np(pthread_self(), sizeof(*saved), saved);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    sched_yield();      // make sure we have actually migrated before touching anything
+    return true;
+}
+
+static inline void PlacementLeaveNode(const cpu_set_t* saved)
+{
+    pthread_setaffinity_np(pthread_self(), sizeof(*saved), saved);
+}
+
+#endif
@@ -0,0 +1,279 @@
+/**
+ * arena.h
+ * -------
+ * Bulk allocation for the examples. An arena hands out memory by bumping
+ * an offset into one large block and gives it all back at once, so setting
+ * up a run is a single malloc however many arrays, names and buffers it
+ * needs, and tearing it down is a single free. If an arena runs out it
+ * chains another block; ArenaReset then folds the blocks into one of the
+ * combined size, so from the next round on it is one allocation again.
+ *
+ * A slabPool carves objects of one size out of an arena that belongs to a
+ * single thread. Its owner allocates and frees from a plain free list,
+ * with no lock and no atomic operations. Any other thread that is done
+ * with an object pushes it onto the pool's returned list, a lock-free
+ * stack. The owner takes back the whole list in one exchange when its own
+ * list runs dry, and only comes back to the arena for more when both are
+ * empty. Nothing is ever given back to malloc until the round is over,
+ * when SlabReset and ArenaReset drop every object in one step.
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#define ARENA_DEFAULT_BLOCK (64 * 1024)
+#define SLAB_REFILL 64          // most objects carved from the arena at a time
+#define SLAB_CHUNK_BYTES (256 * 1024)
+
+typedef struct arenaBlock {
+    struct arenaBlock* next;
+    size_t size;
+    size_t used;
+    _Alignas(CACHE_LINE_SIZE) char data[];
+} arenaBlock;
+
+typedef struct {
+    arenaBlock* first;
+    arenaBlock* current;
+    size_t total;       // bytes in all blocks together
+    int blocks;
+} arena;
+
+typedef struct slabObject {
+    struct slabObject* next;
+} slabObject;
+
+typedef struct {
+    arena* arena;
+    size_t objectSize;
+    int refill;         // objects carved at a time, fewer for large objects
+    slabObject* freeList;                           // the owner's own
+    long carved;
+    _Alignas(CACHE_LINE_SIZE) _Atomic(slabObject*) returned;   // pushed by other threads
+} slabPool;
+
+static inline arenaBlock* ArenaBlockNew(size_t size)
+{
+    arenaBlock* block = (arenaBlock*) aligned_alloc(CACHE_LINE_SIZE,
+        (sizeof(arenaBlock) + size + CACHE_LINE_SIZE - 1) & ~(size_t) (CACHE_LINE_SIZE - 1));
+
+    if (block == NULL) {
+        printf("ERROR: cannot allocate an arena block of %zu bytes\n", size);
+        exit(1);
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+/**
+ * ArenaInit
+ * ---------
+ * Sets up an arena with a first block of the given size, which is best
+ * made large enough for everything the arena will be asked for. The
+ * memory is not touched here, so its pages are still placed by whoever
+ * first writes them.
+ */
+
+static inline void ArenaInit(arena* a, size_t size)
+{
+    if (size == 0) size = ARENA_DEFAULT_BLOCK;
+    a->first = a->current = ArenaBlockNew(size);
+    a->total = size;
+    a->blocks = 1;
+}
+
+/**
+ * ArenaInitOver
+ * -------------
+ * Sets up an arena over size bytes the caller already has, such as a
+ * shared memory segment, starting on a cache line. It has to be sized for
+ * everything it will be asked for, since a block chained onto it would
+ * come from malloc, and it is not to be reset or destroyed.
+ */
+
+static inline void ArenaInitOver(arena* a, void* memory, size_t size)
+{
+    arenaBlock* block = (arenaBlock*) memory;
+
+    block->next = NULL;
+    block->size = size - sizeof(arenaBlock);
+    block->used = 0;
+    a->first = a->current = block;
+    a->total = block->size;
+    a->blocks = 1;
+}
+
+/**
+ * ArenaAlloc
+ * ----------
+ * Returns size bytes aligned to align, a power of two no larger than a
+ * cache line. The memory is not cleared.
+ */
+
+static inline void* ArenaAlloc(arena* a, size_t size, size_t align)
+{
+    arenaBlock* block = a->current;
+    size_t offset = (block->used + align - 1) & ~(align - 1);
+
+    if (offset + size > block->size) {
+        size_t next = block->size > size ? block->size : size;
+
+        block->next = ArenaBlockNew(next);
+        block = a->current = block->next;
+        a->total += next;
+        a->blocks++;
+        offset = 0;
+    }
+    block->used = offset + size;
+    return block->data + offset;
+}
+
+static inline void* ArenaCalloc(arena* a, size_t count, size_t size)
+{
+    void* p = ArenaAlloc(a, count * size, CACHE_LINE_SIZE);
+
+    memset(p, 0, count * size);
+    return p;
+}
+
+static inline char* ArenaStrdup(arena* a, const char* s)
+{
+    size_t length = strlen(s) + 1;
+
+    return (char*) memcpy(ArenaAlloc(a, length, 1), s, length);
+}
+
+/**
+ * ArenaReset
+ * ----------
+ * Gives back everything allocated from the arena at once. If it had to
+ * grow, its blocks are replaced by one that holds as much as all of them.
+ */
+
+static inline void ArenaReset(arena* a)
+{
+    arenaBlock* block;
+
+    if (a->blocks > 1) {
+        while ((block = a->first) != NULL) {
+            a->first = block->next;
+            free(block);
+        }
+        a->first = ArenaBlockNew(a->total);
+        a->blocks = 1;
+    }
+    a->first->used = 0;
+    a->current = a->first;
+}
+
+static inline void ArenaDestroy(arena* a)
+{
+    arenaBlock* block;
+
+    while ((block = a->first) != NULL) {
+        a->first = block->next;
+        free(block);
+    }
+    a->current = NULL;
+}
+
+/**
+ * SlabInit
+ * --------
+ * A pool of objectSize-byte objects, cache-line aligned, drawn from the
+ * given arena, which only the pool's owner may allocate from.
+ */
+
+static inline void SlabInit(slabPool* s, arena* a, size_t objectSize)
+{
+    s->arena = a;
+    s->objectSize = (objectSize + CACHE_LINE_SIZE - 1) & ~(size_t) (CACHE_LINE_SIZE - 1);
+    s->refill = (int) (SLAB_CHUNK_BYTES / s->objectSize);
+    if (s->refill < 1) s->refill = 1;
+    if (s->refill > SLAB_REFILL) s->refill = SLAB_REFILL;
+    s->freeList = NULL;
+    s->carved = 0;
+    atomic_init(&s->returned, NULL);
+}
+
+/**
+ * SlabAlloc
+ * ---------
+ * Owner only.
+ */
+
+static inline void* SlabAlloc(slabPool* s)
+{
+    slabObject* object = s->freeList;
+    char* chunk;
+    int i;
+
+    if (object == NULL) object = atomic_exchange_explicit(&s->returned, NULL, memory_order_acquire);
+    if (object == NULL) {
+        chunk = (char*) ArenaAlloc(s->arena, s->refill * s->objectSize, CACHE_LINE_SIZE);
+        for (i = s->refill - 1; i >= 0; i--) {
+            slabObject* carved = (slabObject*) (chunk + i * s->objectSize);
+            carved->next = object;
+            object = carved;
+        }
+        s->carved += s->refill;
+    }
+    s->freeList = object->next;
+    return object;
+}
+
+/**
+ * SlabFree and SlabReturn
+ * -----------------------
+ * SlabFree is for the owner, SlabReturn for every other thread. Only the
+ * owner ever takes objects off the returned stack, and then always the
+ * whole stack at once, so a push cannot be confused by an object that was
+ * popped and pushed again in the meantime.
+ */
+
+static inline void SlabFree(slabPool* s, void* p)
+{
+    slabObject* object = (slabObject*) p;
+
+    object->next = s->freeList;
+    s->freeList = object;
+}
+
+static inline void SlabReturn(slabPool* s, void* p)
+{
+    slabObject* object = (slabObject*) p;
+    slabObject* head = atomic_load_explicit(&s->returned, memory_order_relaxed);
+
+    do {
+        object->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&s->returned, &head, object,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * SlabReset
+ * ---------
+ * Forgets every object, handed out or not, for when the arena underneath
+ * is about to be reset. No other thread may still hold one.
+ */
+
+static inline void SlabReset(slabPool* s)
+{
+    s->freeList = NULL;
+    atomic_store_explicit(&s->returned, NULL, memory_order_relaxed);
+}
+
+#endif
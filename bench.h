@@ -0,0 +1,208 @@
+/**
+ * bench.h
+ * -------
+ * The benchmark harness shared by the examples. In benchmark mode the
+ * random usleep()s that stand in for real work are replaced by a fixed
+ * amount of busy-work (possibly none, to measure pure synchronization
+ * overhead), per-operation printf()s are suppressed, and the run is either
+ * a fixed number of operations or a fixed length of time. Every thread
+ * keeps its own latencyLog, so recording a sample never touches shared
+ * memory; the logs are merged once the threads have been joined and
+ * BenchReport prints throughput, time per operation and latency
+ * percentiles.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define LATENCY_SAMPLES (1 << 16)
+#define DEADLINE_CHECK_INTERVAL 64
+
+typedef struct {
+    bool enabled;
+    unsigned long work;         // busy-work iterations standing in for each unit of work
+    long ops;                   // run exactly this many operations, if non-zero
+    double duration;            // otherwise run for this many seconds
+    pthread_barrier_t start;    // releases every thread at once
+    uint64_t startNs;
+} benchConfig;
+
+/**
+ * A latencyLog holds up to LATENCY_SAMPLES samples. Once it is full it
+ * keeps a uniform random sample of everything recorded (reservoir
+ * sampling), so long runs still yield unbiased percentiles.
+ */
+
+typedef struct {
+    uint64_t* samples;
+    size_t count;
+    uint64_t seen;
+    uint64_t rng;
+} latencyLog;
+
+static inline uint64_t NowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * BusyWork
+ * --------
+ * Spins for the given number of xorshift rounds and returns the result,
+ * which callers can use as a pseudo-random value. The empty asm keeps the
+ * compiler from discarding or collapsing the loop.
+ */
+
+static inline uint64_t BusyWork(unsigned long iterations, uint64_t seed)
+{
+    uint64_t x = seed | 1;
+    unsigned long i;
+
+    for (i = 0; i < iterations; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        __asm__ __volatile__("" : "+r"(x));
+    }
+    return x;
+}
+
+static inline void LatencyInit(latencyLog* log, uint64_t seed)
+{
+    log->samples = (uint64_t*) malloc(LATENCY_SAMPLES * sizeof(uint64_t));
+    log->count = 0;
+    log->seen = 0;
+    log->rng = seed | 1;
+}
+
+static inline void LatencyDestroy(latencyLog* log)
+{
+    free(log->samples);
+    log->samples = NULL;
+}
+
+static inline void LatencyRecord(latencyLog* log, uint64_t ns)
+{
+    uint64_t slot;
+
+    log->seen++;
+    if (log->count < LATENCY_SAMPLES) {
+        log->samples[log->count++] = ns;
+        return;
+    }
+    log->rng ^= log->rng << 13;
+    log->rng ^= log->rng >> 7;
+    log->rng ^= log->rng << 17;
+    slot = log->rng % log->seen;
+    if (slot < LATENCY_SAMPLES) log->samples[slot] = ns;
+}
+
+/**
+ * Threads call BenchBegin once they are set up; it returns when every
+ * thread, and main, have arrived, so the clock starts with all of them
+ * ready to go. BenchDeadline is the point at which a timed run stops.
+ */
+
+static inline void BenchInit(benchConfig* bench, int numThreads)
+{
+    pthread_barrier_init(&bench->start, NULL, numThreads + 1);
+}
+
+static inline void BenchBegin(benchConfig* bench)
+{
+    pthread_barrier_wait(&bench->start);
+}
+
+static inline uint64_t BenchDeadline(const benchConfig* bench)
+{
+    return bench->duration > 0 ? bench->startNs + (uint64_t) (bench->duration * 1e9) : UINT64_MAX;
+}
+
+static inline int CompareSamples(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * LatencyPrint
+ * ------------
+ * The latency line of a report: percentiles over all the logs' samples
+ * together, or nothing if there are none.
+ */
+
+static inline void LatencyPrint(const latencyLog* const* logs, int numLogs)
+{
+    size_t total = 0, i, j, k = 0;
+    uint64_t* merged;
+    const double quantiles[] = {0.5, 0.99, 0.999};
+    const char* names[] = {"p50", "p99", "p999"};
+
+    for (i = 0; i < (size_t) numLogs; i++) total += logs[i]->count;
+    if (total == 0) return;
+
+    merged = (uint64_t*) malloc(total * sizeof(uint64_t));
+    for (i = 0; i < (size_t) numLogs; i++) {
+        memcpy(merged + k, logs[i]->samples, logs[i]->count * sizeof(uint64_t));
+        k += logs[i]->count;
+    }
+    qsort(merged, total, sizeof(uint64_t), CompareSamples);
+    printf("  latency     ");
+    for (j = 0; j < sizeof(quantiles) / sizeof(quantiles[0]); j++) {
+        size_t index = (size_t) (quantiles[j] * (total - 1));
+        printf(" %s %llu ns", names[j], (unsigned long long) merged[index]);
+    }
+    printf("\n");
+    free(merged);
+}
+
+/**
+ * BenchReport
+ * -----------
+ * Prints one block of results for ops operations completed in elapsedNs
+ * by threads whose latency logs are in logs[0..numLogs). The percentiles
+ * are taken over all the logs' samples together.
+ */
+
+static inline void BenchReport(const char* label, uint64_t ops, uint64_t elapsedNs,
+                               const latencyLog* const* logs, int numLogs)
+{
+    double seconds = elapsedNs / 1e9;
+
+    printf("%s\n", label);
+    printf("  ops          %llu\n", (unsigned long long) ops);
+    printf("  elapsed      %.6f s\n", seconds);
+    printf("  throughput   %.0f ops/s\n", seconds > 0 ? ops / seconds : 0.0);
+    printf("  time/op      %.1f ns\n", ops > 0 ? (double) elapsedNs / ops : 0.0);
+    LatencyPrint(logs, numLogs);
+}
+
+/**
+ * LatencyReport
+ * -------------
+ * Just the percentiles, for samples that aren't operations of their own,
+ * such as how long a waiting thread took to wake up.
+ */
+
+static inline void LatencyReport(const char* label, const latencyLog* const* logs, int numLogs)
+{
+    uint64_t seen = 0;
+    int i;
+
+    for (i = 0; i < numLogs; i++) seen += logs[i]->seen;
+    printf("%s\n", label);
+    printf("  samples      %llu\n", (unsigned long long) seen);
+    LatencyPrint(logs, numLogs);
+}
+
+#endif
@@ -0,0 +1,155 @@
+/**
+ * config.h
+ * --------
+ * Helpers for the examples' run-time configuration. Every setting can be
+ * given as a command-line option or through an environment variable named
+ * in the program's envOption table, the option winning when both are set,
+ * so a scaling sweep can drive either without a rebuild. Thread counts
+ * also accept "auto", which is worked out from the number of online CPUs.
+ * A bad value is reported and ends the program, like any other setup
+ * error in these examples.
+ */
+
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    const char* name;   // environment variable
+    int opt;            // the option it stands for
+} envOption;
+
+static inline int OnlineCpus(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int) cpus : 1;
+}
+
+/**
+ * ParseLong
+ * ---------
+ * Parses a whole decimal number between min and max inclusive.
+ */
+
+static inline long ParseLong(const char* arg, const char* what, long min, long max)
+{
+    char* end;
+    long value = strtol(arg, &end, 10);
+
+    if (*arg == '\0' || *end != '\0' || value < min || value > max) {
+        printf("ERROR: %s must be between %ld and %ld, got '%s'\n", what, min, max, arg);
+        exit(1);
+    }
+    return value;
+}
+
+/**
+ * ParseDouble and ParseDuration
+ * -----------------------------
+ * Parse a finite decimal number that is at least min, and a number of
+ * seconds, which has to be more than zero.
+ */
+
+static inline double ParseDouble(const char* arg, const char* what, double min)
+{
+    char* end;
+    double value = strtod(arg, &end);
+
+    if (*arg == '\0' || *end != '\0' || !isfinite(value) || value < min) {
+        printf("ERROR: %s must be a number of at least %g, got '%s'\n", what, min, arg);
+        exit(1);
+    }
+    return value;
+}
+
+static inline double ParseDuration(const char* arg, const char* what)
+{
+    char* end;
+    double value = strtod(arg, &end);
+
+    if (*arg == '\0' || *end != '\0' || !isfinite(value) || value <= 0) {
+        printf("ERROR: %s must be a number of seconds above 0, got '%s'\n", what, arg);
+        exit(1);
+    }
+    return value;
+}
+
+/**
+ * ParseThreadCount
+ * ----------------
+ * Like ParseLong, but "auto" stands for autoValue (at least one).
+ */
+
+static inline int ParseThreadCount(const char* arg, const char* what, int autoValue, int max)
+{
+    if (strcmp(arg, "auto") == 0) {
+        if (autoValue < 1) autoValue = 1;
+        return autoValue < max ? autoValue : max;
+    }
+    return (int) ParseLong(arg, what, 1, max);
+}
+
+/**
+ * ParsePowerOfTwo
+ * ---------------
+ * Parses a count that has to be a power of two, such as a ring capacity
+ * that is indexed with a mask.
+ */
+
+static inline size_t ParsePowerOfTwo(const char* arg, const char* what, long max)
+{
+    long value = ParseLong(arg, what, 1, max);
+
+    if ((value & (value - 1)) != 0) {
+        printf("ERROR: %s must be a power of two, got '%s'\n", what, arg);
+        exit(1);
+    }
+    return (size_t) value;
+}
+
+/**
+ * ParseSeed
+ * ---------
+ * Parses a 64-bit seed for the random number generators, in decimal or,
+ * with a leading 0x, in hex, as the full range of values has to round-trip
+ * through a trace header or a report.
+ */
+
+static inline uint64_t ParseSeed(const char* arg)
+{
+    char* end;
+    unsigned long long value = strtoull(arg, &end, 0);
+
+    if (*arg == '\0' || *arg == '-' || *end != '\0') {
+        printf("ERROR: seed must be a whole number, got '%s'\n", arg);
+        exit(1);
+    }
+    return (uint64_t) value;
+}
+
+/**
+ * ApplyEnvironment
+ * ----------------
+ * Feeds every variable in the table that is set to apply(ctx, ...), exactly
+ * as if it had been given as the corresponding option. Programs call this
+ * before parsing their command line so that options override the
+ * environment.
+ */
+
+static inline void ApplyEnvironment(const envOption* table, size_t count,
+                                    void (*apply)(void* ctx, int opt, const char* arg), void* ctx)
+{
+    size_t i;
+    const char* value;
+
+    for (i = 0; i < count; i++)
+        if ((value = getenv(table[i].name)) != NULL && *value != '\0') apply(ctx, table[i].opt, value);
+}
+
+#endif
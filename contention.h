@@ -0,0 +1,181 @@
+/**
+ * contention.h
+ * ------------
+ * Counters for what a thread goes through at a lock, or anywhere else it
+ * may have to wait its turn: how often it got through, how often it found
+ * the way blocked, how long it waited and how long it held on once it was
+ * in. Every thread keeps its own contentionStats, which starts on its own
+ * cache line, so counting never touches a line another thread writes.
+ * The counters are added up into a table once the threads are done, and
+ * can also be written out as JSON.
+ *
+ * Times come from CLOCK_MONOTONIC_RAW, which NTP never slews, so a wait
+ * measured while the clock was being adjusted is not stretched or
+ * squeezed.
+ */
+
+#ifndef _CONTENTION_H
+#define _CONTENTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "locks.h"
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) long acquisitions;
+    long contended;     // acquisitions that could not go straight through
+    uint64_t waitNs;
+    uint64_t maxWaitNs;
+    uint64_t holdNs;
+    uint64_t maxHoldNs;
+    uint64_t since;     // when the current hold began
+} contentionStats;
+
+static inline uint64_t RawNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// the start of an acquisition, for ContentionAcquired; 0 when not counting
+static inline uint64_t ContentionStart(const contentionStats* c)
+{
+    return c != NULL ? RawNowNs() : 0;
+}
+
+/**
+ * ContentionAcquired and ContentionReleased
+ * -----------------------------------------
+ * Bracket one hold: the first ends the wait that began at start and
+ * starts the hold, the second ends the hold. Both do nothing when c is
+ * NULL, so callers can pass NULL when they aren't counting.
+ */
+
+static inline void ContentionAcquired(contentionStats* c, uint64_t start, bool contended)
+{
+    uint64_t now, wait;
+
+    if (c == NULL) return;
+    now = RawNowNs();
+    wait = now - start;
+    c->acquisitions++;
+    c->contended += contended;
+    c->waitNs += wait;
+    if (wait > c->maxWaitNs) c->maxWaitNs = wait;
+    c->since = now;
+}
+
+static inline void ContentionReleased(contentionStats* c)
+{
+    uint64_t hold;
+
+    if (c == NULL) return;
+    hold = RawNowNs() - c->since;
+    c->holdNs += hold;
+    if (hold > c->maxHoldNs) c->maxHoldNs = hold;
+}
+
+/**
+ * ContentionAcquire and ContentionRelease
+ * ---------------------------------------
+ * LockAcquire and LockRelease, counted in c. An acquisition is contended
+ * when LockTryAcquire fails and the thread has to wait in LockAcquire.
+ */
+
+static inline void ContentionAcquire(strategyLock* lock, lockNode* node, contentionStats* c)
+{
+    uint64_t start = ContentionStart(c);
+    bool contended = false;
+
+    if (c == NULL || !LockTryAcquire(lock, node)) {
+        contended = c != NULL;
+        LockAcquire(lock, node);
+    }
+    ContentionAcquired(c, start, contended);
+}
+
+static inline void ContentionRelease(strategyLock* lock, lockNode* node, contentionStats* c)
+{
+    ContentionReleased(c);
+    LockRelease(lock, node);
+}
+
+static inline void ContentionAdd(contentionStats* total, const contentionStats* c)
+{
+    total->acquisitions += c->acquisitions;
+    total->contended += c->contended;
+    total->waitNs += c->waitNs;
+    total->holdNs += c->holdNs;
+    if (c->maxWaitNs > total->maxWaitNs) total->maxWaitNs = c->maxWaitNs;
+    if (c->maxHoldNs > total->maxHoldNs) total->maxHoldNs = c->maxHoldNs;
+}
+
+static inline void ContentionRow(const char* name, const contentionStats* c)
+{
+    printf("  %-20s %12ld %12ld %6.1f%% %10.1f %12llu %10.1f %12llu\n", name, c->acquisitions, c->contended,
+           c->acquisitions > 0 ? 100.0 * c->contended / c->acquisitions : 0.0,
+           c->acquisitions > 0 ? (double) c->waitNs / c->acquisitions : 0.0, (unsigned long long) c->maxWaitNs,
+           c->acquisitions > 0 ? (double) c->holdNs / c->acquisitions : 0.0, (unsigned long long) c->maxHoldNs);
+}
+
+/**
+ * ContentionReport
+ * ----------------
+ * A table with one row per thread, stats[i] belonging to names[i], and a
+ * row for all of them together. Times are in nanoseconds.
+ */
+
+static inline void ContentionReport(const char* label, const contentionStats* const* stats,
+                                    const char* const* names, int n)
+{
+    contentionStats total = {0};
+    int i;
+
+    printf("%s\n", label);
+    printf("  %-20s %12s %12s %7s %10s %12s %10s %12s\n", "thread", "acquired", "contended", "", "wait avg",
+           "wait max", "hold avg", "hold max");
+    for (i = 0; i < n; i++) {
+        ContentionRow(names[i], stats[i]);
+        ContentionAdd(&total, stats[i]);
+    }
+    if (n > 1) ContentionRow("total", &total);
+}
+
+static inline void ContentionJsonFields(FILE* out, const contentionStats* c)
+{
+    fprintf(out, "\"acquisitions\": %ld, \"contended\": %ld, \"wait_ns\": %llu, \"max_wait_ns\": %llu, "
+                 "\"hold_ns\": %llu, \"max_hold_ns\": %llu",
+            c->acquisitions, c->contended, (unsigned long long) c->waitNs, (unsigned long long) c->maxWaitNs,
+            (unsigned long long) c->holdNs, (unsigned long long) c->maxHoldNs);
+}
+
+/**
+ * ContentionJson
+ * --------------
+ * The same table as one JSON object, {"section": label, "threads": [...],
+ * "total": {...}}. Thread names are the examples' own and need no
+ * escaping. The caller writes whatever surrounds the object.
+ */
+
+static inline void ContentionJson(FILE* out, const char* label, const contentionStats* const* stats,
+                                  const char* const* names, int n)
+{
+    contentionStats total = {0};
+    int i;
+
+    fprintf(out, "    {\"section\": \"%s\", \"threads\": [\n", label);
+    for (i = 0; i < n; i++) {
+        fprintf(out, "      {\"name\": \"%s\", ", names[i]);
+        ContentionJsonFields(out, stats[i]);
+        fprintf(out, "}%s\n", i + 1 < n ? "," : "");
+        ContentionAdd(&total, stats[i]);
+    }
+    fprintf(out, "    ], \"total\": {");
+    ContentionJsonFields(out, &total);
+    fprintf(out, "}}");
+}
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * deque.h
+ * -------
+ * A fixed-capacity Chase-Lev work-stealing deque, following the C11
+ * formulation of Lê, Pop, Cohen and Zappa Nardelli ("Correct and Efficient
+ * Work-Stealing for Weak Memory Models", PPoPP 2013). The owner thread
+ * pushes and takes at the bottom without any read-modify-write in the
+ * common case; any number of thieves steal from the top with a single
+ * compare-and-swap, and only a take that races a steal for the very last
+ * item needs one too. The array does not grow: DequePush reports a full
+ * deque and leaves it to the owner to decide what to do with the item.
+ */
+
+#ifndef _DEQUE_H
+#define _DEQUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+typedef enum {
+    STEAL_OK,
+    STEAL_EMPTY,
+    STEAL_ABORT     // lost a race with another thief or the owner; worth retrying
+} stealResult;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_long top;      // advanced by thieves
+    _Alignas(CACHE_LINE_SIZE) atomic_long bottom;   // moved by the owner
+    _Atomic int64_t* items;
+    long mask;
+} workDeque;
+
+static inline void DequeInit(workDeque* d, long capacity)
+{
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+    d->items = (_Atomic int64_t*) calloc(capacity, sizeof(int64_t));
+    d->mask = capacity - 1;
+}
+
+static inline void DequeDestroy(workDeque* d)
+{
+    free((void*) d->items);
+}
+
+/**
+ * DequePush
+ * ---------
+ * Owner only. Returns false if the deque is full.
+ */
+
+static inline bool DequePush(workDeque* d, int64_t item)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+
+    if (b - t > d->mask) return false;
+    atomic_store_explicit(&d->items[b & d->mask], item, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return true;
+}
+
+/**
+ * DequeTake
+ * ---------
+ * Owner only: pops the most recently pushed item. The owner first claims
+ * the bottom slot and then looks at top; if that leaves exactly one item
+ * a thief may be after it too, and the compare-and-swap on top decides.
+ */
+
+static inline bool DequeTake(workDeque* d, int64_t* item)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    long t;
+    bool taken = true;
+
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return false;
+    }
+    *item = atomic_load_explicit(&d->items[b & d->mask], memory_order_relaxed);
+    if (t == b) {
+        taken = atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                        memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return taken;
+}
+
+/**
+ * DequeSteal
+ * ----------
+ * Any thread: takes the oldest item.
+ */
+
+static inline stealResult DequeSteal(workDeque* d, int64_t* item)
+{
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    long b;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b) return STEAL_EMPTY;
+    *item = atomic_load_explicit(&d->items[t & d->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+        return STEAL_ABORT;
+    return STEAL_OK;
+}
+
+static inline bool DequeEmpty(workDeque* d)
+{
+    return atomic_load_explicit(&d->top, memory_order_acquire) >=
+           atomic_load_explicit(&d->bottom, memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,177 @@
+/**
+ * epoch.h
+ * -------
+ * Epoch-based reclamation, after Fraser ("Practical lock-freedom", 2004),
+ * for lock-free structures whose nodes come from the heap. A thread that
+ * unlinks a node cannot free it straight away, since another thread may
+ * have read a pointer to it just before and still be looking at it.
+ * Instead it retires the node, and the node is freed once every thread
+ * that could have seen it has moved on.
+ *
+ * Every thread that touches the structure brackets its accesses with
+ * EpochEnter and EpochExit. On entry it announces the global epoch it saw.
+ * The epoch only advances when every thread inside has announced the
+ * current one. So by the time it has advanced twice past the epoch a node
+ * was retired in, no thread can still hold a pointer to that node. Each
+ * thread keeps three limbo lists, one per epoch modulo three, and frees a
+ * whole list at once when it finds the epoch has moved that far. Nothing
+ * here costs an atomic operation per node: entering is one store and a fence,
+ * retiring is a push onto a list of the thread's own, and only every
+ * EPOCH_BATCH retirements does a thread try to advance the epoch, which
+ * reads every other thread's announcement.
+ *
+ * A retired node has to start with an epochNode, and is freed with free().
+ * A thread that stops entering holds back its last two lists until
+ * EpochDrain, when no thread may be inside.
+ */
+
+#ifndef _EPOCH_H
+#define _EPOCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#define EPOCH_BATCH 64          // retirements between attempts to advance the epoch
+#define EPOCH_ACTIVE 1          // in a thread's state while it is inside
+
+typedef struct epochNode {
+    struct epochNode* next;
+} epochNode;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t state;  // epoch << 1 | EPOCH_ACTIVE inside, 0 outside
+    uint64_t epoch;             // the global epoch as of the last EpochEnter
+    epochNode* limbo[3];        // what was retired in epoch e waits in limbo[e % 3]
+    uint64_t limboEpoch[3];
+    int sinceAdvance;
+    long retired;
+    long freed;
+    long batches;               // limbo lists freed, each in one go
+} epochThread;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t epoch;
+    epochThread** threads;
+    int numThreads;
+    atomic_long advances;
+} epochDomain;
+
+static inline void EpochThreadInit(epochThread* t)
+{
+    memset(t, 0, sizeof(*t));
+    atomic_init(&t->state, 0);
+}
+
+// threads[0..n) are every thread that will ever enter the domain
+static inline void EpochInit(epochDomain* d, epochThread** threads, int n)
+{
+    atomic_init(&d->epoch, 0);
+    atomic_init(&d->advances, 0);
+    d->threads = threads;
+    d->numThreads = n;
+}
+
+static inline void EpochFreeList(epochThread* t, int slot)
+{
+    epochNode* node = t->limbo[slot];
+    epochNode* next;
+
+    if (node == NULL) return;
+    for (; node != NULL; node = next) {
+        next = node->next;
+        free(node);
+        t->freed++;
+    }
+    t->limbo[slot] = NULL;
+    t->batches++;
+}
+
+/**
+ * EpochEnter
+ * ----------
+ * Announces the current epoch. The fence keeps the announcement ahead of
+ * every pointer the thread goes on to read. If the epoch has moved since
+ * the thread was last inside, any of its lists retired two or more epochs
+ * ago are freed.
+ */
+
+static inline void EpochEnter(epochDomain* d, epochThread* t)
+{
+    uint64_t epoch = atomic_load_explicit(&d->epoch, memory_order_relaxed);
+    int slot;
+
+    atomic_store_explicit(&t->state, epoch << 1 | EPOCH_ACTIVE, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (epoch == t->epoch) return;
+    t->epoch = epoch;
+    for (slot = 0; slot < 3; slot++)
+        if (t->limbo[slot] != NULL && epoch - t->limboEpoch[slot] >= 2) EpochFreeList(t, slot);
+}
+
+static inline void EpochExit(epochThread* t)
+{
+    atomic_store_explicit(&t->state, 0, memory_order_release);
+}
+
+/**
+ * EpochTryAdvance
+ * ---------------
+ * Moves the global epoch on by one if every thread inside has announced
+ * it. Returns whether it moved, by this thread or another.
+ */
+
+static inline bool EpochTryAdvance(epochDomain* d)
+{
+    uint64_t epoch = atomic_load_explicit(&d->epoch, memory_order_acquire), state;
+    int i;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    for (i = 0; i < d->numThreads; i++) {
+        state = atomic_load_explicit(&d->threads[i]->state, memory_order_acquire);
+        if ((state & EPOCH_ACTIVE) && state >> 1 != epoch) return false;
+    }
+    if (atomic_compare_exchange_strong_explicit(&d->epoch, &epoch, epoch + 1,
+                                                memory_order_acq_rel, memory_order_relaxed))
+        atomic_fetch_add_explicit(&d->advances, 1, memory_order_relaxed);
+    return true;
+}
+
+/**
+ * EpochRetire
+ * -----------
+ * Hands over a node that the calling thread, which must be inside, has
+ * just unlinked. A list still waiting in the same slot is from three or
+ * more epochs ago, so it is freed first.
+ */
+
+static inline void EpochRetire(epochDomain* d, epochThread* t, epochNode* node)
+{
+    int slot = (int) (t->epoch % 3);
+
+    if (t->limbo[slot] != NULL && t->limboEpoch[slot] != t->epoch) EpochFreeList(t, slot);
+    t->limboEpoch[slot] = t->epoch;
+    node->next = t->limbo[slot];
+    t->limbo[slot] = node;
+    t->retired++;
+    if (++t->sinceAdvance >= EPOCH_BATCH) {
+        t->sinceAdvance = 0;
+        EpochTryAdvance(d);
+    }
+}
+
+// frees everything the thread still holds, once no thread is inside
+static inline void EpochDrain(epochThread* t)
+{
+    int slot;
+
+    for (slot = 0; slot < 3; slot++) EpochFreeList(t, slot);
+}
+
+#endif
@@ -0,0 +1,116 @@
+/**
+ * futex.h
+ * -------
+ * Thin wrappers around the Linux futex system call, shared by the examples
+ * that want to park threads in the kernel without going through a full
+ * semaphore. A futex is just a 32-bit word: FutexWait sleeps only if the
+ * word still holds the value the caller last saw, and FutexWake wakes up to
+ * count sleepers, so the check-then-sleep race is resolved by the kernel.
+ */
+
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static inline void FutexWait(atomic_int* addr, int expected)
+{
+    syscall(SYS_futex, (int*) addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static inline void FutexWake(atomic_int* addr, int count)
+{
+    syscall(SYS_futex, (int*) addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/**
+ * futexCounter
+ * ------------
+ * A counting semaphore that can be taken and given many units at a time.
+ * CounterTake blocks only while the count is zero and then takes as many
+ * units as are available, up to max; CounterGive adds n units and issues
+ * at most one wake-up call, and none at all when nobody is waiting.
+ * Waiters announce themselves before sleeping and givers check for them
+ * after adding, both sequentially consistent, so a give can never slip in
+ * between a taker's last look at the count and its sleep unnoticed.
+ *
+ * CounterClose marks the counter as closed by setting COUNTER_CLOSED in
+ * the futex word itself and wakes every waiter with one call. From then
+ * on CounterTake still hands out whatever units are left, but returns 0
+ * instead of waiting once there are none. Since the close changes the
+ * word, a taker that was just about to sleep on a count of zero finds it
+ * changed and cannot miss it.
+ */
+
+#define COUNTER_CLOSED (1 << 30)
+
+typedef struct {
+    atomic_int value;   // the count, with COUNTER_CLOSED once closed
+    atomic_int waiters;
+} futexCounter;
+
+static inline void CounterInit(futexCounter* c, int value)
+{
+    atomic_init(&c->value, value);
+    atomic_init(&c->waiters, 0);
+}
+
+static inline int CounterTake(futexCounter* c, int max)
+{
+    int value = atomic_load(&c->value);
+
+    for (;;) {
+        if (value == COUNTER_CLOSED) return 0;
+        if (value == 0) {
+            atomic_fetch_add(&c->waiters, 1);
+            FutexWait(&c->value, 0);
+            atomic_fetch_sub(&c->waiters, 1);
+            value = atomic_load(&c->value);
+            continue;
+        }
+        int count = value & ~COUNTER_CLOSED;
+        int take = count < max ? count : max;
+        if (atomic_compare_exchange_weak(&c->value, &value, value - take)) return take;
+    }
+}
+
+// takes exactly n units if that many are there, without ever waiting
+static inline bool CounterTryTake(futexCounter* c, int n)
+{
+    int value = atomic_load(&c->value);
+
+    while ((value & ~COUNTER_CLOSED) >= n)
+        if (atomic_compare_exchange_weak(&c->value, &value, value - n)) return true;
+    return false;
+}
+
+// the units there are right now, closed or not
+static inline int CounterCount(const futexCounter* c)
+{
+    return atomic_load_explicit(&c->value, memory_order_relaxed) & ~COUNTER_CLOSED;
+}
+
+static inline void CounterGive(futexCounter* c, int n)
+{
+    atomic_fetch_add(&c->value, n);
+    if (atomic_load(&c->waiters) > 0) FutexWake(&c->value, n);
+}
+
+static inline void CounterClose(futexCounter* c)
+{
+    atomic_fetch_or(&c->value, COUNTER_CLOSED);
+    if (atomic_load(&c->waiters) > 0) FutexWake(&c->value, INT_MAX);
+}
+
+// for the next round: takes the close back, which nobody may be waiting on any more
+static inline void CounterReopen(futexCounter* c)
+{
+    atomic_fetch_and(&c->value, ~COUNTER_CLOSED);
+}
+
+#endif
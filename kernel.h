@@ -0,0 +1,413 @@
+/**
+ * kernel.h
+ * --------
+ * Byte kernels for the consumers to run over what they take from the
+ * channel, so that processing can be real work over real bytes instead of
+ * a sleep or a spin, and a run shows whether it is bound by the handoffs
+ * or by the work done with what was handed off:
+ *
+ *   checksum    Adler's two running sums, the byte total and the total of
+ *               the prefix totals, without the modulus
+ *   fold        ASCII case folding into a scratch block, counting the
+ *               letters it folded
+ *   histogram   a count of every byte value
+ *
+ * The checksum and fold kernels come in a scalar version and vector ones:
+ * AVX2 and AVX-512 on x86-64 and NEON on AArch64. KernelSelect picks the
+ * widest the CPU supports, or the one named, once at startup, and the
+ * chosen version's function pointer is what the consumers call. A
+ * histogram does not vectorize on any of these, since lanes that hit the
+ * same bin would lose each other's counts, so it is only ever scalar; it
+ * spreads a long run over four tables to keep consecutive equal bytes
+ * from waiting on each other's increments.
+ *
+ * Every kernel works through its input a KERNEL_CHUNK at a time, which
+ * keeps the vector versions' narrow accumulators from overflowing and
+ * gives fold a scratch block that stays in the L1 cache.
+ */
+
+#ifndef _KERNEL_H
+#define _KERNEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#define KERNEL_CHUNK 4096
+#define KERNEL_SPREAD_MIN 1024      // shortest run worth four histogram tables
+
+typedef enum {
+    KERNEL_CHECKSUM,
+    KERNEL_FOLD,
+    KERNEL_HISTOGRAM
+} kernelKind;
+
+typedef enum {
+    ISA_SCALAR,
+    ISA_AVX2,
+    ISA_AVX512,
+    ISA_NEON,
+    ISA_AUTO
+} kernelIsa;
+
+static const char* const kernelNames[] = {"checksum", "fold", "histogram"};
+static const char* const isaNames[] = {"scalar", "avx2", "avx512", "neon", "auto"};
+
+// a consumer's own: the histogram a run adds up in and fold's output
+typedef struct {
+    uint64_t histogram[256];
+    _Alignas(CACHE_LINE_SIZE) uint8_t block[KERNEL_CHUNK];
+} kernelState;
+
+typedef uint64_t (*kernelFn)(const uint8_t* bytes, size_t n, kernelState* state);
+
+typedef struct {
+    kernelKind kind;
+    kernelIsa isa;
+    kernelFn run;       // NULL when no kernel was asked for
+} byteKernel;
+
+static inline uint64_t ChecksumScalar(const uint8_t* bytes, size_t n, kernelState* state)
+{
+    uint64_t s1 = 0, s2 = 0;
+    size_t i;
+
+    (void) state;
+    for (i = 0; i < n; i++) {
+        s1 += bytes[i];
+        s2 += s1;
+    }
+    return s2 << 24 ^ s1;
+}
+
+// folds n bytes into out and returns how many were upper case
+static inline uint64_t FoldBytes(const uint8_t* bytes, uint8_t* out, size_t n)
+{
+    uint64_t folded = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        bool upper = (uint8_t) (bytes[i] - 'A') < 26;
+
+        out[i] = bytes[i] | (upper ? 0x20 : 0);
+        folded += upper;
+    }
+    return folded;
+}
+
+static inline uint64_t FoldScalar(const uint8_t* bytes, size_t n, kernelState* state)
+{
+    uint64_t folded = 0;
+    size_t i, length;
+
+    for (i = 0; i < n; i += length) {
+        length = n - i < KERNEL_CHUNK ? n - i : KERNEL_CHUNK;
+        folded += FoldBytes(bytes + i, state->block, length);
+    }
+    return folded;
+}
+
+static inline uint64_t HistogramScalar(const uint8_t* bytes, size_t n, kernelState* state)
+{
+    uint32_t tables[4][256];
+    size_t i, length, j;
+    int b;
+
+    if (n < KERNEL_SPREAD_MIN) {
+        for (i = 0; i < n; i++) state->histogram[bytes[i]]++;
+        return n > 0 ? state->histogram[bytes[n - 1]] : 0;
+    }
+    for (i = 0; i < n; i += length) {
+        length = n - i < KERNEL_CHUNK ? n - i : KERNEL_CHUNK;
+        memset(tables, 0, sizeof(tables));
+        for (j = 0; j + 4 <= length; j += 4) {
+            tables[0][bytes[i + j]]++;
+            tables[1][bytes[i + j + 1]]++;
+            tables[2][bytes[i + j + 2]]++;
+            tables[3][bytes[i + j + 3]]++;
+        }
+        for (; j < length; j++) tables[0][bytes[i + j]]++;
+        for (b = 0; b < 256; b++) state->histogram[b] += tables[0][b] + tables[1][b] + tables[2][b] + tables[3][b];
+    }
+    return state->histogram[bytes[n - 1]];
+}
+
+#if defined(__x86_64__)
+
+/**
+ * ChecksumAvx2
+ * ------------
+ * Takes 32 bytes a step. Over a step the second sum grows by 32 times the
+ * first as it stood before it plus each byte weighted by how many of the
+ * step's prefixes it is in, 32 for the first down to 1 for the last, which
+ * maddubs and madd add up lane by lane. The first sum as it stood before
+ * each step is added up in before, to be multiplied out once a chunk.
+ */
+
+__attribute__((target("avx2")))
+static uint64_t ChecksumAvx2(const uint8_t* bytes, size_t n, kernelState* state)
+{
+    const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                             16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i ones = _mm256_set1_epi16(1), zero = _mm256_setzero_si256();
+    uint64_t s1 = 0, s2 = 0, lanes[4];
+    uint32_t weighted[8];
+    size_t i = 0, j, length;
+    int k;
+
+    (void) state;
+    for (; i + 32 <= n; i += length) {
+        __m256i sum = zero, before = zero, weight = zero;
+
+        length = (n - i < KERNEL_CHUNK ? n - i : KERNEL_CHUNK) & ~(size_t) 31;
+        for (j = 0; j < length; j += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) (bytes + i + j));
+
+            before = _mm256_add_epi64(before, sum);
+            sum = _mm256_add_epi64(sum, _mm256_sad_epu8(v, zero));
+            weight = _mm256_add_epi32(weight, _mm256_madd_epi16(_mm256_maddubs_epi16(v, weights), ones));
+        }
+        s2 += s1 * length;
+        _mm256_storeu_si256((__m256i*) lanes, before);
+        for (k = 0; k < 4; k++) s2 += 32 * lanes[k];
+        _mm256_storeu_si256((__m256i*) weighted, weight);
+        for (k = 0; k < 8; k++) s2 += weighted[k];
+        _mm256_storeu_si256((__m256i*) lanes, sum);
+        for (k = 0; k < 4; k++) s1 += lanes[k];
+    }
+    for (; i < n; i++) {
+        s1 += bytes[i];
+        s2 += s1;
+    }
+    return s2 << 24 ^ s1;
+}
+
+__attribute__((target("avx2")))
+static uint64_t FoldAvx2(const uint8_t* bytes, size_t n, kernelState* state)
+{
+    // 'A'..'Z' moved to the bottom of the signed range, so one compare finds them
+    const __m256i shift = _mm256_set1_epi8((char) (0x80 - 'A')), limit = _mm256_set1_epi8((char) (0x80 + 26 - 0x100));
+    const __m256i bit = _mm256_set1_epi8(0x20);
+    uint64_t folded = 0;
+    size_t i, j, length;
+
+    for (i = 0; i < n; i += length) {
+        length = n - i < KERNEL_CHUNK ? n - i : KERNEL_CHUNK;
+        for (j = 0; j + 32 <= length; j += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) (bytes + i + j));
+            __m256i upper = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(v, shift));
+
+            _mm256_store_si256((__m256i*) (state->block + j), _mm256_or_si256(v, _mm256_and_si256(upper, bit)));
+            folded += __builtin_popcount((unsigned int) _mm256_movemask_epi8(upper));
+        }
+        folded += FoldBytes(bytes + i + j, state->block + j, length - j);
+    }
+    return folded;
+}
+
+// ChecksumAvx2 64 bytes a step, with weights from 64 down to 1
+__attribute__((target("avx512f,avx512bw")))
+static uint64_t ChecksumAvx512(const uint8_t* bytes, size_t n, kernelState* state)
+{
+    const __m512i weights = _mm512_set_epi8(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                                            17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32,
+                                            33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48,
+                                            49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64);
+    const __m512i ones = _mm512_set1_epi16(1), zero = _mm512_setzero_si512();
+    uint64_t s1 = 0, s2 = 0;
+    size_t i = 0, j, length;
+
+    (void) state;
+    for (; i + 64 <= n; i += length) {
+        __m512i sum = zero, before = zero, weight = zero;
+
+        length = (n - i < KERNEL_CHUNK ? n - i : KERNEL_CHUNK) & ~(size_t) 63;
+        for (j = 0; j < length; j += 64) {
+            __m512i v = _mm512_loadu_si512((const void*) (bytes + i + j));
+
+            before = _mm512_add_epi64(before, sum);
+            sum = _mm512_add_epi64(sum, _mm512_sad_epu8(v, zero));
+            weight = _mm512_add_epi32(weight, _mm512_madd_epi16(_mm512_maddubs_epi16(v, weights), ones));
+        }
+        s2 += s1 * length + 64 * (uint64_t) _mm512_reduce_add_epi64(before) +
+              (uint32_t) _mm512_reduce_add_epi32(weight);
+        s1 += (uint64_t) _mm512_reduce_add_epi64(sum);
+    }
+    for (; i < n; i++) {
+        s1 += bytes[i];
+        s2 += s1;
+    }
+    return s2 << 24 ^ s1;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint64_t FoldAvx512(const uint8_t* bytes, size_t n, kernelState* state)
+{
+    const __m512i first = _mm512_set1_epi8('A'), letters = _mm512_set1_epi8(25), bit = _mm512_set1_epi8(0x20);
+    uint64_t folded = 0;
+    size_t i, j, length;
+
+    for (i = 0; i < n; i += length) {
+        length = n - i < KERNEL_CHUNK ? n - i : KERNEL_CHUNK;
+        for (j = 0; j + 64 <= length; j += 64) {
+            __m512i v = _mm512_loadu_si512((const void*) (bytes + i + j));
+            __mmask64 upper = _mm512_cmple_epu8_mask(_mm512_sub_epi8(v, first), letters);
+
+            _mm512_store_si512((void*) (state->block + j), _mm512_or_si512(v, _mm512_maskz_mov_epi8(upper, bit)));
+            folded += __builtin_popcountll(upper);
+        }
+        folded += FoldBytes(bytes + i + j, state->block + j, length - j);
+    }
+    return folded;
+}
+
+#elif defined(__aarch64__)
+
+// ChecksumAvx2 16 bytes a step, with weights from 16 down to 1
+static uint64_t ChecksumNeon(const uint8_t* bytes, size_t n, kernelState* state)
+{
+    static const uint8_t steps[16] = {16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+    const uint8x16_t weights = vld1q_u8(steps);
+    uint64_t s1 = 0, s2 = 0;
+    size_t i = 0, j, length;
+
+    (void) state;
+    for (; i + 16 <= n; i += length) {
+        uint32x4_t sum = vdupq_n_u32(0), before = vdupq_n_u32(0), weight = vdupq_n_u32(0);
+
+        length = (n - i < KERNEL_CHUNK ? n - i : KERNEL_CHUNK) & ~(size_t) 15;
+        for (j = 0; j < length; j += 16) {
+            uint8x16_t v = vld1q_u8(bytes + i + j);
+
+            before = vaddq_u32(before, sum);
+            sum = vpadalq_u16(sum, vpaddlq_u8(v));
+            weight = vpadalq_u16(weight, vmull_u8(vget_low_u8(v), vget_low_u8(weights)));
+            weight = vpadalq_u16(weight, vmull_u8(vget_high_u8(v), vget_high_u8(weights)));
+        }
+        s2 += s1 * length + 16 * (uint64_t) vaddvq_u32(before) + vaddvq_u32(weight);
+        s1 += vaddvq_u32(sum);
+    }
+    for (; i < n; i++) {
+        s1 += bytes[i];
+        s2 += s1;
+    }
+    return s2 << 24 ^ s1;
+}
+
+static uint64_t FoldNeon(const uint8_t* bytes, size_t n, kernelState* state)
+{
+    const uint8x16_t first = vdupq_n_u8('A'), letters = vdupq_n_u8(25), bit = vdupq_n_u8(0x20);
+    uint64_t folded = 0;
+    size_t i, j, length;
+
+    for (i = 0; i < n; i += length) {
+        length = n - i < KERNEL_CHUNK ? n - i : KERNEL_CHUNK;
+        for (j = 0; j + 16 <= length; j += 16) {
+            uint8x16_t v = vld1q_u8(bytes + i + j);
+            uint8x16_t upper = vcleq_u8(vsubq_u8(v, first), letters);
+
+            vst1q_u8(state->block + j, vorrq_u8(v, vandq_u8(upper, bit)));
+            folded += vaddvq_u8(vshrq_n_u8(upper, 7));
+        }
+        folded += FoldBytes(bytes + i + j, state->block + j, length - j);
+    }
+    return folded;
+}
+
+#endif
+
+static inline bool KernelIsaSupported(kernelIsa isa)
+{
+    switch (isa) {
+    case ISA_SCALAR:
+        return true;
+#if defined(__x86_64__)
+    case ISA_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case ISA_AVX512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#elif defined(__aarch64__)
+    case ISA_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+/**
+ * KernelFromName
+ * --------------
+ * Parses KIND or KIND:ISA, such as "checksum" or "fold:scalar", into k,
+ * leaving the version to KernelSelect. Returns false for a name it
+ * doesn't know.
+ */
+
+static inline bool KernelFromName(const char* spec, byteKernel* k)
+{
+    const char* colon = strchr(spec, ':');
+    size_t length = colon != NULL ? (size_t) (colon - spec) : strlen(spec), i;
+
+    k->isa = ISA_AUTO;
+    k->run = NULL;
+    for (i = 0; i < sizeof(kernelNames) / sizeof(kernelNames[0]); i++)
+        if (strlen(kernelNames[i]) == length && strncmp(spec, kernelNames[i], length) == 0) break;
+    if (i == sizeof(kernelNames) / sizeof(kernelNames[0])) return false;
+    k->kind = (kernelKind) i;
+    if (colon == NULL) return true;
+    for (i = 0; i < sizeof(isaNames) / sizeof(isaNames[0]); i++)
+        if (strcmp(colon + 1, isaNames[i]) == 0) {
+            k->isa = (kernelIsa) i;
+            return true;
+        }
+    return false;
+}
+
+/**
+ * KernelSelect
+ * ------------
+ * Fills in the version of k's kind to run: the one k names, or with
+ * ISA_AUTO the widest this CPU supports. Returns false if the CPU does not
+ * support the one named. A histogram is always the scalar version.
+ */
+
+static inline bool KernelSelect(byteKernel* k)
+{
+    static const kernelFn versions[3][4] = {
+#if defined(__x86_64__)
+        {ChecksumScalar, ChecksumAvx2, ChecksumAvx512, NULL},
+        {FoldScalar, FoldAvx2, FoldAvx512, NULL},
+#elif defined(__aarch64__)
+        {ChecksumScalar, NULL, NULL, ChecksumNeon},
+        {FoldScalar, NULL, NULL, FoldNeon},
+#else
+        {ChecksumScalar, NULL, NULL, NULL},
+        {FoldScalar, NULL, NULL, NULL},
+#endif
+        {HistogramScalar, NULL, NULL, NULL}
+    };
+    int isa;
+
+    if (k->kind == KERNEL_HISTOGRAM && k->isa != ISA_AUTO) k->isa = ISA_SCALAR;
+    if (k->isa == ISA_AUTO) {
+        for (isa = ISA_NEON; isa > ISA_SCALAR; isa--)
+            if (versions[k->kind][isa] != NULL && KernelIsaSupported((kernelIsa) isa)) break;
+        k->isa = (kernelIsa) isa;
+    }
+    if (versions[k->kind][k->isa] == NULL || !KernelIsaSupported(k->isa)) return false;
+    k->run = versions[k->kind][k->isa];
+    return true;
+}
+
+#endif
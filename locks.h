@@ -0,0 +1,272 @@
+/**
+ * locks.h
+ * -------
+ * A small family of mutual exclusion locks behind one interface, so that
+ * a critical section can be written once and the primitive guarding it
+ * picked at run time:
+ *
+ *   sem       a binary semaphore, the classic sem_wait/sem_post lock
+ *   mutex     a default pthread_mutex_t
+ *   adaptive  a pthread_mutex_t that spins briefly before sleeping
+ *   spin      a pthread_spinlock_t, which never sleeps
+ *   ticket    a FIFO spinlock: take a number, wait for it to be served
+ *   mcs       the Mellor-Crummey/Scott queue lock, in which every waiter
+ *             spins on its own node so a release touches only the next
+ *             waiter's cache line
+ *
+ * Every thread that uses a strategyLock passes its own lockNode to
+ * LockAcquire and LockRelease. Only the MCS lock needs it, but requiring
+ * it of every strategy keeps the calling code identical for all of them.
+ * Users must define _GNU_SOURCE before their first #include for the
+ * adaptive mutex type to be visible.
+ */
+
+#ifndef _LOCKS_H
+#define _LOCKS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CpuRelax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CpuRelax() __asm__ __volatile__("yield")
+#else
+#define CpuRelax() ((void) 0)
+#endif
+
+typedef enum {
+    LOCK_SEM,
+    LOCK_MUTEX,
+    LOCK_ADAPTIVE,
+    LOCK_SPIN,
+    LOCK_TICKET,
+    LOCK_MCS,
+    NUM_LOCK_KINDS
+} lockKind;
+
+static const char* const lockNames[NUM_LOCK_KINDS] = {
+    "sem", "mutex", "adaptive", "spin", "ticket", "mcs"
+};
+
+typedef struct lockNode {
+    _Alignas(CACHE_LINE_SIZE) _Atomic(struct lockNode*) next;
+    atomic_bool locked;
+} lockNode;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_uint next;     // next number to hand out
+    _Alignas(CACHE_LINE_SIZE) atomic_uint serving;  // number allowed in
+} ticketLock;
+
+typedef struct {
+    lockKind kind;
+    union {
+        sem_t sem;
+        pthread_mutex_t mutex;
+        pthread_spinlock_t spin;
+        ticketLock ticket;
+        _Atomic(lockNode*) mcsTail;
+    } u;
+} strategyLock;
+
+/**
+ * LockKindFromName
+ * ----------------
+ * Maps a strategy name as listed above to its lockKind, or returns -1 if
+ * the name is not known.
+ */
+
+static inline int LockKindFromName(const char* name)
+{
+    int i;
+
+    for (i = 0; i < NUM_LOCK_KINDS; i++)
+        if (strcmp(name, lockNames[i]) == 0) return i;
+    return -1;
+}
+
+static inline void LockInit(strategyLock* lock, lockKind kind)
+{
+    pthread_mutexattr_t attr;
+
+    memset(lock, 0, sizeof(*lock));
+    lock->kind = kind;
+    switch (kind) {
+    case LOCK_SEM:
+        sem_init(&lock->u.sem, 0, 1);
+        break;
+    case LOCK_MUTEX:
+        pthread_mutex_init(&lock->u.mutex, NULL);
+        break;
+    case LOCK_ADAPTIVE:
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+        pthread_mutex_init(&lock->u.mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+        break;
+    case LOCK_SPIN:
+        pthread_spin_init(&lock->u.spin, PTHREAD_PROCESS_PRIVATE);
+        break;
+    case LOCK_TICKET:
+        atomic_init(&lock->u.ticket.next, 0);
+        atomic_init(&lock->u.ticket.serving, 0);
+        break;
+    case LOCK_MCS:
+    default:
+        atomic_init(&lock->u.mcsTail, NULL);
+        break;
+    }
+}
+
+static inline void LockDestroy(strategyLock* lock)
+{
+    switch (lock->kind) {
+    case LOCK_SEM:
+        sem_destroy(&lock->u.sem);
+        break;
+    case LOCK_MUTEX:
+    case LOCK_ADAPTIVE:
+        pthread_mutex_destroy(&lock->u.mutex);
+        break;
+    case LOCK_SPIN:
+        pthread_spin_destroy(&lock->u.spin);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * LockAcquire
+ * -----------
+ * For the MCS lock the caller's node is appended to the queue of waiters
+ * with a single exchange on the tail; if there was a predecessor we link
+ * ourselves behind it and then spin on our own node until the predecessor
+ * hands the lock over.
+ */
+
+static inline void LockAcquire(strategyLock* lock, lockNode* node)
+{
+    unsigned int ticket;
+    lockNode* prev;
+
+    switch (lock->kind) {
+    case LOCK_SEM:
+        sem_wait(&lock->u.sem);
+        break;
+    case LOCK_MUTEX:
+    case LOCK_ADAPTIVE:
+        pthread_mutex_lock(&lock->u.mutex);
+        break;
+    case LOCK_SPIN:
+        pthread_spin_lock(&lock->u.spin);
+        break;
+    case LOCK_TICKET:
+        ticket = atomic_fetch_add_explicit(&lock->u.ticket.next, 1, memory_order_relaxed);
+        while (atomic_load_explicit(&lock->u.ticket.serving, memory_order_acquire) != ticket)
+            CpuRelax();
+        break;
+    case LOCK_MCS:
+    default:
+        atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+        atomic_store_explicit(&node->locked, true, memory_order_relaxed);
+        prev = atomic_exchange_explicit(&lock->u.mcsTail, node, memory_order_acq_rel);
+        if (prev != NULL) {
+            atomic_store_explicit(&prev->next, node, memory_order_release);
+            while (atomic_load_explicit(&node->locked, memory_order_acquire))
+                CpuRelax();
+        }
+        break;
+    }
+}
+
+/**
+ * LockTryAcquire
+ * --------------
+ * Takes the lock only if nobody holds it or is waiting for it, without
+ * ever waiting, and returns whether it did. A ticket lock is taken only if
+ * the next number is the one being served, an MCS lock only if its queue
+ * is empty.
+ */
+
+static inline bool LockTryAcquire(strategyLock* lock, lockNode* node)
+{
+    unsigned int ticket;
+    lockNode* expected = NULL;
+
+    switch (lock->kind) {
+    case LOCK_SEM:
+        return sem_trywait(&lock->u.sem) == 0;
+    case LOCK_MUTEX:
+    case LOCK_ADAPTIVE:
+        return pthread_mutex_trylock(&lock->u.mutex) == 0;
+    case LOCK_SPIN:
+        return pthread_spin_trylock(&lock->u.spin) == 0;
+    case LOCK_TICKET:
+        ticket = atomic_load_explicit(&lock->u.ticket.serving, memory_order_relaxed);
+        return atomic_compare_exchange_strong_explicit(&lock->u.ticket.next, &ticket, ticket + 1,
+                                                       memory_order_acquire, memory_order_relaxed);
+    case LOCK_MCS:
+    default:
+        atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+        atomic_store_explicit(&node->locked, false, memory_order_relaxed);
+        return atomic_compare_exchange_strong_explicit(&lock->u.mcsTail, &expected, node,
+                                                       memory_order_acq_rel, memory_order_relaxed);
+    }
+}
+
+/**
+ * LockRelease
+ * -----------
+ * An MCS holder with no known successor tries to swing the tail back to
+ * empty; if that fails someone is in the middle of linking in behind us,
+ * so we wait for the link to appear and then hand the lock to them.
+ */
+
+static inline void LockRelease(strategyLock* lock, lockNode* node)
+{
+    lockNode* next;
+    lockNode* expected;
+
+    switch (lock->kind) {
+    case LOCK_SEM:
+        sem_post(&lock->u.sem);
+        break;
+    case LOCK_MUTEX:
+    case LOCK_ADAPTIVE:
+        pthread_mutex_unlock(&lock->u.mutex);
+        break;
+    case LOCK_SPIN:
+        pthread_spin_unlock(&lock->u.spin);
+        break;
+    case LOCK_TICKET:
+        atomic_store_explicit(&lock->u.ticket.serving,
+                              atomic_load_explicit(&lock->u.ticket.serving, memory_order_relaxed) + 1,
+                              memory_order_release);
+        break;
+    case LOCK_MCS:
+    default:
+        next = atomic_load_explicit(&node->next, memory_order_acquire);
+        if (next == NULL) {
+            expected = node;
+            if (atomic_compare_exchange_strong_explicit(&lock->u.mcsTail, &expected, NULL,
+                                                        memory_order_release, memory_order_relaxed))
+                break;
+            while ((next = atomic_load_explicit(&node->next, memory_order_acquire)) == NULL)
+                CpuRelax();
+        }
+        atomic_store_explicit(&next->locked, false, memory_order_release);
+        break;
+    }
+}
+
+#endif
@@ -0,0 +1,163 @@
+/**
+ * pool.h
+ * ------
+ * A pool of persistent worker threads for running the examples' workloads
+ * round after round without creating a single new thread. Every round is
+ * one task per worker: worker i runs task(args[i]), usually in the role
+ * (seller, writer, reader) that thread i used to be created for. Between
+ * rounds the workers are parked.
+ *
+ * A round starts like a generation barrier: PoolSubmit publishes the task
+ * and its arguments and then bumps the pool's generation, which is what
+ * every parked worker is waiting on, and PoolWait waits for the count of
+ * workers still busy with the round to reach zero. Both waits use
+ * ParkWhile, which spins for a while on the word, since the next round
+ * often follows right away, and only then sleeps on it with a futex.
+ */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "futex.h"
+#include "locks.h"
+#include "affinity.h"
+
+#define PARK_SPIN_LIMIT 4096
+
+typedef void* (*poolTask)(void* arg);
+
+typedef struct workerPool workerPool;
+
+typedef struct {
+    workerPool* pool;
+    int index;
+} poolWorker;
+
+struct workerPool {
+    int numWorkers;
+    pthread_t* threads;
+    poolWorker* workers;
+    poolTask task;
+    void** args;            // args[i] is passed to worker i
+    bool stop;
+    _Alignas(CACHE_LINE_SIZE) atomic_int generation;    // bumped to start each round
+    atomic_int sleepers;    // workers asleep on generation
+    _Alignas(CACHE_LINE_SIZE) atomic_int busy;          // workers still in the current round
+};
+
+/**
+ * ParkWhile
+ * ---------
+ * Returns once *word no longer holds value, spinning for up to
+ * PARK_SPIN_LIMIT rounds before sleeping on it. A sleeper counts itself in
+ * *sleepers, if given, so that whoever changes the word can skip the wake
+ * call when everybody is still spinning.
+ */
+
+static inline void ParkWhile(atomic_int* word, int value, atomic_int* sleepers)
+{
+    int spins;
+
+    for (spins = 0; spins < PARK_SPIN_LIMIT; spins++) {
+        if (atomic_load_explicit(word, memory_order_acquire) != value) return;
+        CpuRelax();
+    }
+    while (atomic_load(word) == value) {
+        if (sleepers != NULL) atomic_fetch_add(sleepers, 1);
+        FutexWait(word, value);
+        if (sleepers != NULL) atomic_fetch_sub(sleepers, 1);
+    }
+}
+
+static inline void* PoolWorkerMain(void* arg)
+{
+    poolWorker* worker = (poolWorker*) arg;
+    workerPool* pool = worker->pool;
+    int seen = 0;
+
+    for (;;) {
+        ParkWhile(&pool->generation, seen, &pool->sleepers);
+        seen = atomic_load_explicit(&pool->generation, memory_order_acquire);
+        if (pool->stop) break;
+        pool->task(pool->args[worker->index]);
+        if (atomic_fetch_sub_explicit(&pool->busy, 1, memory_order_acq_rel) == 1) FutexWake(&pool->busy, 1);
+    }
+    return NULL;
+}
+
+/**
+ * PoolInit
+ * --------
+ * Starts numWorkers parked workers, each created with attr and then placed
+ * according to where (see affinity.h). Returns the pthread_create error
+ * code of the first worker that could not be started, or 0.
+ */
+
+static inline int PoolInit(workerPool* pool, int numWorkers, pthread_attr_t* attr, const placement* where)
+{
+    int i, rc;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->numWorkers = numWorkers;
+    pool->threads = (pthread_t*) calloc(numWorkers, sizeof(pthread_t));
+    pool->workers = (poolWorker*) calloc(numWorkers, sizeof(poolWorker));
+    atomic_init(&pool->generation, 0);
+    atomic_init(&pool->sleepers, 0);
+    atomic_init(&pool->busy, 0);
+    for (i = 0; i < numWorkers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        PlacementApply(where, attr, i);
+        if ((rc = pthread_create(pool->threads + i, attr, PoolWorkerMain, pool->workers + i)) != 0) return rc;
+    }
+    return 0;
+}
+
+static inline void PoolRelease(workerPool* pool)
+{
+    atomic_fetch_add(&pool->generation, 1);
+    if (atomic_load(&pool->sleepers) > 0) FutexWake(&pool->generation, INT_MAX);
+}
+
+/**
+ * PoolSubmit
+ * ----------
+ * Starts a round in which worker i runs task(args[i]), and returns without
+ * waiting for it. The previous round must have been waited for.
+ */
+
+static inline void PoolSubmit(workerPool* pool, poolTask task, void** args)
+{
+    pool->task = task;
+    pool->args = args;
+    atomic_store_explicit(&pool->busy, pool->numWorkers, memory_order_relaxed);
+    PoolRelease(pool);
+}
+
+static inline void PoolWait(workerPool* pool)
+{
+    int busy;
+
+    while ((busy = atomic_load_explicit(&pool->busy, memory_order_acquire)) != 0)
+        ParkWhile(&pool->busy, busy, NULL);
+}
+
+static inline void PoolDestroy(workerPool* pool)
+{
+    int i;
+
+    pool->stop = true;
+    atomic_fetch_add(&pool->generation, 1);
+    FutexWake(&pool->generation, INT_MAX);
+    for (i = 0; i < pool->numWorkers; i++) pthread_join(pool->threads[i], NULL);
+    free(pool->threads);
+    free(pool->workers);
+}
+
+#endif
@@ -1,157 +1,3279 @@
 /**
  * readerWriter.c
  * --------------
- * The canonical consumer-producer example. This version has hust one reader
- * and just one writer (although it could be generalized to multiple readers/writers)
- * communicating information through a shared buffer. There are two generalized semaphores
- * used, one to track the num of empty buffers, another to track full buffers. Each is used
- * to count, as well as control access.
+ * The canonical consumer-producer example. Any number of writer threads
+ * (-w) hand items to any number of reader threads (-r) through a shared,
+ * bounded channel. The default transport (-t sem) is the original design:
+ * an array of buffers with two counting semaphores, one for the empty
+ * buffers and one for the full ones, each used to count as well as to
+ * control access. The futex transport is the same design on counters that
+ * take a whole batch at once. The spsc and mpmc transports are lock-free
+ * rings, for one writer and one reader or for any number of each. Records
+ * of varying size go through the records transport, read and written in
+ * place in one ring of bytes, or the nodes transport, a lock-free linked
+ * queue on the heap. Each transport is described with its structure and in
+ * ChannelPut, ChannelGet, RecordReserve and RecordAcquire.
+ *
+ * Items move in batches (-b), and a thread that finds the channel full or
+ * empty waits the way -y says (see wait.h). By default every handoff is
+ * printed as it happens, the write before any reader can take the item;
+ * a run can instead be traced (-T, see trace.h) and repeated on the same
+ * input (-E) for traceReport to compare. With -B it is a benchmark (see
+ * bench.h) that times every channel operation, and -I also counts how
+ * contended they were.
+ *
+ * The one link generalizes to a pipeline of stages with transformers in
+ * between (-S, see Transformer), and the readers can hand their items on
+ * to processors that steal work from each other (-P, see Dispatch) or run
+ * a byte kernel over them (-k, see kernel.h). A channel can also size
+ * itself (-A, see channelAdapt), live in shared memory between a writer
+ * process and a reader process (-H, see shm.h) or carry a real file (-f,
+ * see fileStream).
+ *
+ * Threads come from a persistent pool (see pool.h) that can run the same
+ * job several rounds in a row (-N), can be pinned (-a, see affinity.h),
+ * and draw from generators of their own (see rng.h). However a round ends,
+ * the last writer to stop closes the channel (see ChannelClose), and the
+ * readers take whatever there is until it is closed and empty. Every
+ * setting can be given on the command line or through the RW_* environment
+ * variables listed in envOptions, so that a scaling sweep needs no
+ * rebuilds.
  */
 
+
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "futex.h"
+#include "bench.h"
+#include "trace.h"
+#include "traceEvents.h"
+#include "config.h"
+#include "affinity.h"
+#include "rng.h"
+#include "pool.h"
+#include "deque.h"
+#include "arena.h"
+#include "wait.h"
+#include "contention.h"
+#include "epoch.h"
+#include "shm.h"
+#include "kernel.h"
+
+#define NUM_TOTAL_BUFFERS 8          // default capacity; any power of two can be chosen with -c
+#define MAX_TOTAL_BUFFERS (1L << 26)
+#define DATA_LENGTH 20               // default items per writer, chosen with -i
+#define MAX_THREADS 1024
+#define MAX_BATCH 1024
+#define MAX_ROUNDS 1000000
+#define MAX_SKEW 1000000
+#define MAX_STAGES 16
+#define DEQUE_CAPACITY 4096
+#define STEAL_CHUNK 8
+#define RECORD_ALIGN 8
+#define MIN_RECORD_SIZE 256
+#define MAX_RECORD_SIZE 4096           // defaults for -z
+#define MAX_RECORD_LIMIT (1 << 20)
+#define MAX_RECORD_RING (1L << 30)
+#define DEFAULT_BENCH_OPS 1000000
+#define KERNEL_TIMING_INTERVAL 16    // kernel calls per one that is timed
+#define STREAM_HEADER sizeof(uint64_t)  // a streamed chunk's record starts with its offset in the file
+#define ADAPT_WINDOW 256             // puts between decisions on an adaptive channel's capacity
+#define ADAPT_STALL_RATIO 16         // grow when more than one put in this many stalled on full
+#define CACHE_LINE_SIZE 64
+
+typedef enum {
+    TRANSPORT_SEM,
+    TRANSPORT_SPSC,
+    TRANSPORT_MPMC,
+    TRANSPORT_FUTEX,
+    TRANSPORT_RECORDS,
+    TRANSPORT_NODES
+} transportKind;
+
+static const char* const transportNames[] = {"sem", "spsc", "mpmc", "futex", "records", "nodes"};
+
+typedef enum {
+    ROLE_WRITER,
+    ROLE_READER,
+    ROLE_PROCESSOR,
+    ROLE_TRANSFORMER
+} threadRole;
+
+/**
+ * In the SPSC ring (-t spsc) the writer owns the tail index and the reader
+ * the head: each only ever stores its own index and loads the other's, so
+ * acquire/release atomics are all the synchronization it needs and no
+ * handoff ever enters the kernel. Each index is on its own cache line,
+ * together with the owner's cached copy of the other index, so the writer
+ * and reader only touch each other's line when the cached copy says the
+ * ring looks full (or empty). The buffers themselves are allocated
+ * separately, since their size is only known at run time.
+ */
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t head;   // next position to read, stored by the reader
+    size_t cachedTail;                              // reader's last view of tail
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t tail;   // next position to write, stored by the writer
+    size_t cachedHead;                              // writer's last view of head
+    _Alignas(CACHE_LINE_SIZE) char* buffers;
+} spscRing;
+
+/**
+ * In the MPMC queue (-t mpmc) every cell carries its own sequence number.
+ * A thread claims a position with a compare-and-swap on its side's counter
+ * and then waits only on that cell, so writers never contend with readers,
+ * only with each other for the cell they are claiming. A cell whose
+ * sequence equals the position about to be written is empty; once written
+ * its sequence becomes position + 1, which is what the reader of that
+ * position waits for, and the reader then advances it by a whole lap so
+ * the writer of the next lap can claim it.
+ */
+
+typedef struct {
+    atomic_size_t sequence;
+    char value;
+} mpmcCell;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t enqueuePos;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t dequeuePos;
+    _Alignas(CACHE_LINE_SIZE) mpmcCell* cells;
+} mpmcQueue;
+
+/**
+ * The record ring carries variable-size records in one contiguous array of
+ * bytes. Each record is a recordHeader followed by its payload, padded to
+ * a multiple of RECORD_ALIGN, and never wraps around the end of the ring:
+ * a writer that would run off the end first fills the rest with a pad
+ * record and starts again at offset zero. A writer reserves a record and
+ * writes its payload straight into the ring; a reader gets a view of it,
+ * a pointer and a length, and releases it once it is done with it, so the
+ * payload is never copied on the way. Records may be committed and
+ * released in any order: readers wait for the oldest unread record to be
+ * committed, and the head, which is what gives writers their space back,
+ * only moves past a record once it and every record before it has been
+ * released.
+ */
+
+typedef enum {
+    RECORD_RESERVED,    // a writer is filling it in
+    RECORD_COMMITTED,   // ready to be read
+    RECORD_RELEASED,    // read and processed; its space can be reused
+    RECORD_PAD          // filler up to the end of the ring
+} recordState;
+
+typedef struct {
+    atomic_uint state;
+    uint32_t length;    // payload bytes
+} recordHeader;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t head;       // oldest record not yet released
+    pthread_mutex_t releaseLock;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t tail;       // end of the newest reservation
+    pthread_mutex_t writeLock;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t readPos;    // next record to hand to a reader
+    pthread_mutex_t readLock;
+    _Alignas(CACHE_LINE_SIZE) char* bytes;
+    size_t size;        // bytes in the ring, a power of two
+} recordRing;
+
+/**
+ * The nodes transport's queue always holds one dummy node at its head; the
+ * oldest record is the one after it. A reader that takes a record makes
+ * that record's node the new dummy and retires the old one, so a node is
+ * only unlinked once its record has been read. Its reader stays inside its
+ * epoch until it releases the record, which keeps the node it is reading
+ * from being freed under it when the next reader retires it. The retired
+ * nodes go on their reader's own list and are freed a list at a time once
+ * no thread can still see them (see epoch.h), with no lock and no
+ * reference count per record.
+ */
+
+typedef struct recordNode {
+    epochNode retired;  // first, so that the node can be freed through it
+    _Atomic(struct recordNode*) next;
+    size_t serial;      // a unique ticket pairing the write with its read in a trace
+    uint32_t length;
+    char data[];
+} recordNode;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic(recordNode*) head;   // the dummy
+    _Alignas(CACHE_LINE_SIZE) _Atomic(recordNode*) tail;
+    atomic_size_t serial;
+    epochDomain epochs;
+} recordQueue;
 
-#define NUM_TOTAL_BUFFERS 5
-#define DATA_LENGTH 20
+typedef struct {
+    recordHeader* header;
+    char* data;
+    uint32_t length;
+    size_t pos;         // where the record starts in the ring
+    recordNode* node;   // nodes: the record's node, or for a reader the dummy to retire
+} recordView;
+
+/*
+ * A record copied out of the ring for a processor, in its reader's slab
+ * pool. The reader releases the record from the ring straight away, so a
+ * slow record holds up one processor rather than the writers, and the
+ * processor hands the copy back to the pool when it is done.
+ */
+typedef struct {
+    slabPool* owner;
+    uint32_t length;
+    char data[];
+} recordCopy;
+
+/**
+ * An adaptive channel (-A) moves its capacity between two bounds as it
+ * runs. The writers count, under the write lock, how many of their puts
+ * in the current window stalled on a full buffer and how full they left
+ * it at most; the readers count, under the read lock, the gets that found
+ * it empty. The writer whose put closes a window decides from those
+ * counts whether to resize (see ChannelAdapt).
+ */
+
+typedef struct {
+    size_t minCapacity;
+    size_t maxCapacity;         // 0 when the capacity is fixed
+    atomic_size_t current;      // the capacity, for anyone not holding the locks
+    bool ownsBuffer;            // the buffers came from a resize, not from the arena
+    // the current window, under the write lock
+    long windowPuts;
+    long windowStalls;
+    size_t windowPeak;
+    // over the whole run
+    long puts;
+    long fullStalls;            // under the write lock
+    long gets;
+    long emptyStalls;           // under the read lock
+    long grows;
+    long shrinks;
+    size_t largest;
+    size_t smallest;
+} channelAdapt;
+
+/**
+ * The semaphore and futex transports share one array of buffers between a
+ * write and a read position, each advanced under its own side's lock. The
+ * futex counters can be taken and given a batch's worth of units at a time,
+ * so a batch costs one wake-up instead of one per item.
+ */
 
 typedef struct {
-    const char* name;
+    transportKind transport;
+    size_t capacity;    // number of buffers, a power of two
+    size_t mask;        // capacity - 1, turns a position into a buffer index
+    // TRANSPORT_SEM and TRANSPORT_FUTEX
     char* sharedBuffer;
-    sem_t* pEmptyBuffers;
-    sem_t* pFullBuffers;
-    struct random_data* randBuffer;
+    sem_t emptyBuffers;
+    sem_t fullBuffers;
+    futexCounter emptyCount;
+    futexCounter fullCount;
+    pthread_mutex_t writeLock;
+    pthread_mutex_t readLock;
+    size_t writePt;
+    size_t readPt;
+    channelAdapt adapt;
+    // TRANSPORT_SPSC
+    spscRing* ring;
+    // TRANSPORT_MPMC
+    mpmcQueue* queue;
+    // TRANSPORT_RECORDS, where capacity is the size of the ring in bytes
+    recordRing* records;
+    // TRANSPORT_NODES, with emptyCount and fullCount counting the nodes that may still be linked and are
+    recordQueue* nodes;
+    // how to wait, and what to wait on, when the buffer is full or empty
+    waitPolicy wait;
+    atomic_bool closed; // no more puts this round; set once every writer is done
+    uint64_t closedNs;  // when, for the shutdown time
+    _Alignas(CACHE_LINE_SIZE) eventCount dataReady;
+    _Alignas(CACHE_LINE_SIZE) eventCount spaceFree;
+} channel;
+
+/**
+ * A file streamed through the records or nodes transport (-f). The input
+ * is mapped whole and cut into chunks, which writers claim in order from
+ * next; each goes into a record of its own, behind its offset in the file,
+ * so that readers can write it out to the same offset whatever order the
+ * chunks reach them in.
+ */
+
+typedef struct {
+    const char* map;    // the input, read-only
+    size_t size;
+    size_t chunk;       // bytes per chunk, all but the last
+    long chunks;
+    int output;         // descriptor of the output file, or -1 to discard what is read
+    _Alignas(CACHE_LINE_SIZE) atomic_long next;     // the next chunk to claim
+} fileStream;
+
+/**
+ * A reader that processes what it reads stalls behind every slow item
+ * while the buffer fills up. With processors (-P) the readers only read:
+ * each pushes its items onto its own Chase-Lev deque (see deque.h) and the
+ * processors steal them, so a slow item holds up only the one processor
+ * working on it. This is what they share: the readers' deques come first
+ * and the processors' after them, readersLeft tells the processors when
+ * no more work is coming, and epoch is what an idle processor parks on
+ * until there is.
+ */
+
+typedef struct {
+    workDeque* deques;
+    int numDeques;
+    atomic_int readersLeft;
+    atomic_int epoch;       // bumped whenever work is pushed or a reader finishes
+    atomic_int sleepers;
+} dispatcher;
+
+/**
+ * Each thread's data, including its random number state, lives in its own
+ * cache-line aligned block. The generator updates its state on every call and
+ * the benchmark counters change on every item, so two threads sharing a
+ * line would keep stealing it from each other.
+ */
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) char* name;
+    channel* channel;   // what the thread writes to, or for a reader or transformer reads from
+    channel* output;    // what a transformer writes to
+    int stage;          // 0 for writers, up to stages - 1 for readers
+    long count;         // number of items this thread writes
+    int batch;          // most items moved per channel operation
+    uint32_t minRecord; // record sizes, for TRANSPORT_RECORDS
+    uint32_t maxRecord;
+    rng rng;            // this thread's own generator
+    rngLanes lanes;     // and its batch generator
+    // benchmark mode
+    benchConfig* bench;
+    latencyLog latency;
+    latencyLog wakeups; // how long this thread took to wake up after a wait
+    long ops;           // items this thread actually moved, over all rounds
+    long bytes;         // and the payload bytes, for records
+    uint64_t seed;
+    atomic_int* stageLeft;  // threads of this thread's stage still writing
+    uint64_t doneNs;    // when a reader finished its last round
+    threadRole role;
+    bool instrument;    // count channel operations in contention
+    contentionStats contention;
+    int skew;           // one item in skew costs skew times as much, if above 1
+    traceMode traceOutput;
+    traceRing* trace;
+    // with processors
+    dispatcher* dispatch;
+    workDeque* deque;   // this thread's own deque
+    long processed;
+    long steals;
+    arena scratch;      // readers of records: where their copies come from
+    slabPool copies;
+    epochThread epoch;  // the nodes transport's writers and readers
+    fileStream* stream; // writers and readers of a streamed file
+    const byteKernel* kernel;   // what ProcessData runs, or NULL
+    kernelState* kernelWork;
+    uint64_t kernelBytes;
+    uint64_t kernelNs;  // estimated from one call in KERNEL_TIMING_INTERVAL
+    long kernelCalls;
+    // how full the buffer this thread reads from was, sampled on each read
+    uint64_t occupancySum;
+    long occupancySamples;
+    long emptySamples;
+    long fullSamples;
 } threadData;
 
+typedef struct {
+    transportKind transport;
+    int numWriters;
+    int numReaders;
+    int batch;
+    size_t capacity;
+    size_t minCapacity; // -A: bounds on an adaptive capacity, or 0 for a fixed one
+    size_t maxCapacity;
+    long items;         // items each writer writes, outside a benchmark
+    int rounds;
+    int numProcessors;
+    int skew;
+    uint32_t minRecord;
+    uint32_t maxRecord;
+    int wait;           // a waitStrategy, or -1 for the transport's own
+    int spinBudget;
+    int stages;
+    int stageThreads[MAX_STAGES];   // threads of each stage, writers first and readers last
+    int numStageCounts;             // how many counts -g gave
+    int stageCounts[MAX_STAGES];
+    benchConfig bench;
+    traceMode traceOutput;
+    const char* traceFile;
+    bool traceLogger;
+    placement placement;
+    bool instrument;
+    const char* jsonFile;
+    const char* inputFile;  // -f: stream this file through the channel
+    const char* outputFile; // -O: and write it out here
+    byteKernel kernel;      // -k: ProcessData's kernel, if kernel.run is set
+    const char* shmName;    // -H: the channel lives in this shared memory segment
+    int side;               // and this process runs ROLE_WRITER or ROLE_READER, or -1 for both
+    bool seeded;            // -E: start the generators from seed instead of the clock
+    uint64_t seed;
+} programConfig;
+
+static const envOption envOptions[] = {
+    {"RW_TRANSPORT", 't'},
+    {"RW_WRITERS", 'w'},
+    {"RW_READERS", 'r'},
+    {"RW_BATCH", 'b'},
+    {"RW_CAPACITY", 'c'},
+    {"RW_ADAPT", 'A'},
+    {"RW_ITEMS", 'i'},
+    {"RW_BENCH", 'B'},
+    {"RW_WORK", 'W'},
+    {"RW_OPS", 'n'},
+    {"RW_DURATION", 'd'},
+    {"RW_TRACE", 'T'},
+    {"RW_TRACE_FILE", 'o'},
+    {"RW_TRACE_LOGGER", 'L'},
+    {"RW_AFFINITY", 'a'},
+    {"RW_ROUNDS", 'N'},
+    {"RW_PROCESSORS", 'P'},
+    {"RW_SKEW", 'K'},
+    {"RW_RECORD_SIZE", 'z'},
+    {"RW_WAIT", 'y'},
+    {"RW_SPIN_BUDGET", 'Y'},
+    {"RW_STAGES", 'S'},
+    {"RW_STAGE_THREADS", 'g'},
+    {"RW_INSTRUMENT", 'I'},
+    {"RW_JSON", 'J'},
+    {"RW_INPUT", 'f'},
+    {"RW_OUTPUT", 'O'},
+    {"RW_KERNEL", 'k'},
+    {"RW_SHM", 'H'},
+    {"RW_SIDE", 'R'},
+    {"RW_SEED", 'E'}
+};
+
 static void* Writer(void* writerData);
 static void* Reader(void* readerData);
-static void ProcessData(void* readerData);
-static char PrepareData(void* writerData);
+static void* Processor(void* processorData);
+static void* Transformer(void* transformerData);
+static int TakeBatch(threadData* data, char* records, int want);
+static void PutBatch(threadData* data, channel* ch, const char* records, int n);
+static void* RecordWriter(void* writerData);
+static void* RecordReader(void* readerData);
+static void* StreamWriter(void* writerData);
+static void* StreamReader(void* readerData);
+static void StreamWrite(threadData* data, recordView* views, int n);
+static uint64_t StreamOffset(const recordView* view);
+static void StreamWritev(int fd, struct iovec* iov, int count, uint64_t offset);
+static void StreamOpen(fileStream* stream, const char* input, const char* output, size_t chunk);
+static void StreamClose(fileStream* stream, long rounds, uint64_t elapsedNs);
+static void* RunRole(void* roleData);
+static void Dispatch(threadData* data, const char* records, int n);
+static void PushWork(threadData* data, int64_t item);
+static void SignalWork(dispatcher* dispatch);
+static void FinishDispatch(threadData* data);
+static bool StealWork(threadData* data, int64_t* item);
+static void ProcessOne(threadData* data, int64_t item);
+static void ProcessData(void* readerData, const char* records, int n);
+static void PrepareData(void* writerData, char* records, int n);
+static void ProcessRecord(threadData* data, const recordView* view);
+static void RunKernel(threadData* data, const char* bytes, size_t n);
+static void ReportKernel(const byteKernel* kernel, const threadData* threads, int numThreads, uint64_t elapsedNs);
+static void PrepareRecord(threadData* data, char* payload, uint32_t length);
+static size_t ChannelFootprint(transportKind transport, size_t capacity);
+static void ChannelInit(channel* ch, transportKind transport, size_t capacity, arena* a, bool shared);
+static void ChannelDestroy(channel* ch);
+static void ChannelSetAdaptive(channel* ch, size_t minCapacity, size_t maxCapacity);
+static void ChannelAdapt(channel* ch);
+static bool ChannelTakeEmpty(channel* ch, size_t n);
+static void ReportAdaptive(const channel* links, int numLinks);
+static int ChannelPut(channel* ch, const char* values, int n, size_t* firstPos, latencyLog* wakeups,
+                      contentionStats* contention, threadData* echo);
+static int ChannelGet(channel* ch, char* values, int n, size_t* firstPos, latencyLog* wakeups,
+                      contentionStats* contention);
+static bool AdaptCountPut(channelAdapt* adapt, bool stalled, size_t full);
+static void ChannelLock(pthread_mutex_t* lock, const contentionStats* contention, bool* contended);
+static void ChannelClose(channel* ch);
+static void ChannelReopen(channel* ch);
+static latencyLog* Wakeups(threadData* data);
+static contentionStats* Contention(threadData* data);
+static threadData* Echo(threadData* data);
+static bool Recording(const threadData* data);
+static void EchoPut(threadData* echo, size_t pos, const char* values, int n);
+static size_t RecordSize(uint32_t length);
+static size_t RecordRingSize(size_t capacity, uint32_t maxRecord);
+static void RecordReserve(channel* ch, uint32_t length, recordView* view, latencyLog* wakeups);
+static size_t RecordCommit(channel* ch, const recordView* view, epochThread* epoch);
+static bool RecordAcquire(channel* ch, recordView* view, latencyLog* wakeups, epochThread* epoch);
+static bool RecordTryAcquire(channel* ch, recordView* view);
+static void RecordRelease(channel* ch, const recordView* view, epochThread* epoch);
+static void NodeEnqueue(channel* ch, recordNode* node, epochThread* epoch);
+static recordNode* NodeDequeue(channel* ch, recordView* view, epochThread* epoch);
+static void ReportReclamation(const threadData* threads, int numThreads, const channel* ch);
+static void ReportHandoff(threadData* data, handoffEvent kind, size_t pos, char value, uint64_t at);
+static void FormatHandoff(FILE* out, const char* name, const traceEvent* event);
+static void ReportProcessors(const threadData* readers, int numReaders, int numProcessors);
+static size_t ChannelOccupancy(channel* ch);
+static size_t ChannelSpace(const channel* ch);
+static void SampleOccupancy(threadData* data);
+static void ReportPipeline(const programConfig* config, threadData* const* consumers, const int* numConsumers,
+                           const channel* links, uint64_t elapsedNs);
+static void ReportContention(const programConfig* config, const threadData* threads, int numThreads,
+                             const int* stageFirst, arena* a);
+static void Usage(const char* prog);
+static void ApplyOption(void* ctx, int opt, const char* arg);
 
 /**
  * Initially, all buffers are empty, so our empty buffer semaphore starts
  * with a count equal to the total number of buffers, while our full buffer
- * semaphore begins at zero. We create two threads: one to read and one
- * to write, and then start them off running. They will finish after all data
- * has been written and read.
+ * semaphore begins at zero. We create the writer and reader threads and
+ * then start them off running. Each writer writes its items, the last one
+ * to finish closes the channel and the readers read until it is closed and
+ * empty, so they will finish after all data has been written and read.
+ * Every further round runs the same job again on the same threads, once
+ * the channels are open again.
  */
 
 void main(int argc, char **argv)
 {
-    pthread_t writer, reader;
-    sem_t emptyBuffers, fullBuffers;
-    char buffers[NUM_TOTAL_BUFFERS];
-    int rc;
-    struct random_data* randStates;
-    char* randStateBuffers;
-    void* status;
-
-    randStates = (struct random_data*) calloc(2, sizeof(struct random_data));
-    randStateBuffers = (char*) calloc(2, 32);
-    
+    workerPool pool;
+    void** taskArgs;
+    threadData* threadArgs;
+    channel* links;
+    arena setup, channelArena;
+    bool copyRecords, records, nodes;
+    int numThreads, numLinks, numTransformers, firstTransformer, link, stage;
+    int stageFirst[MAX_STAGES];     // the first thread of each stage
+    threadData* consumers[MAX_STAGES];
+    long totalItems;
+    size_t channelSize;
+    int i, rc, opt, round;
+    uint64_t elapsedNs = 0, roundStart, lastDone, shutdownNs, shutdownSum = 0, shutdownMax = 0;
+    latencyLog roundLatency;
+    const latencyLog* roundLogs[1];
+    dispatcher dispatch;
+    atomic_int stageLeft[MAX_STAGES];
+    char label[256];
+    tracer trace;
+    FILE* traceOut = stdout;
+    char nameBuffer[48];
+    cpu_set_t mainCpus;
+    bool entered, initChannels = true;
+    shmSegment segment;
+    char key[SHM_KEY_LENGTH];
+    size_t shmSize, channelBytes;
+    int localFirst, localThreads;   // the threads this process runs
+    fileStream stream;
+    uint64_t streamNs = 0;
+    uint64_t baseSeed;
+    programConfig config = {
+        .transport = TRANSPORT_SEM,
+        .numWriters = 1,
+        .numReaders = 1,
+        .batch = 1,
+        .capacity = NUM_TOTAL_BUFFERS,
+        .items = DATA_LENGTH,
+        .rounds = 1,
+        .skew = 1,
+        .minRecord = MIN_RECORD_SIZE,
+        .maxRecord = MAX_RECORD_SIZE,
+        .wait = -1,
+        .spinBudget = WAIT_SPIN_BUDGET,
+        .stages = 2,
+        .traceOutput = TRACE_STDIO,
+        .side = -1
+    };
+
+    static const struct option longOptions[] = {
+        {"transport", required_argument, NULL, 't'},
+        {"writers", required_argument, NULL, 'w'},
+        {"readers", required_argument, NULL, 'r'},
+        {"batch", required_argument, NULL, 'b'},
+        {"capacity", required_argument, NULL, 'c'},
+        {"adapt", required_argument, NULL, 'A'},
+        {"items", required_argument, NULL, 'i'},
+        {"bench", no_argument, NULL, 'B'},
+        {"work", required_argument, NULL, 'W'},
+        {"ops", required_argument, NULL, 'n'},
+        {"duration", required_argument, NULL, 'd'},
+        {"trace", required_argument, NULL, 'T'},
+        {"trace-file", required_argument, NULL, 'o'},
+        {"trace-logger", no_argument, NULL, 'L'},
+        {"affinity", required_argument, NULL, 'a'},
+        {"rounds", required_argument, NULL, 'N'},
+        {"processors", required_argument, NULL, 'P'},
+        {"skew", required_argument, NULL, 'K'},
+        {"record-size", required_argument, NULL, 'z'},
+        {"wait", required_argument, NULL, 'y'},
+        {"spin-budget", required_argument, NULL, 'Y'},
+        {"stages", required_argument, NULL, 'S'},
+        {"stage-threads", required_argument, NULL, 'g'},
+        {"instrument", no_argument, NULL, 'I'},
+        {"json", required_argument, NULL, 'J'},
+        {"input", required_argument, NULL, 'f'},
+        {"output", required_argument, NULL, 'O'},
+        {"kernel", required_argument, NULL, 'k'},
+        {"shm", required_argument, NULL, 'H'},
+        {"side", required_argument, NULL, 'R'},
+        {"seed", required_argument, NULL, 'E'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    ApplyEnvironment(envOptions, sizeof(envOptions) / sizeof(envOptions[0]), ApplyOption, &config);
+    while ((opt = getopt_long(argc, argv, "t:w:r:b:c:A:i:BW:n:d:T:o:La:N:P:K:z:y:Y:S:g:IJ:f:O:k:H:R:E:h", longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            Usage(argv[0]);
+            exit(0);
+        case '?':
+            Usage(argv[0]);
+            exit(1);
+        default:
+            ApplyOption(&config, opt, optarg);
+        }
+    }
+    baseSeed = config.seeded ? config.seed : RngClockSeed();
+
+    /**
+     * Stage 0 is the writers and the last stage the readers; the transform
+     * stages in between get one thread each, or what -g says: one count for
+     * all of them or one per stage.
+     */
+    if (config.numStageCounts > 1 && config.numStageCounts != config.stages - 2) {
+        printf("ERROR: %d transform stages but %d stage thread counts\n", config.stages - 2, config.numStageCounts);
+        exit(1);
+    }
+    records = config.transport == TRANSPORT_RECORDS || config.transport == TRANSPORT_NODES;
+    nodes = config.transport == TRANSPORT_NODES;
+    if (config.stages > 2 && records) {
+        printf("ERROR: the %s transport only connects writers to readers, without transform stages\n",
+               transportNames[config.transport]);
+        exit(1);
+    }
+    if (config.instrument && records) {
+        printf("ERROR: the %s transport doesn't count its operations, so -I and -J need another transport\n",
+               transportNames[config.transport]);
+        exit(1);
+    }
+    numLinks = config.stages - 1;
+    numTransformers = 0;
+    config.stageThreads[0] = config.numWriters;
+    config.stageThreads[config.stages - 1] = config.numReaders;
+    for (stage = 1; stage < config.stages - 1; stage++) {
+        config.stageThreads[stage] = config.numStageCounts == 0 ? 1
+                                   : config.stageCounts[config.numStageCounts == 1 ? 0 : stage - 1];
+        numTransformers += config.stageThreads[stage];
+    }
+    for (stage = 0; stage < config.stages; stage++) {
+        if (config.transport == TRANSPORT_SPSC && config.stageThreads[stage] != 1) {
+            printf("ERROR: the spsc transport needs exactly one thread in every stage\n");
+            exit(1);
+        }
+    }
+
+    if (config.maxCapacity > 0) {
+        if (config.transport != TRANSPORT_SEM && config.transport != TRANSPORT_FUTEX) {
+            printf("ERROR: only the sem and futex transports can adapt their capacity\n");
+            exit(1);
+        }
+        if (config.capacity < config.minCapacity) config.capacity = config.minCapacity;
+        if (config.capacity > config.maxCapacity) config.capacity = config.maxCapacity;
+    }
+
+    if ((config.shmName != NULL) != (config.side >= 0)) {
+        printf("ERROR: a shared memory channel (-H) and the side this process runs (-R) go together\n");
+        exit(1);
+    }
+    if (config.shmName != NULL &&
+        ((config.transport != TRANSPORT_SEM && config.transport != TRANSPORT_SPSC && config.transport != TRANSPORT_MPMC) ||
+         config.stages > 2 || config.numProcessors > 0 || config.maxCapacity > 0)) {
+        printf("ERROR: a shared memory channel needs the sem, spsc or mpmc transport, two stages, no processors\n"
+               "and a fixed capacity\n");
+        exit(1);
+    }
+
+    // a streamed file's chunks are the records, each with its offset in front
+    if (config.inputFile != NULL) {
+        if (!records || config.numProcessors > 0 || config.bench.duration > 0) {
+            printf("ERROR: a file can only be streamed through the records or nodes transport, to the readers\n"
+                   "themselves and not for a duration\n");
+            exit(1);
+        }
+        StreamOpen(&stream, config.inputFile, config.outputFile, config.maxRecord);
+        config.minRecord = config.maxRecord = (uint32_t) (STREAM_HEADER + stream.chunk);
+    } else if (config.outputFile != NULL) {
+        printf("ERROR: an output file (-O) needs an input file (-f) to stream\n");
+        exit(1);
+    }
+
+    channelSize = config.capacity;
+    if (config.transport == TRANSPORT_RECORDS) {
+        channelSize = RecordRingSize(config.capacity, config.maxRecord);
+        if (channelSize > MAX_RECORD_RING) {
+            printf("ERROR: %zu records of %u bytes need more than %ld bytes of ring\n",
+                   config.capacity, config.maxRecord, MAX_RECORD_RING);
+            exit(1);
+        }
+    }
+
+    firstTransformer = config.numWriters + config.numReaders + config.numProcessors;
+    numThreads = firstTransformer + numTransformers;
+    localFirst = config.side == ROLE_READER ? config.numWriters : 0;
+    localThreads = config.side == ROLE_WRITER ? config.numWriters
+                 : config.side == ROLE_READER ? config.numReaders : numThreads;
+    stageFirst[0] = 0;
+    stageFirst[config.stages - 1] = config.numWriters;
+    for (stage = 1, i = firstTransformer; stage < config.stages - 1; i += config.stageThreads[stage++])
+        stageFirst[stage] = i;
+    totalItems = config.numWriters * config.items;
+    if (config.bench.enabled) {
+        if (config.bench.ops == 0 && config.bench.duration <= 0) config.bench.ops = DEFAULT_BENCH_OPS;
+        totalItems = config.bench.duration > 0 ? LONG_MAX : config.bench.ops;
+        BenchInit(&config.bench, localThreads);
+        LatencyInit(&roundLatency, baseSeed);
+    }
+    if (config.inputFile != NULL) totalItems = stream.chunks;
+
+    // a benchmark never prints from the hot path, and a streamed file's chunks aren't letters
+    if ((config.bench.enabled || config.inputFile != NULL) && config.traceOutput == TRACE_STDIO)
+        config.traceOutput = TRACE_OFF;
+    if (config.traceFile != NULL && (traceOut = fopen(config.traceFile, "wb")) == NULL) {
+        printf("ERROR: cannot open trace file '%s'\n", config.traceFile);
+        exit(1);
+    }
+    TracerInit(&trace, config.traceOutput, traceOut, numThreads, FormatHandoff);
+    // the argument arrays, the thread data, the deques, the latency logs, the names, the kernels' state,
+    // the channels, the contention tables and the epoch threads
+    ArenaInit(&setup, numThreads * (6 * sizeof(void*) + sizeof(threadData) + sizeof(workDeque) + sizeof(nameBuffer) +
+                                    (config.kernel.run != NULL ? sizeof(kernelState) : 0)) +
+                      numLinks * sizeof(channel) + 10 * CACHE_LINE_SIZE);
+    taskArgs = (void**) ArenaCalloc(&setup, numThreads, sizeof(void*));
+    threadArgs = (threadData*) ArenaCalloc(&setup, numThreads, sizeof(threadData));
+
     pthread_attr_t attr;
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 
-    sem_init(&emptyBuffers, 0, NUM_TOTAL_BUFFERS);
-    sem_init(&fullBuffers, 0, 0);
+    // by default the semaphores and futexes block, the lock-free rings yield and the records spin, then sleep
+    if (config.wait < 0)
+        config.wait = config.transport == TRANSPORT_SPSC || config.transport == TRANSPORT_MPMC ? WAIT_YIELD
+                    : records ? WAIT_SPIN_FUTEX : WAIT_BLOCK;
+    // the lock-free rings wake their sleepers through private futexes, which never reach another process
+    if (config.shmName != NULL && config.transport != TRANSPORT_SEM &&
+        (config.wait == WAIT_BLOCK || config.wait == WAIT_SPIN_FUTEX)) {
+        printf("ERROR: a shared memory %s channel can only spin or yield\n", transportNames[config.transport]);
+        exit(1);
+    }
+
+    /**
+     * A shared channel goes in the segment along with its buffers, and
+     * the process that creates the segment sets it up. Both sides have
+     * to agree on everything the other side's threads depend on, which
+     * is what the key holds.
+     */
+    if (config.shmName != NULL) {
+        snprintf(key, sizeof(key), "readerWriter transport=%s writers=%d readers=%d capacity=%zu items=%ld "
+                 "rounds=%d bench=%d wait=%s spin=%d", transportNames[config.transport], config.numWriters,
+                 config.numReaders, config.capacity, totalItems, config.rounds, config.bench.enabled,
+                 waitNames[config.wait], config.spinBudget);
+        channelBytes = (sizeof(channel) + CACHE_LINE_SIZE - 1) & ~(size_t) (CACHE_LINE_SIZE - 1);
+        shmSize = channelBytes + sizeof(arenaBlock) + ChannelFootprint(config.transport, channelSize);
+        initChannels = ShmAttach(&segment, config.shmName, shmSize, key, 2);
+        links = (channel*) ShmData(&segment);
+        ArenaInitOver(&channelArena, (char*) links + channelBytes, shmSize - channelBytes);
+    } else {
+        links = (channel*) ArenaCalloc(&setup, numLinks, sizeof(channel));
+        ArenaInit(&channelArena, numLinks * ChannelFootprint(config.transport, channelSize));
+    }
+    // first-touch each buffer from the node its consumers will run on
+    for (link = 0; initChannels && link < numLinks; link++) {
+        entered = PlacementEnterNode(&config.placement, PlacementNodeOf(&config.placement, stageFirst[link + 1]),
+                                     &mainCpus);
+        ChannelInit(links + link, config.transport, channelSize, &channelArena, config.shmName != NULL);
+        if (config.maxCapacity > 0) ChannelSetAdaptive(links + link, config.minCapacity, config.maxCapacity);
+        if (entered) PlacementLeaveNode(&mainCpus);
+        links[link].wait.strategy = (waitStrategy) config.wait;
+        links[link].wait.spinBudget = config.spinBudget;
+        links[link].wait.timed = config.bench.enabled;
+    }
+    if (config.shmName != NULL && initChannels) ShmReady(&segment);
+
+    copyRecords = records && config.numProcessors > 0;
+    if (config.numProcessors > 0) {
+        dispatch.numDeques = config.numReaders + config.numProcessors;
+        dispatch.deques = (workDeque*) ArenaCalloc(&setup, dispatch.numDeques, sizeof(workDeque));
+        for (i = 0; i < dispatch.numDeques; i++) DequeInit(dispatch.deques + i, DEQUE_CAPACITY);
+        atomic_init(&dispatch.epoch, 0);
+        atomic_init(&dispatch.sleepers, 0);
+    }
 
-    initstate_r(random(), randStateBuffers, 16, randStates);
-    initstate_r(random(), randStateBuffers + 1, 16, randStates + 1);
+    /**
+     * Threads [0, numWriters) are writers, the next numReaders are readers,
+     * then come the processors, if any, and last the transformers, stage by
+     * stage. A benchmark shares its items out evenly among the writers, with
+     * the remainder going to the first few. Everything downstream of them
+     * just runs until its input is closed.
+     */
+    for (i = 0; i < numThreads; i++) {
+        threadRole role = i < config.numWriters ? ROLE_WRITER
+                        : i < config.numWriters + config.numReaders ? ROLE_READER
+                        : i < firstTransformer ? ROLE_PROCESSOR : ROLE_TRANSFORMER;
+        int index = role == ROLE_WRITER ? i
+                  : role == ROLE_READER ? i - config.numWriters
+                  : role == ROLE_PROCESSOR ? i - config.numWriters - config.numReaders : i - firstTransformer;
 
-    threadData writerData = {"Writer", buffers, &emptyBuffers, &fullBuffers, randStates};
-    threadData readerData = {"Reader", buffers, &emptyBuffers, &fullBuffers, randStates + 1};
-    
-    rc = pthread_create(&writer, NULL, Writer, (void*) &writerData);
-    if (rc != 0) {
-        printf("ERROR: pthread_create(&writer,...) failed with return code of %d\n.", rc);
-        exit(1);
+        stage = role == ROLE_WRITER ? 0 : config.stages - 1;
+        if (role == ROLE_TRANSFORMER)
+            for (stage = 1; index >= config.stageThreads[stage]; index -= config.stageThreads[stage++])
+                ;
+
+        RngSeed(&(threadArgs + i)->rng, baseSeed, i);
+        RngLanesSeed(&(threadArgs + i)->lanes, baseSeed, numThreads + i);
+        if (role == ROLE_WRITER) {
+            sprintf(nameBuffer, config.numWriters == 1 ? "Writer" : "Writer #%d", index + 1);
+            (threadArgs + i)->count = config.items;
+            if (config.bench.enabled || config.inputFile != NULL)
+                (threadArgs + i)->count = totalItems / config.numWriters + (index < totalItems % config.numWriters);
+        } else if (role == ROLE_READER) {
+            sprintf(nameBuffer, config.numReaders == 1 ? "Reader" : "Reader #%d", index + 1);
+            if (copyRecords) {
+                SlabInit(&(threadArgs + i)->copies, &(threadArgs + i)->scratch, sizeof(recordCopy) + config.maxRecord);
+                ArenaInit(&(threadArgs + i)->scratch, (threadArgs + i)->copies.refill * (threadArgs + i)->copies.objectSize);
+            }
+        } else if (role == ROLE_TRANSFORMER) {
+            sprintf(nameBuffer, "Transformer #%d.%d", stage + 1, index + 1);
+            (threadArgs + i)->output = links + stage;
+        } else {
+            sprintf(nameBuffer, "Processor #%d", index + 1);
+        }
+        if (config.numProcessors > 0 && role != ROLE_WRITER) {
+            (threadArgs + i)->dispatch = &dispatch;
+            (threadArgs + i)->deque = dispatch.deques + (role == ROLE_READER ? index : config.numReaders + index);
+        }
+        (threadArgs + i)->name = ArenaStrdup(&setup, nameBuffer);
+        (threadArgs + i)->traceOutput = config.traceOutput;
+        (threadArgs + i)->trace = TraceRingFor(&trace, i, nameBuffer);
+        (threadArgs + i)->channel = role == ROLE_WRITER ? links : links + stage - 1;
+        (threadArgs + i)->stage = stage;
+        (threadArgs + i)->instrument = config.instrument;
+        (threadArgs + i)->batch = config.batch;
+        (threadArgs + i)->minRecord = config.minRecord;
+        (threadArgs + i)->maxRecord = config.maxRecord;
+        (threadArgs + i)->bench = &config.bench;
+        (threadArgs + i)->seed = RngNext(&(threadArgs + i)->rng);
+        (threadArgs + i)->stageLeft = stageLeft + stage;
+        (threadArgs + i)->role = role;
+        (threadArgs + i)->skew = config.skew;
+        (threadArgs + i)->stream = config.inputFile != NULL ? &stream : NULL;
+        if (config.kernel.run != NULL && role != ROLE_WRITER) {
+            (threadArgs + i)->kernel = &config.kernel;
+            (threadArgs + i)->kernelWork = (kernelState*) ArenaCalloc(&setup, 1, sizeof(kernelState));
+        }
+        if (config.bench.enabled) {
+            LatencyInit(&(threadArgs + i)->latency, (threadArgs + i)->seed);
+            LatencyInit(&(threadArgs + i)->wakeups, ~(threadArgs + i)->seed);
+        }
+        EpochThreadInit(&(threadArgs + i)->epoch);
+        taskArgs[i] = threadArgs + i;
+    }
+
+    // the writers and readers are the only threads that touch the queue
+    if (nodes) {
+        epochThread** epochs = (epochThread**) ArenaCalloc(&setup, config.numWriters + config.numReaders,
+                                                           sizeof(void*));
+
+        for (i = 0; i < config.numWriters + config.numReaders; i++) epochs[i] = &(threadArgs + i)->epoch;
+        EpochInit(&links->nodes->epochs, epochs, config.numWriters + config.numReaders);
     }
-    rc = pthread_create(&reader, NULL, Reader, (void*) &readerData);
+
+    TracerDescribe(&trace, "readerWriter", baseSeed);
+    TracerStart(&trace, config.traceLogger);
+    rc = PoolInit(&pool, localThreads, &attr, &config.placement);
     if (rc != 0) {
-        printf("ERROR: pthread_create(&reader,...) failed with return code of %d\n.", rc);
+        printf("ERROR: pthread_create() failed with return code of %d\n.", rc);
         exit(1);
     }
 
     pthread_attr_destroy(&attr);
 
-    rc = pthread_join(writer, &status);
-    if (rc != 0) {
-        printf("ERROR: pthread_join(&writer,...) failed with return code of %d\n.", rc);
-        exit(1);
+    // a shared channel's rounds start once both sides are there
+    if (config.shmName != NULL) ShmAwaitPeers(&segment);
+    for (round = 0; round < config.rounds; round++) {
+        if (!config.bench.enabled && config.rounds > 1) printf("Round %d\n", round + 1);
+        for (stage = 0; stage < config.stages - 1; stage++) atomic_store(stageLeft + stage, config.stageThreads[stage]);
+        atomic_store(&dispatch.readersLeft, config.numReaders);
+        if (config.inputFile != NULL) atomic_store(&stream.next, 0);
+        // the writers of a shared channel wait for the readers to have opened it again
+        if (config.side == ROLE_WRITER)
+            while (atomic_load(&links->closed)) usleep(SHM_POLL_US);
+        roundStart = NowNs();
+        PoolSubmit(&pool, RunRole, taskArgs + localFirst);
+        if (config.bench.enabled) {
+            config.bench.startNs = NowNs();
+            BenchBegin(&config.bench);
+        }
+        PoolWait(&pool);
+        streamNs += NowNs() - roundStart;
+        if (config.bench.enabled) {
+            elapsedNs += NowNs() - config.bench.startNs;
+            LatencyRecord(&roundLatency, NowNs() - roundStart);
+        }
+        // from the writers' close until the last reader was done with what was left
+        if (config.bench.enabled && config.side != ROLE_WRITER) {
+            for (lastDone = 0, i = config.numWriters; i < config.numWriters + config.numReaders; i++)
+                if ((threadArgs + i)->doneNs > lastDone) lastDone = (threadArgs + i)->doneNs;
+            shutdownNs = lastDone > links->closedNs ? lastDone - links->closedNs : 0;
+            shutdownSum += shutdownNs;
+            if (shutdownNs > shutdownMax) shutdownMax = shutdownNs;
+        }
+        // every link was closed as its writers finished; only the reader side reopens a shared one
+        if (config.shmName == NULL)
+            for (link = 0; link < numLinks; link++) ChannelReopen(links + link);
+        else if (config.side == ROLE_READER)
+            ChannelReopen(links);
+        // nobody is inside an epoch between rounds, so whatever is still retired can go
+        if (nodes)
+            for (i = 0; i < config.numWriters + config.numReaders; i++) EpochDrain(&(threadArgs + i)->epoch);
+        // every copy has been processed by now, so the readers' pools can go in one step
+        if (copyRecords)
+            for (i = config.numWriters; i < config.numWriters + config.numReaders; i++) {
+                SlabReset(&(threadArgs + i)->copies);
+                ArenaReset(&(threadArgs + i)->scratch);
+            }
     }
-    rc = pthread_join(reader, &status);
-    if (rc != 0) {
-        printf("ERROR: pthread_join(&reader,...) failed with return code of %d\n.", rc);
+    PoolDestroy(&pool);
+
+    TracerFinish(&trace);
+    if (traceOut != stdout) fclose(traceOut);
+
+    if (config.bench.enabled) {
+        const latencyLog** logs = (const latencyLog**) ArenaCalloc(&setup, numThreads, sizeof(latencyLog*));
+        const latencyLog** wakeups = (const latencyLog**) ArenaCalloc(&setup, numThreads, sizeof(latencyLog*));
+        long written = 0, read = 0, bytes = 0;
+
+        for (i = 0; i < numThreads; i++) {
+            logs[i] = &(threadArgs + i)->latency;
+            wakeups[i] = &(threadArgs + i)->wakeups;
+            if ((threadArgs + i)->role == ROLE_WRITER) written += (threadArgs + i)->ops;
+            else if ((threadArgs + i)->role == ROLE_READER) {
+                read += (threadArgs + i)->ops;
+                bytes += (threadArgs + i)->bytes;
+            }
+        }
+        snprintf(label, sizeof(label), "benchmark: readerWriter transport=%s writers=%d readers=%d stages=%d batch=%d capacity=%zu rounds=%d work=%lu affinity=%s wait=%s spin=%d seed=%llu",
+                 transportNames[config.transport], config.numWriters, config.numReaders, config.stages, config.batch,
+                 config.capacity, config.rounds, config.bench.work, placementNames[config.placement.kind],
+                 waitNames[config.wait], config.spinBudget, (unsigned long long) baseSeed);
+        printf("%s\n", label);
+        if (config.shmName != NULL)
+            printf("shared memory %s, %s side\n", segment.name, config.side == ROLE_WRITER ? "writer" : "reader");
+        if (config.side != ROLE_READER) BenchReport("writers (ChannelPut)", written, elapsedNs, logs, config.numWriters);
+        for (stage = 1; stage < config.stages - 1; stage++) {
+            long moved = 0;
+
+            for (i = stageFirst[stage]; i < stageFirst[stage] + config.stageThreads[stage]; i++) moved += (threadArgs + i)->ops;
+            snprintf(label, sizeof(label), "stage %d transformers (ChannelGet)", stage + 1);
+            BenchReport(label, moved, elapsedNs, logs + stageFirst[stage], config.stageThreads[stage]);
+        }
+        if (config.side != ROLE_WRITER)
+            BenchReport("readers (ChannelGet)", read, elapsedNs, logs + config.numWriters, config.numReaders);
+        if (config.side != ROLE_READER) LatencyReport("writers waking (buffer full)", wakeups, config.numWriters);
+        if (config.side != ROLE_WRITER)
+            LatencyReport("readers waking (buffer empty)", wakeups + config.numWriters, config.numReaders);
+        if (records) {
+            printf("payload (records of %u-%u bytes)\n", config.minRecord, config.maxRecord);
+            printf("  bytes        %ld\n", bytes);
+            printf("  bandwidth    %.1f MB/s\n", elapsedNs > 0 ? bytes * 1e3 / elapsedNs : 0.0);
+        }
+        if (nodes) ReportReclamation(threadArgs, config.numWriters + config.numReaders, links);
+        if (config.numProcessors > 0)
+            ReportProcessors(threadArgs + config.numWriters, config.numReaders, config.numProcessors);
+        for (stage = 1; stage < config.stages; stage++) consumers[stage] = threadArgs + stageFirst[stage];
+        if (config.side != ROLE_WRITER) ReportPipeline(&config, consumers, config.stageThreads, links, elapsedNs);
+        if (config.side != ROLE_WRITER) {
+            printf("shutdown (writers' close to the last reader done)\n");
+            printf("  mean         %.1f us\n", shutdownSum / 1e3 / config.rounds);
+            printf("  max          %.1f us\n", shutdownMax / 1e3);
+        }
+        if (config.rounds > 1) {
+            roundLogs[0] = &roundLatency;
+            BenchReport("rounds (submitted to last thread done)", config.rounds, elapsedNs, roundLogs, 1);
+        }
+        LatencyDestroy(&roundLatency);
+        for (i = 0; i < numThreads; i++) {
+            LatencyDestroy(&(threadArgs + i)->latency);
+            LatencyDestroy(&(threadArgs + i)->wakeups);
+        }
+        pthread_barrier_destroy(&config.bench.start);
+    }
+
+    if (config.maxCapacity > 0) ReportAdaptive(links, numLinks);
+    if (config.kernel.run != NULL) ReportKernel(&config.kernel, threadArgs + localFirst, localThreads, elapsedNs);
+    if (config.inputFile != NULL) StreamClose(&stream, config.rounds, streamNs);
+    if (config.instrument) ReportContention(&config, threadArgs, numThreads, stageFirst, &setup);
+    if (config.numProcessors > 0) {
+        if (!config.bench.enabled)
+            ReportProcessors(threadArgs + config.numWriters, config.numReaders, config.numProcessors);
+        for (i = 0; i < dispatch.numDeques; i++) DequeDestroy(dispatch.deques + i);
+    }
+    if (copyRecords)
+        for (i = config.numWriters; i < config.numWriters + config.numReaders; i++) ArenaDestroy(&(threadArgs + i)->scratch);
+    if (config.shmName != NULL) {
+        // the other side may still be using the channel, in which case it tears it down
+        if (ShmLeave(&segment)) ChannelDestroy(links);
+        ShmDetach(&segment);
+    } else {
+        for (link = 0; link < numLinks; link++) ChannelDestroy(links + link);
+        ArenaDestroy(&channelArena);
+    }
+    ArenaDestroy(&setup);
+    if (!config.bench.enabled) printf("All Done!\n");
+}
+
+static void Usage(const char* prog)
+{
+    printf("usage: %s [-t sem|spsc|mpmc|futex|records|nodes] [-w writers] [-r readers] [-b batch]\n", prog);
+    printf("       [-c capacity [-A min:max]] [-i items] [-z min[:max]]\n");
+    printf("       [-B [-W work] [-n ops | -d seconds]] [-T stdio|text|binary|off [-o file] [-L]]\n");
+    printf("       [-a none|compact|scatter|list:CPUS|numa[:N]] [-N rounds] [-P processors [-K skew]]\n");
+    printf("       [-y spin|yield|spin-futex|block [-Y spins]] [-S stages [-g threads[,threads...]]]\n");
+    printf("       [-I] [-J file] [-f input [-O output]] [-k checksum|fold|histogram[:isa]]\n");
+    printf("       [-H name -R writer|reader]\n");
+    printf("  -t, --transport   sem: two counting semaphores (default)\n");
+    printf("                    spsc: lock-free single-producer/single-consumer ring\n");
+    printf("                    mpmc: lock-free bounded queue with per-slot sequence numbers\n");
+    printf("                    futex: like sem, with futex counters that move a batch per wake-up\n");
+    printf("                    records: variable-size records reserved, read and released in place\n");
+    printf("                    nodes: the same records on the heap, in a lock-free linked queue\n");
+    printf("                    whose nodes are freed by epoch-based reclamation\n");
+    printf("  -w, --writers     number of writer threads, or auto for half the CPUs (default 1)\n");
+    printf("  -r, --readers     number of reader threads, or auto for the other half (default 1)\n");
+    printf("  -b, --batch       most items moved per channel operation (default 1)\n");
+    printf("  -c, --capacity    number of buffers, a power of two (default %d); for records,\n", NUM_TOTAL_BUFFERS);
+    printf("                    how many of the largest records fit in the ring, and for nodes\n");
+    printf("                    how many records may be in flight\n");
+    printf("  -A, --adapt       let the sem or futex buffer grow and shrink between these powers\n");
+    printf("                    of two as writers stall on it; -c is where it starts\n");
+    printf("  -i, --items       items each writer writes (default %d)\n", DATA_LENGTH);
+    printf("  -z, --record-size payload bytes per record, or a range to draw from (default %d:%d)\n",
+           MIN_RECORD_SIZE, MAX_RECORD_SIZE);
+    printf("  -B, --bench       run as a benchmark and report throughput and latency\n");
+    printf("  -W, --work        busy-work iterations per item in a benchmark (default 0)\n");
+    printf("  -n, --ops         items to move in a benchmark (default %d)\n", DEFAULT_BENCH_OPS);
+    printf("  -d, --duration    run a benchmark for this many seconds instead\n");
+    printf("  -N, --rounds      run the whole job this many times on the same threads (default 1)\n");
+    printf("  -P, --processors  hand what is read to this many work-stealing processor threads,\n");
+    printf("                    or auto for one per CPU (default 0: readers process it themselves)\n");
+    printf("  -K, --skew        in a benchmark one item in skew costs skew times the work (default 1)\n");
+    printf("  -y, --wait        how to wait for a full or empty buffer: spin, yield (after spinning),\n");
+    printf("                    spin-futex (sleep after spinning) or block (default: each\n");
+    printf("                    transport's own, block for sem and futex, yield for spsc and mpmc,\n");
+    printf("                    spin-futex for records and nodes)\n");
+    printf("  -Y, --spin-budget checks before yield or spin-futex give up spinning (default %d)\n",
+           WAIT_SPIN_BUDGET);
+    printf("  -S, --stages      stages in the pipeline, counting the writers and the readers; the\n");
+    printf("                    ones in between transform what they read and pass it on (default 2)\n");
+    printf("  -g, --stage-threads  threads in each transform stage, one count for all of them or\n");
+    printf("                    one per stage (default 1)\n");
+    printf("  -I, --instrument  count each thread's channel operations, how many had to wait,\n");
+    printf("                    and how long they waited and held the buffers, and print a table;\n");
+    printf("                    not with the records or nodes transport\n");
+    printf("  -J, --json        also write those tables to this file as JSON (implies -I)\n");
+    printf("  -f, --input       stream this file through the records or nodes transport, in chunks\n");
+    printf("                    of the largest record size (-z), and report the bandwidth\n");
+    printf("  -O, --output      where the readers write the streamed file, batches of up to -b\n");
+    printf("                    chunks at a time (default: nowhere)\n");
+    printf("  -k, --kernel      process by running checksum, fold or histogram over the bytes\n");
+    printf("                    read instead of sleeping or busy-work, with :scalar, :avx2,\n");
+    printf("                    :avx512 or :neon to pick the version (default: the widest)\n");
+    printf("  -H, --shm         put the buffer in this POSIX shared memory segment, for a writer\n");
+    printf("                    process and a reader process started with the same settings\n");
+    printf("                    (sem, spsc or mpmc transport, two stages)\n");
+    printf("  -R, --side        which threads this process runs with -H: writer or reader\n");
+    printf("  -E, --seed        seed the random letters, delays and record sizes with this instead\n");
+    printf("                    of the clock, so that a run can be repeated on the same input\n");
+    printf("  -T, --trace       stdio: print each handoff as it happens (default, off in a benchmark)\n");
+    printf("                    text, binary: record handoffs in per-thread rings and write them\n");
+    printf("                    out at the end; off: no output\n");
+    printf("  -o, --trace-file  write the trace here instead of to stdout\n");
+    printf("  -L, --trace-logger  drain the trace rings from a background thread as it runs\n");
+    printf("  -a, --affinity    where to pin threads: none (default), compact, scatter,\n");
+    printf("                    list:CPUS such as list:0,2,4-7, or numa[:N] for one node\n");
+    printf("Each option can also be set with the environment variable listed here;\n");
+    printf("the command line wins when both are given:\n ");
+    for (size_t i = 0; i < sizeof(envOptions) / sizeof(envOptions[0]); i++)
+        printf(" %s (-%c)", envOptions[i].name, envOptions[i].opt);
+    printf("\n");
+}
+
+/**
+ * ApplyOption
+ * -----------
+ * Applies one setting, from the command line or the environment, to the
+ * programConfig in ctx.
+ */
+
+static void ApplyOption(void* ctx, int opt, const char* arg)
+{
+    programConfig* config = (programConfig*) ctx;
+    int cpus = OnlineCpus();
+
+    switch (opt) {
+    case 't':
+        if (strcmp(arg, "sem") == 0) config->transport = TRANSPORT_SEM;
+        else if (strcmp(arg, "spsc") == 0) config->transport = TRANSPORT_SPSC;
+        else if (strcmp(arg, "mpmc") == 0) config->transport = TRANSPORT_MPMC;
+        else if (strcmp(arg, "futex") == 0) config->transport = TRANSPORT_FUTEX;
+        else if (strcmp(arg, "records") == 0) config->transport = TRANSPORT_RECORDS;
+        else if (strcmp(arg, "nodes") == 0) config->transport = TRANSPORT_NODES;
+        else {
+            printf("ERROR: unknown transport '%s'\n", arg);
+            exit(1);
+        }
+        break;
+    case 'w':
+        config->numWriters = ParseThreadCount(arg, "writers", cpus / 2, MAX_THREADS);
+        break;
+    case 'r':
+        config->numReaders = ParseThreadCount(arg, "readers", cpus - cpus / 2, MAX_THREADS);
+        break;
+    case 'b':
+        config->batch = (int) ParseLong(arg, "batch", 1, MAX_BATCH);
+        break;
+    case 'c':
+        config->capacity = ParsePowerOfTwo(arg, "capacity", MAX_TOTAL_BUFFERS);
+        break;
+    case 'A': {
+        char bound[32];
+        const char* colon = strchr(arg, ':');
+
+        if (colon == NULL) {
+            printf("ERROR: adaptive capacity needs min:max, got '%s'\n", arg);
+            exit(1);
+        }
+        snprintf(bound, sizeof(bound), "%.*s", (int) (colon - arg), arg);
+        config->minCapacity = ParsePowerOfTwo(bound, "adaptive capacity", MAX_TOTAL_BUFFERS);
+        config->maxCapacity = ParsePowerOfTwo(colon + 1, "adaptive capacity", MAX_TOTAL_BUFFERS);
+        if (config->maxCapacity < config->minCapacity) {
+            printf("ERROR: adaptive capacity %zu:%zu has its bounds the wrong way round\n", config->minCapacity,
+                   config->maxCapacity);
+            exit(1);
+        }
+        break;
+    }
+    case 'i':
+        config->items = ParseLong(arg, "items", 1, LONG_MAX / MAX_THREADS);
+        break;
+    case 'B':
+        config->bench.enabled = arg == NULL || strcmp(arg, "0") != 0;
+        break;
+    case 'W':
+        config->bench.work = (unsigned long) ParseLong(arg, "work", 0, LONG_MAX);
+        break;
+    case 'n':
+        config->bench.ops = ParseLong(arg, "ops", 1, LONG_MAX);
+        break;
+    case 'd':
+        config->bench.duration = ParseDuration(arg, "duration");
+        break;
+    case 'T':
+        if (!TraceModeFromName(arg, &config->traceOutput)) {
+            printf("ERROR: unknown trace output '%s'\n", arg);
+            exit(1);
+        }
+        break;
+    case 'o':
+        config->traceFile = arg;
+        break;
+    case 'L':
+        config->traceLogger = arg == NULL || strcmp(arg, "0") != 0;
+        break;
+    case 'a':
+        if (!PlacementFromSpec(arg, &config->placement)) {
+            printf("ERROR: unknown or unusable affinity '%s'\n", arg);
+            exit(1);
+        }
+        break;
+    case 'N':
+        config->rounds = (int) ParseLong(arg, "rounds", 1, MAX_ROUNDS);
+        break;
+    case 'P':
+        config->numProcessors = strcmp(arg, "auto") == 0 ? ParseThreadCount(arg, "processors", cpus, MAX_THREADS)
+                                                         : (int) ParseLong(arg, "processors", 0, MAX_THREADS);
+        break;
+    case 'K':
+        config->skew = (int) ParseLong(arg, "skew", 1, MAX_SKEW);
+        break;
+    case 'y': {
+        waitStrategy strategy;
+
+        if (!WaitStrategyFromName(arg, &strategy)) {
+            printf("ERROR: unknown wait strategy '%s'\n", arg);
+            exit(1);
+        }
+        config->wait = (int) strategy;
+        break;
+    }
+    case 'Y':
+        config->spinBudget = (int) ParseLong(arg, "spin budget", 0, MAX_SPIN_BUDGET);
+        break;
+    case 'I':
+        config->instrument = arg == NULL || strcmp(arg, "0") != 0;
+        break;
+    case 'J':
+        config->jsonFile = arg;
+        config->instrument = true;
+        break;
+    case 'f':
+        config->inputFile = arg;
+        break;
+    case 'O':
+        config->outputFile = arg;
+        break;
+    case 'k':
+        if (!KernelFromName(arg, &config->kernel)) {
+            printf("ERROR: unknown kernel '%s'\n", arg);
+            exit(1);
+        }
+        if (!KernelSelect(&config->kernel)) {
+            printf("ERROR: this CPU cannot run the %s version of %s\n", isaNames[config->kernel.isa],
+                   kernelNames[config->kernel.kind]);
+            exit(1);
+        }
+        break;
+    case 'H':
+        config->shmName = arg;
+        break;
+    case 'R':
+        if (strcmp(arg, "writer") == 0) config->side = ROLE_WRITER;
+        else if (strcmp(arg, "reader") == 0) config->side = ROLE_READER;
+        else {
+            printf("ERROR: unknown side '%s'\n", arg);
+            exit(1);
+        }
+        break;
+    case 'E':
+        config->seeded = true;
+        config->seed = ParseSeed(arg);
+        break;
+    case 'S':
+        config->stages = (int) ParseLong(arg, "stages", 2, MAX_STAGES);
+        break;
+    case 'g': {
+        char count[32];
+        const char* next;
+
+        config->numStageCounts = 0;
+        for (; *arg != '\0'; arg = *next == ',' ? next + 1 : next) {
+            next = strchr(arg, ',');
+            if (next == NULL) next = arg + strlen(arg);
+            if (config->numStageCounts == MAX_STAGES - 2) {
+                printf("ERROR: more than %d stage thread counts\n", MAX_STAGES - 2);
+                exit(1);
+            }
+            snprintf(count, sizeof(count), "%.*s", (int) (next - arg), arg);
+            config->stageCounts[config->numStageCounts++] = (int) ParseLong(count, "stage threads", 1, MAX_THREADS);
+        }
+        break;
+    }
+    case 'z': {
+        char bound[32];
+        const char* colon = strchr(arg, ':');
+        size_t length = colon != NULL ? (size_t) (colon - arg) : strlen(arg);
+
+        snprintf(bound, sizeof(bound), "%.*s", (int) length, arg);
+        config->minRecord = (uint32_t) ParseLong(bound, "record size", 1, MAX_RECORD_LIMIT);
+        config->maxRecord = colon != NULL ? (uint32_t) ParseLong(colon + 1, "record size", config->minRecord,
+                                                                 MAX_RECORD_LIMIT)
+                                          : config->minRecord;
+        break;
+    }
+    }
+}
+
+/**
+ * ChannelInit
+ * -----------
+ * Sets up the shared buffer for the chosen transport. The semaphore
+ * transport starts with every buffer counted as empty; the SPSC ring starts
+ * with head == tail, which is how it represents empty; every MPMC cell
+ * starts with its sequence equal to its own index, ready for the first lap
+ * of writers; the record ring starts out empty with all its offsets at
+ * zero, and the record queue with only its dummy node, the one node that
+ * comes from the heap rather than the arena. Everything else is drawn
+ * from the arena a, which ChannelFootprint says how large to make. The
+ * buffers are written here, not just allocated, so their pages are placed
+ * on the NUMA node of the thread that calls ChannelInit. A shared channel
+ * lives in memory other processes map too, and gets process-shared
+ * semaphores and locks.
+ */
+
+static size_t ChannelFootprint(transportKind transport, size_t capacity)
+{
+    switch (transport) {
+    case TRANSPORT_SPSC:
+        return sizeof(spscRing) + capacity * sizeof(char) + 2 * CACHE_LINE_SIZE;
+    case TRANSPORT_MPMC:
+        return sizeof(mpmcQueue) + capacity * sizeof(mpmcCell) + 2 * CACHE_LINE_SIZE;
+    case TRANSPORT_RECORDS:
+        return sizeof(recordRing) + capacity + 2 * CACHE_LINE_SIZE;
+    case TRANSPORT_NODES:
+        return sizeof(recordQueue) + CACHE_LINE_SIZE;
+    default:
+        return capacity * sizeof(char) + CACHE_LINE_SIZE;
+    }
+}
+
+static void ChannelInit(channel* ch, transportKind transport, size_t capacity, arena* a, bool shared)
+{
+    pthread_mutexattr_t lockAttr;
+    size_t i;
+
+    memset(ch, 0, sizeof(*ch));
+    ch->transport = transport;
+    ch->capacity = capacity;
+    ch->mask = capacity - 1;
+    EventInit(&ch->dataReady);
+    EventInit(&ch->spaceFree);
+    atomic_init(&ch->closed, false);
+    switch (transport) {
+    case TRANSPORT_SPSC:
+        ch->ring = (spscRing*) ArenaAlloc(a, sizeof(spscRing), CACHE_LINE_SIZE);
+        memset(ch->ring, 0, sizeof(spscRing));
+        atomic_init(&ch->ring->head, 0);
+        atomic_init(&ch->ring->tail, 0);
+        ch->ring->buffers = (char*) ArenaAlloc(a, capacity * sizeof(char), CACHE_LINE_SIZE);
+        memset(ch->ring->buffers, 0, capacity * sizeof(char));
+        break;
+    case TRANSPORT_MPMC:
+        ch->queue = (mpmcQueue*) ArenaAlloc(a, sizeof(mpmcQueue), CACHE_LINE_SIZE);
+        atomic_init(&ch->queue->enqueuePos, 0);
+        atomic_init(&ch->queue->dequeuePos, 0);
+        ch->queue->cells = (mpmcCell*) ArenaAlloc(a, capacity * sizeof(mpmcCell), CACHE_LINE_SIZE);
+        memset(ch->queue->cells, 0, capacity * sizeof(mpmcCell));
+        for (i = 0; i < capacity; i++) atomic_init(&ch->queue->cells[i].sequence, i);
+        break;
+    case TRANSPORT_SEM:
+    case TRANSPORT_FUTEX:
+        ch->sharedBuffer = (char*) ArenaAlloc(a, capacity * sizeof(char), CACHE_LINE_SIZE);
+        memset(ch->sharedBuffer, 0, capacity * sizeof(char));
+        sem_init(&ch->emptyBuffers, shared, capacity);
+        sem_init(&ch->fullBuffers, shared, 0);
+        CounterInit(&ch->emptyCount, capacity);
+        CounterInit(&ch->fullCount, 0);
+        pthread_mutexattr_init(&lockAttr);
+        pthread_mutexattr_setpshared(&lockAttr, shared ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE);
+        pthread_mutex_init(&ch->writeLock, &lockAttr);
+        pthread_mutex_init(&ch->readLock, &lockAttr);
+        pthread_mutexattr_destroy(&lockAttr);
+        break;
+    case TRANSPORT_RECORDS:
+        ch->records = (recordRing*) ArenaAlloc(a, sizeof(recordRing), CACHE_LINE_SIZE);
+        memset(ch->records, 0, sizeof(recordRing));
+        atomic_init(&ch->records->head, 0);
+        atomic_init(&ch->records->tail, 0);
+        atomic_init(&ch->records->readPos, 0);
+        pthread_mutex_init(&ch->records->writeLock, NULL);
+        pthread_mutex_init(&ch->records->readLock, NULL);
+        pthread_mutex_init(&ch->records->releaseLock, NULL);
+        ch->records->size = capacity;
+        ch->records->bytes = (char*) ArenaAlloc(a, capacity, CACHE_LINE_SIZE);
+        memset(ch->records->bytes, 0, capacity);
+        break;
+    case TRANSPORT_NODES: {
+        recordNode* dummy = (recordNode*) calloc(1, sizeof(recordNode));
+
+        ch->nodes = (recordQueue*) ArenaAlloc(a, sizeof(recordQueue), CACHE_LINE_SIZE);
+        memset(ch->nodes, 0, sizeof(recordQueue));
+        atomic_init(&dummy->next, NULL);
+        atomic_init(&ch->nodes->head, dummy);
+        atomic_init(&ch->nodes->tail, dummy);
+        atomic_init(&ch->nodes->serial, 0);
+        CounterInit(&ch->emptyCount, capacity);
+        CounterInit(&ch->fullCount, 0);
+        break;
+    }
+    }
+}
+
+/**
+ * ChannelDestroy
+ * --------------
+ * Tears down the channel's semaphores and locks; its memory goes with the
+ * arena it came from, but for the nodes still in the record queue.
+ */
+
+static void ChannelDestroy(channel* ch)
+{
+    recordNode *node, *next;
+
+    switch (ch->transport) {
+    case TRANSPORT_NODES:
+        for (node = atomic_load(&ch->nodes->head); node != NULL; node = next) {
+            next = atomic_load(&node->next);
+            free(node);
+        }
+        break;
+    case TRANSPORT_SPSC:
+    case TRANSPORT_MPMC:
+        break;
+    case TRANSPORT_SEM:
+    case TRANSPORT_FUTEX:
+        if (ch->adapt.ownsBuffer) free(ch->sharedBuffer);
+        sem_destroy(&ch->emptyBuffers);
+        sem_destroy(&ch->fullBuffers);
+        pthread_mutex_destroy(&ch->writeLock);
+        pthread_mutex_destroy(&ch->readLock);
+        break;
+    case TRANSPORT_RECORDS:
+        pthread_mutex_destroy(&ch->records->writeLock);
+        pthread_mutex_destroy(&ch->records->readLock);
+        pthread_mutex_destroy(&ch->records->releaseLock);
+        break;
+    }
+}
+
+/**
+ * ChannelSetAdaptive
+ * ------------------
+ * Lets a sem or futex channel, set up with a capacity between the two
+ * bounds, resize itself within them from now on.
+ */
+
+static void ChannelSetAdaptive(channel* ch, size_t minCapacity, size_t maxCapacity)
+{
+    ch->adapt.minCapacity = minCapacity;
+    ch->adapt.maxCapacity = maxCapacity;
+    ch->adapt.largest = ch->adapt.smallest = ch->capacity;
+    atomic_init(&ch->adapt.current, ch->capacity);
+}
+
+/**
+ * ChannelAdapt
+ * ------------
+ * Called by the writer whose put closed a window of ADAPT_WINDOW puts on
+ * an adaptive channel, once that put is done. If more than one put in
+ * ADAPT_STALL_RATIO stalled on a full buffer, the capacity doubles; if none
+ * did and the buffer was never more than a quarter full, it halves.
+ *
+ * Every copy into or out of the buffers happens under the write or the
+ * read lock, so while this holds both no handoff is in progress, and the
+ * unread items, at positions readPt up to writePt, can be moved to a new
+ * array. A writer that has claimed space but not yet taken the write lock
+ * writes at writePt and on, which the new array has room for: a shrink
+ * first takes the buffers it drops out of the empty count, and so out of
+ * reach of writers, and gives up until the next window when they aren't
+ * all free. A grow hands its new buffers to the writers once it is done.
+ */
+
+static void ChannelAdapt(channel* ch)
+{
+    channelAdapt* adapt = &ch->adapt;
+    size_t capacity = ch->capacity, added, pos;
+    char* buffers;
+
+    pthread_mutex_lock(&ch->writeLock);
+    if (adapt->windowStalls * ADAPT_STALL_RATIO > adapt->windowPuts) {
+        if (capacity < adapt->maxCapacity) capacity *= 2;
+    } else if (adapt->windowStalls == 0 && adapt->windowPeak * 4 <= capacity && capacity > adapt->minCapacity) {
+        capacity /= 2;
+    }
+    adapt->windowPuts = adapt->windowStalls = 0;
+    adapt->windowPeak = 0;
+    if (capacity == ch->capacity || (capacity < ch->capacity && !ChannelTakeEmpty(ch, ch->capacity - capacity))) {
+        pthread_mutex_unlock(&ch->writeLock);
+        return;
+    }
+
+    buffers = (char*) aligned_alloc(CACHE_LINE_SIZE, (capacity + CACHE_LINE_SIZE - 1) & ~(size_t) (CACHE_LINE_SIZE - 1));
+    if (buffers == NULL) {
+        printf("ERROR: cannot allocate %zu buffers for an adaptive channel\n", capacity);
         exit(1);
     }
+    pthread_mutex_lock(&ch->readLock);
+    for (pos = ch->readPt; pos != ch->writePt; pos++) buffers[pos & (capacity - 1)] = ch->sharedBuffer[pos & ch->mask];
+    if (adapt->ownsBuffer) free(ch->sharedBuffer);
+    ch->sharedBuffer = buffers;
+    adapt->ownsBuffer = true;
+    added = capacity > ch->capacity ? capacity - ch->capacity : 0;
+    if (added > 0) adapt->grows++;
+    else adapt->shrinks++;
+    if (capacity > adapt->largest) adapt->largest = capacity;
+    if (capacity < adapt->smallest) adapt->smallest = capacity;
+    ch->capacity = capacity;
+    ch->mask = capacity - 1;
+    atomic_store_explicit(&adapt->current, capacity, memory_order_relaxed);
+    pthread_mutex_unlock(&ch->readLock);
+    pthread_mutex_unlock(&ch->writeLock);
+
+    if (added == 0) return;
+    EventStamp(&ch->spaceFree, &ch->wait);
+    if (ch->transport == TRANSPORT_FUTEX) CounterGive(&ch->emptyCount, (int) added);
+    else
+        while (added-- > 0) sem_post(&ch->emptyBuffers);
+}
+
+// takes n empty buffers out of circulation if they are free right now, or none of them
+static bool ChannelTakeEmpty(channel* ch, size_t n)
+{
+    size_t i;
 
-    sem_destroy(&emptyBuffers);
-    sem_destroy(&fullBuffers);
-    free(randStateBuffers);
-    free(randStates);
-    printf("All Done!\n");
+    if (ch->transport == TRANSPORT_FUTEX) return CounterTryTake(&ch->emptyCount, (int) n);
+    for (i = 0; i < n; i++) {
+        if (sem_trywait(&ch->emptyBuffers) != 0) {
+            while (i-- > 0) sem_post(&ch->emptyBuffers);
+            return false;
+        }
+    }
+    return true;
 }
 
 /**
- * Writer
- * ------
- * This is the routine forked by the Writer thread. It will loop until
- * all data is written. It prepares the data to be written, the waits
- * for an empty buffer to be available to write the data to, after which
- * it signals that a full buffer is ready.
+ * ChannelPut
+ * ----------
+ * Claims between 1 and n empty buffers in one step, copies the first values
+ * into them, marks them all full together and returns how many were used.
+ * The claimed buffers are consecutive positions starting at *firstPos, so
+ * the j'th value went into buffer (*firstPos + j) & ch->mask. Only the
+ * wait for the first empty buffer ever blocks; any more are taken only if
+ * they are already free, so a batch never waits on a reader that is itself
+ * waiting on this writer.
+ *
+ * On the SPSC ring the writer re-reads the reader's head only when its
+ * cached copy says the ring is full, and waits while it stays full.
+ * On the MPMC queue a writer that finds its first cell still a lap behind
+ * knows the queue is full and waits; one that finds it ahead lost the race
+ * for that position and simply retries with the current one. Every wait
+ * follows the channel's wait policy, and in a benchmark records how long
+ * the writer took to wake up in wakeups.
+ *
+ * If contention is given, the put is counted in it as one acquisition:
+ * the wait runs until the buffers are claimed and the hold until they are
+ * handed over. A put is contended if it had to wait for space, lost a
+ * race for it or found the write lock taken.
+ *
+ * If echo is given, the values are printed as that writer's, in stdio
+ * mode, once they are in their buffers but before any reader can take
+ * them, so that an item is never seen read before it is written.
  */
 
-static void* Writer(void* writerData)
+static int ChannelPut(channel* ch, const char* values, int n, size_t* firstPos, latencyLog* wakeups,
+                      contentionStats* contention, threadData* echo)
 {
-    int i, writePt;
-    char dataToWrite;
+    size_t pos;
+    int i, taken, full;
+    waiter w = {0};
+    bool waiting = false, contended = false, stalled, adapt = false;
+    uint64_t start = ContentionStart(contention);
 
-    threadData* data = (threadData*) writerData;
+    switch (ch->transport) {
+    case TRANSPORT_MPMC: {
+        mpmcQueue* queue = ch->queue;
+        pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+        for (;;) {
+            size_t seq = atomic_load_explicit(&queue->cells[pos & ch->mask].sequence, memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+            if (diff == 0) {
+                // the first cell is free; extend the claim over any free cells after it
+                for (taken = 1; taken < n && (size_t) taken < ch->capacity; taken++) {
+                    seq = atomic_load_explicit(&queue->cells[(pos + taken) & ch->mask].sequence,
+                                               memory_order_acquire);
+                    if (seq != pos + taken) break;
+                }
+                if (atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos + taken,
+                                                          memory_order_relaxed, memory_order_relaxed))
+                    break;
+                contended = true;
+            } else {
+                contended = true;
+                if (diff < 0) {
+                    if (!waiting) WaitBegin(&w, &ch->wait, &ch->spaceFree);
+                    waiting = true;
+                    WaitPause(&w);
+                }
+                pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+            }
+        }
+        if (waiting) WaitEnd(&w, wakeups);
+        ContentionAcquired(contention, start, contended);
+        EchoPut(echo, pos, values, taken);
+        for (i = 0; i < taken; i++) {
+            mpmcCell* cell = &queue->cells[(pos + i) & ch->mask];
+            cell->value = values[i];
+            atomic_store_explicit(&cell->sequence, pos + i + 1, memory_order_release);
+        }
+        ContentionReleased(contention);
+        EventNotify(&ch->dataReady, &ch->wait);
+        break;
+    }
+
+    case TRANSPORT_SPSC: {
+        spscRing* ring = ch->ring;
+        pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        if (pos - ring->cachedHead == ch->capacity) {
+            contended = true;
+            WaitBegin(&w, &ch->wait, &ch->spaceFree);
+            while (pos - (ring->cachedHead = atomic_load_explicit(&ring->head, memory_order_acquire)) == ch->capacity)
+                WaitPause(&w);
+            WaitEnd(&w, wakeups);
+        }
+        taken = (int) (ch->capacity - (pos - ring->cachedHead));
+        if (taken > n) taken = n;
+        ContentionAcquired(contention, start, contended);
+        for (i = 0; i < taken; i++) ring->buffers[(pos + i) & ch->mask] = values[i];
+        EchoPut(echo, pos, values, taken);
+        atomic_store_explicit(&ring->tail, pos + taken, memory_order_release);
+        ContentionReleased(contention);
+        EventNotify(&ch->dataReady, &ch->wait);
+        break;
+    }
 
-    for (i = 0; i < DATA_LENGTH; i++) {
-        dataToWrite = PrepareData(writerData);
-        sem_wait(data->pEmptyBuffers);
-        data->sharedBuffer[writePt] = dataToWrite;
-        printf("%s: buffer[%d] = %c\n", data->name, writePt, dataToWrite);
-        writePt = (writePt + 1) % NUM_TOTAL_BUFFERS;
-        sem_post(data->pFullBuffers);
+    case TRANSPORT_FUTEX:
+        contended = stalled = CounterCount(&ch->emptyCount) == 0;
+        taken = CounterWait(&ch->emptyCount, n, &ch->wait, &ch->spaceFree, wakeups);
+        ChannelLock(&ch->writeLock, contention, &contended);
+        ContentionAcquired(contention, start, contended);
+        pos = ch->writePt;
+        for (i = 0; i < taken; i++) ch->sharedBuffer[(pos + i) & ch->mask] = values[i];
+        EchoPut(echo, pos, values, taken);
+        ch->writePt += taken;
+        if (ch->adapt.maxCapacity > 0)
+            adapt = AdaptCountPut(&ch->adapt, stalled, CounterCount(&ch->fullCount) + taken);
+        pthread_mutex_unlock(&ch->writeLock);
+        EventStamp(&ch->dataReady, &ch->wait);
+        CounterGive(&ch->fullCount, taken);
+        ContentionReleased(contention);
+        break;
+
+    case TRANSPORT_SEM:
+    default:
+        contended = stalled = !SemWait(&ch->emptyBuffers, &ch->wait, &ch->spaceFree, wakeups);
+        for (taken = 1; taken < n && sem_trywait(&ch->emptyBuffers) == 0; taken++)
+            ;
+        ChannelLock(&ch->writeLock, contention, &contended);
+        ContentionAcquired(contention, start, contended);
+        pos = ch->writePt;
+        for (i = 0; i < taken; i++) ch->sharedBuffer[(pos + i) & ch->mask] = values[i];
+        EchoPut(echo, pos, values, taken);
+        ch->writePt += taken;
+        if (ch->adapt.maxCapacity > 0) {
+            sem_getvalue(&ch->fullBuffers, &full);
+            adapt = AdaptCountPut(&ch->adapt, stalled, (full > 0 ? full : 0) + taken);
+        }
+        pthread_mutex_unlock(&ch->writeLock);
+        EventStamp(&ch->dataReady, &ch->wait);
+        for (i = 0; i < taken; i++) sem_post(&ch->fullBuffers);
+        ContentionReleased(contention);
+        break;
     }
 
-    pthread_exit((void*) writerData);
+    // only once this put has been handed over, so that no handoff of this thread's is in progress
+    if (adapt) ChannelAdapt(ch);
+    *firstPos = pos;
+    return taken;
 }
 
-static void* Reader(void* readerData)
+// counts a put on an adaptive channel, under the write lock; true if it closed the window
+static bool AdaptCountPut(channelAdapt* adapt, bool stalled, size_t full)
 {
-    int i, readPt = 0;
-    char dataToRead;
+    adapt->puts++;
+    adapt->fullStalls += stalled;
+    adapt->windowStalls += stalled;
+    if (full > adapt->windowPeak) adapt->windowPeak = full;
+    return ++adapt->windowPuts == ADAPT_WINDOW;
+}
 
-    threadData* data = (threadData*) readerData;
+/**
+ * ChannelGet
+ * ----------
+ * The mirror image of ChannelPut: waits for at least one full buffer, takes
+ * up to n of them, copies their contents into values and hands them all
+ * back as empty. Returns how many values were read, and counts the get in
+ * contention, if given, as ChannelPut does.
+ *
+ * Once the channel is closed and empty it returns 0 instead of waiting. A
+ * reader that sees the close takes one more look before believing the
+ * channel is empty, since the puts before the close are only sure to be
+ * visible after it. On the semaphore transport the close is one extra unit
+ * of fullBuffers, which no item goes with: whoever takes it finds fewer
+ * items than units and posts it again for the next reader.
+ */
+
+static int ChannelGet(channel* ch, char* values, int n, size_t* firstPos, latencyLog* wakeups,
+                      contentionStats* contention)
+{
+    size_t pos;
+    int i, taken, surplus = 0;
+    waiter w = {0};
+    bool waiting = false, contended = false, stalled, closing = false;
+    uint64_t start = ContentionStart(contention);
+
+    switch (ch->transport) {
+    case TRANSPORT_MPMC: {
+        mpmcQueue* queue = ch->queue;
+        pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+        for (;;) {
+            size_t seq = atomic_load_explicit(&queue->cells[pos & ch->mask].sequence, memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+            if (diff == 0) {
+                for (taken = 1; taken < n && (size_t) taken < ch->capacity; taken++) {
+                    seq = atomic_load_explicit(&queue->cells[(pos + taken) & ch->mask].sequence,
+                                               memory_order_acquire);
+                    if (seq != pos + taken + 1) break;
+                }
+                if (atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos + taken,
+                                                          memory_order_relaxed, memory_order_relaxed))
+                    break;
+                contended = true;
+            } else {
+                contended = true;
+                if (diff < 0 && atomic_load_explicit(&ch->closed, memory_order_acquire)) {
+                    taken = 0;
+                    if (closing) break;
+                    closing = true;
+                } else if (diff < 0) {
+                    if (!waiting) WaitBegin(&w, &ch->wait, &ch->dataReady);
+                    waiting = true;
+                    WaitPause(&w);
+                }
+                pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+            }
+        }
+        if (waiting) WaitEnd(&w, wakeups);
+        ContentionAcquired(contention, start, contended);
+        for (i = 0; i < taken; i++) {
+            mpmcCell* cell = &queue->cells[(pos + i) & ch->mask];
+            values[i] = cell->value;
+            atomic_store_explicit(&cell->sequence, pos + i + ch->capacity, memory_order_release);
+        }
+        ContentionReleased(contention);
+        EventNotify(&ch->spaceFree, &ch->wait);
+        break;
+    }
+
+    case TRANSPORT_SPSC: {
+        spscRing* ring = ch->ring;
+        pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        if (pos == ring->cachedTail) {
+            contended = true;
+            WaitBegin(&w, &ch->wait, &ch->dataReady);
+            while (pos == (ring->cachedTail = atomic_load_explicit(&ring->tail, memory_order_acquire)) && !closing) {
+                if (atomic_load_explicit(&ch->closed, memory_order_acquire)) closing = true;
+                else WaitPause(&w);
+            }
+            WaitEnd(&w, wakeups);
+        }
+        taken = (int) (ring->cachedTail - pos);
+        if (taken > n) taken = n;
+        ContentionAcquired(contention, start, contended);
+        for (i = 0; i < taken; i++) values[i] = ring->buffers[(pos + i) & ch->mask];
+        atomic_store_explicit(&ring->head, pos + taken, memory_order_release);
+        ContentionReleased(contention);
+        EventNotify(&ch->spaceFree, &ch->wait);
+        break;
+    }
+
+    case TRANSPORT_FUTEX:
+        contended = stalled = CounterCount(&ch->fullCount) == 0;
+        taken = CounterWait(&ch->fullCount, n, &ch->wait, &ch->dataReady, wakeups);
+        if (taken == 0) {
+            *firstPos = 0;
+            return 0;
+        }
+        ChannelLock(&ch->readLock, contention, &contended);
+        ContentionAcquired(contention, start, contended);
+        pos = ch->readPt;
+        for (i = 0; i < taken; i++) values[i] = ch->sharedBuffer[(pos + i) & ch->mask];
+        ch->readPt += taken;
+        ch->adapt.gets++;
+        ch->adapt.emptyStalls += stalled;
+        pthread_mutex_unlock(&ch->readLock);
+        EventStamp(&ch->spaceFree, &ch->wait);
+        CounterGive(&ch->emptyCount, taken);
+        ContentionReleased(contention);
+        break;
+
+    case TRANSPORT_SEM:
+    default:
+        contended = stalled = !SemWait(&ch->fullBuffers, &ch->wait, &ch->dataReady, wakeups);
+        for (taken = 1; taken < n && sem_trywait(&ch->fullBuffers) == 0; taken++)
+            ;
+        ChannelLock(&ch->readLock, contention, &contended);
+        ContentionAcquired(contention, start, contended);
+        pos = ch->readPt;
+        // once closed, writePt no longer moves, and a unit without an item behind it is the close
+        if (atomic_load_explicit(&ch->closed, memory_order_acquire) && (size_t) taken > ch->writePt - pos) {
+            surplus = taken - (int) (ch->writePt - pos);
+            taken -= surplus;
+        }
+        for (i = 0; i < taken; i++) values[i] = ch->sharedBuffer[(pos + i) & ch->mask];
+        ch->readPt += taken;
+        ch->adapt.gets++;
+        ch->adapt.emptyStalls += stalled;
+        pthread_mutex_unlock(&ch->readLock);
+        EventStamp(&ch->spaceFree, &ch->wait);
+        for (i = 0; i < taken; i++) sem_post(&ch->emptyBuffers);
+        for (i = 0; i < surplus; i++) sem_post(&ch->fullBuffers);
+        ContentionReleased(contention);
+        break;
+    }
+
+    *firstPos = pos;
+    return taken;
+}
+
+/**
+ * ChannelLock
+ * -----------
+ * Locks a channel's read or write lock, noting in *contended whether it
+ * was taken when the caller is counting contention.
+ */
+
+static void ChannelLock(pthread_mutex_t* lock, const contentionStats* contention, bool* contended)
+{
+    if (contention != NULL && pthread_mutex_trylock(lock) == 0) return;
+    if (contention != NULL) *contended = true;
+    pthread_mutex_lock(lock);
+}
+
+/**
+ * ChannelClose
+ * ------------
+ * Called by the last writer of a link once everything it and the others
+ * wrote has been put: from now on a reader that finds the channel empty
+ * stops instead of waiting. The futex and nodes transports close their
+ * fullCount, which wakes every reader sleeping on it at once, and the
+ * semaphore transport posts a single extra unit that the readers pass on
+ * to each other. Readers waiting under a spinning strategy, or on one of
+ * the rings, see the flag, and those asleep on dataReady are woken by the
+ * notification.
+ */
+
+static void ChannelClose(channel* ch)
+{
+    ch->closedNs = NowNs();
+    atomic_store_explicit(&ch->closed, true, memory_order_release);
+    if (ch->transport == TRANSPORT_SEM) sem_post(&ch->fullBuffers);
+    else if (ch->transport == TRANSPORT_FUTEX || ch->transport == TRANSPORT_NODES) CounterClose(&ch->fullCount);
+    EventNotify(&ch->dataReady, &ch->wait);
+}
+
+// between rounds, once every reader has stopped: takes the close back, and the semaphore's unit with it
+static void ChannelReopen(channel* ch)
+{
+    atomic_store(&ch->closed, false);
+    if (ch->transport == TRANSPORT_SEM) sem_trywait(&ch->fullBuffers);
+    else if (ch->transport == TRANSPORT_FUTEX || ch->transport == TRANSPORT_NODES) CounterReopen(&ch->fullCount);
+}
+
+/**
+ * RecordSize
+ * ----------
+ * The space a record with the given payload takes up in the ring.
+ */
+
+static size_t RecordSize(uint32_t length)
+{
+    return (sizeof(recordHeader) + length + RECORD_ALIGN - 1) & ~(size_t) (RECORD_ALIGN - 1);
+}
+
+/**
+ * RecordRingSize
+ * --------------
+ * A ring large enough for capacity records of the largest size, rounded up
+ * to a power of two, so -c bounds the records in flight much as it bounds
+ * the buffers of the other transports. It always has room for two, since a
+ * record that has to skip the end of the ring can cost up to twice its size.
+ */
+
+static size_t RecordRingSize(size_t capacity, uint32_t maxRecord)
+{
+    size_t needed = (capacity < 2 ? 2 : capacity) * RecordSize(maxRecord), size = 1;
 
-    for (i = 0; i < DATA_LENGTH; i++) {
-        sem_wait(data->pFullBuffers);
-        dataToRead = data->sharedBuffer[readPt];
-        printf("\t\t\t\t%s: buffer[%d] = %c\n", data->name, readPt, dataToRead);
-        readPt = (readPt + 1) % NUM_TOTAL_BUFFERS;
-        sem_post(data->pEmptyBuffers);
-        ProcessData(readerData);
+    while (size < needed) size <<= 1;
+    return size;
+}
+
+/**
+ * RecordReserve
+ * -------------
+ * Claims room for a record of length payload bytes at the tail, padding
+ * out the end of the ring first if the record wouldn't fit there, and
+ * waits for enough of the ring to be released if it is full. The record
+ * stays invisible to readers until RecordCommit. Writers take turns under
+ * writeLock only for the reservation itself, not while they fill their
+ * records in. On the nodes transport the writer instead waits for one of
+ * the capacity places to be free and mallocs a node for the record, which
+ * gets its serial here, so writers racing to link theirs in can link them
+ * out of serial order.
+ */
+
+static void RecordReserve(channel* ch, uint32_t length, recordView* view, latencyLog* wakeups)
+{
+    recordRing* ring = ch->records;
+    size_t size = RecordSize(length), pos, offset, pad;
+    recordHeader* header;
+    waiter w;
+
+    if (ch->transport == TRANSPORT_NODES) {
+        CounterWait(&ch->emptyCount, 1, &ch->wait, &ch->spaceFree, wakeups);
+        view->node = (recordNode*) malloc(sizeof(recordNode) + length);
+        if (view->node == NULL) {
+            printf("ERROR: cannot allocate a record of %u bytes\n", length);
+            exit(1);
+        }
+        view->node->length = length;
+        view->node->serial = atomic_fetch_add_explicit(&ch->nodes->serial, 1, memory_order_relaxed);
+        view->header = NULL;
+        view->data = view->node->data;
+        view->length = length;
+        view->pos = view->node->serial;
+        return;
+    }
+    pthread_mutex_lock(&ring->writeLock);
+    pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    offset = pos & (ring->size - 1);
+    pad = offset + size > ring->size ? ring->size - offset : 0;
+    if (pos + pad + size - atomic_load_explicit(&ring->head, memory_order_acquire) > ring->size) {
+        WaitBegin(&w, &ch->wait, &ch->spaceFree);
+        while (pos + pad + size - atomic_load_explicit(&ring->head, memory_order_acquire) > ring->size)
+            WaitPause(&w);
+        WaitEnd(&w, wakeups);
     }
+    if (pad > 0) {
+        header = (recordHeader*) (ring->bytes + offset);
+        header->length = (uint32_t) (pad - sizeof(recordHeader));
+        atomic_store_explicit(&header->state, RECORD_PAD, memory_order_relaxed);
+        pos += pad;
+    }
+    header = (recordHeader*) (ring->bytes + (pos & (ring->size - 1)));
+    header->length = length;
+    atomic_store_explicit(&header->state, RECORD_RESERVED, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, pos + size, memory_order_release);
+    pthread_mutex_unlock(&ring->writeLock);
+
+    view->header = header;
+    view->data = (char*) (header + 1);
+    view->length = length;
+    view->pos = pos;
+}
 
-    pthread_exit((void*) readerData);
+// returns the record's position, the one RecordReserve gave it
+static size_t RecordCommit(channel* ch, const recordView* view, epochThread* epoch)
+{
+    if (ch->transport == TRANSPORT_NODES) {
+        NodeEnqueue(ch, view->node, epoch);
+    } else {
+        atomic_store_explicit(&view->header->state, RECORD_COMMITTED, memory_order_release);
+        EventNotify(&ch->dataReady, &ch->wait);
+    }
+    return view->pos;
 }
 
-static void ProcessData(void* readerData)
+/**
+ * RecordAcquire
+ * -------------
+ * Hands the oldest unread record to the calling reader, skipping pad
+ * records, and waits for it to be committed if its writer is still
+ * filling it in. On the nodes transport the reader waits for a record to
+ * be linked and unlinks it, and is inside its epoch until RecordRelease.
+ * Returns false, with nothing acquired, once the channel is closed and
+ * every record has been handed out.
+ */
+
+static bool RecordAcquire(channel* ch, recordView* view, latencyLog* wakeups, epochThread* epoch)
 {
-    int result;
-    random_r(((threadData*) readerData)->randBuffer, &result);
-    usleep(500000 + (result % 1500000));
+    recordRing* ring = ch->records;
+    size_t pos;
+    recordHeader* header;
+    unsigned int state;
+    waiter w = {0};
+    bool waiting = false, closing = false;
+
+    if (ch->transport == TRANSPORT_NODES) {
+        if (CounterWait(&ch->fullCount, 1, &ch->wait, &ch->dataReady, wakeups) == 0) return false;
+        view->node = NodeDequeue(ch, view, epoch);
+        return true;
+    }
+    pthread_mutex_lock(&ring->readLock);
+    pos = atomic_load_explicit(&ring->readPos, memory_order_relaxed);
+    for (;;) {
+        if (pos < atomic_load_explicit(&ring->tail, memory_order_acquire)) {
+            header = (recordHeader*) (ring->bytes + (pos & (ring->size - 1)));
+            state = atomic_load_explicit(&header->state, memory_order_acquire);
+            if (state == RECORD_PAD) {
+                pos += RecordSize(header->length);
+                continue;
+            }
+            if (state == RECORD_COMMITTED) break;
+        } else if (atomic_load_explicit(&ch->closed, memory_order_acquire)) {
+            // every record was committed before the close, but the tail has to be looked at again
+            if (closing) break;
+            closing = true;
+            continue;
+        }
+        if (!waiting) WaitBegin(&w, &ch->wait, &ch->dataReady);
+        waiting = true;
+        WaitPause(&w);
+    }
+    if (waiting) WaitEnd(&w, wakeups);
+    if (closing && pos >= atomic_load_explicit(&ring->tail, memory_order_relaxed)) {
+        pthread_mutex_unlock(&ring->readLock);
+        return false;
+    }
+    atomic_store_explicit(&ring->readPos, pos + RecordSize(header->length), memory_order_release);
+    pthread_mutex_unlock(&ring->readLock);
+
+    view->header = header;
+    view->data = (char*) (header + 1);
+    view->length = header->length;
+    view->pos = pos;
+    return true;
 }
 
-static char PrepareData(void* writerData)
+/**
+ * RecordTryAcquire
+ * ----------------
+ * RecordAcquire for a ring reader that already holds records: it takes
+ * the oldest unread record only if it is committed and no other reader is
+ * at the ring, and never waits. The head cannot move past a record that is
+ * still held, so a reader waiting for more while holding one could wait
+ * for a writer that in turn waits for it.
+ */
+
+static bool RecordTryAcquire(channel* ch, recordView* view)
 {
-    int result;
-    random_r(((threadData*) writerData)->randBuffer, &result);
-    usleep(500000 + (result % 1500000));
-    return ((char)(65 + (result % 25)));
+    recordRing* ring = ch->records;
+    size_t pos;
+    recordHeader* header;
+    unsigned int state;
+
+    // a reader waiting in RecordAcquire keeps readLock, so this one gives up rather than wait for it
+    if (pthread_mutex_trylock(&ring->readLock) != 0) return false;
+    pos = atomic_load_explicit(&ring->readPos, memory_order_relaxed);
+    while (pos < atomic_load_explicit(&ring->tail, memory_order_acquire)) {
+        header = (recordHeader*) (ring->bytes + (pos & (ring->size - 1)));
+        state = atomic_load_explicit(&header->state, memory_order_acquire);
+        if (state == RECORD_PAD) {
+            pos += RecordSize(header->length);
+            continue;
+        }
+        if (state != RECORD_COMMITTED) break;
+        atomic_store_explicit(&ring->readPos, pos + RecordSize(header->length), memory_order_release);
+        pthread_mutex_unlock(&ring->readLock);
+        view->header = header;
+        view->data = (char*) (header + 1);
+        view->length = header->length;
+        view->pos = pos;
+        return true;
+    }
+    pthread_mutex_unlock(&ring->readLock);
+    return false;
+}
+
+/**
+ * RecordRelease
+ * -------------
+ * Marks the record as done with and moves the head past every released
+ * or pad record at the front of the ring, waking any writer waiting for
+ * the space. On the nodes transport the reader retires the old dummy,
+ * leaves its epoch and gives the record's place back.
+ */
+
+static void RecordRelease(channel* ch, const recordView* view, epochThread* epoch)
+{
+    recordRing* ring = ch->records;
+    size_t head, end;
+    recordHeader* header;
+    unsigned int state;
+    bool moved = false;
+
+    if (ch->transport == TRANSPORT_NODES) {
+        EpochRetire(&ch->nodes->epochs, epoch, &view->node->retired);
+        EpochExit(epoch);
+        EventStamp(&ch->spaceFree, &ch->wait);
+        CounterGive(&ch->emptyCount, 1);
+        return;
+    }
+    atomic_store_explicit(&view->header->state, RECORD_RELEASED, memory_order_release);
+    pthread_mutex_lock(&ring->releaseLock);
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    end = atomic_load_explicit(&ring->readPos, memory_order_acquire);
+    while (head < end) {
+        header = (recordHeader*) (ring->bytes + (head & (ring->size - 1)));
+        state = atomic_load_explicit(&header->state, memory_order_acquire);
+        if (state != RECORD_RELEASED && state != RECORD_PAD) break;
+        head += RecordSize(header->length);
+        moved = true;
+    }
+    if (moved) atomic_store_explicit(&ring->head, head, memory_order_release);
+    pthread_mutex_unlock(&ring->releaseLock);
+    if (moved) EventNotify(&ch->spaceFree, &ch->wait);
+}
+
+/**
+ * NodeEnqueue
+ * -----------
+ * Links a node in at the tail of the record queue, following Michael and
+ * Scott: the node goes after the last one with a compare-and-swap, and the
+ * tail, which may lag one node behind, is swung after it by whoever gets
+ * there first. The writer is inside its epoch for this, since the node the
+ * tail points to may be unlinked by a reader meanwhile.
+ */
+
+static void NodeEnqueue(channel* ch, recordNode* node, epochThread* epoch)
+{
+    recordQueue* queue = ch->nodes;
+    recordNode *tail, *next;
+
+    atomic_init(&node->next, NULL);
+    EpochEnter(&queue->epochs, epoch);
+    for (;;) {
+        tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        if (tail != atomic_load_explicit(&queue->tail, memory_order_acquire)) continue;
+        if (next != NULL) {
+            atomic_compare_exchange_weak_explicit(&queue->tail, &tail, next, memory_order_release, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&tail->next, &next, node, memory_order_release, memory_order_relaxed))
+            break;
+    }
+    atomic_compare_exchange_strong_explicit(&queue->tail, &tail, node, memory_order_release, memory_order_relaxed);
+    EpochExit(epoch);
+    EventStamp(&ch->dataReady, &ch->wait);
+    CounterGive(&ch->fullCount, 1);
+}
+
+/**
+ * NodeDequeue
+ * -----------
+ * Unlinks the oldest record for a reader that has already taken one unit
+ * of fullCount, so there is always a record after the dummy. The record's
+ * node becomes the new dummy. The old one is returned, to be retired once
+ * the record is released, and the record is described in *view. The reader
+ * is left inside its epoch.
+ */
+
+static recordNode* NodeDequeue(channel* ch, recordView* view, epochThread* epoch)
+{
+    recordQueue* queue = ch->nodes;
+    recordNode *head, *tail, *next;
+
+    EpochEnter(&queue->epochs, epoch);
+    for (;;) {
+        head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        next = atomic_load_explicit(&head->next, memory_order_acquire);
+        if (head != atomic_load_explicit(&queue->head, memory_order_acquire) || next == NULL) continue;
+        // the tail must never be left behind on a node that is about to be retired
+        if (head == tail) {
+            atomic_compare_exchange_weak_explicit(&queue->tail, &tail, next, memory_order_release, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&queue->head, &head, next, memory_order_acq_rel, memory_order_relaxed))
+            break;
+    }
+    view->header = NULL;
+    view->data = next->data;
+    view->length = next->length;
+    view->pos = next->serial;
+    return head;
+}
+
+/**
+ * ReportReclamation
+ * -----------------
+ * How many nodes the writers and readers retired, in how many lists they
+ * were freed, and how often the epoch moved on.
+ */
+
+static void ReportReclamation(const threadData* threads, int numThreads, const channel* ch)
+{
+    long retired = 0, freed = 0, batches = 0;
+    int i;
+
+    for (i = 0; i < numThreads; i++) {
+        retired += threads[i].epoch.retired;
+        freed += threads[i].epoch.freed;
+        batches += threads[i].epoch.batches;
+    }
+    printf("reclamation (epochs)\n");
+    printf("  retired      %ld nodes\n", retired);
+    printf("  freed        %ld in %ld batches (%.1f each)\n", freed, batches, batches > 0 ? (double) freed / batches : 0.0);
+    printf("  advances     %ld\n", atomic_load(&ch->nodes->epochs.advances));
+}
+
+/**
+ * ReportAdaptive
+ * --------------
+ * Where each adaptive buffer's capacity went, and the stalls that moved it.
+ */
+
+static void ReportAdaptive(const channel* links, int numLinks)
+{
+    const channelAdapt* adapt;
+    int link;
+
+    for (link = 0; link < numLinks; link++) {
+        adapt = &links[link].adapt;
+        if (numLinks == 1) printf("adaptive capacity (%zu-%zu)\n", adapt->minCapacity, adapt->maxCapacity);
+        else printf("adaptive capacity of buffer %d (%zu-%zu)\n", link + 1, adapt->minCapacity, adapt->maxCapacity);
+        printf("  capacity     %zu at the end, %zu-%zu along the way\n", links[link].capacity, adapt->smallest,
+               adapt->largest);
+        printf("  resizes      %ld grows, %ld shrinks\n", adapt->grows, adapt->shrinks);
+        printf("  full stalls  %ld of %ld puts (%.1f%%)\n", adapt->fullStalls, adapt->puts,
+               adapt->puts > 0 ? 100.0 * adapt->fullStalls / adapt->puts : 0.0);
+        printf("  empty stalls %ld of %ld gets (%.1f%%)\n", adapt->emptyStalls, adapt->gets,
+               adapt->gets > 0 ? 100.0 * adapt->emptyStalls / adapt->gets : 0.0);
+    }
+}
+
+// where a thread records its wake-up latency, if anywhere
+static latencyLog* Wakeups(threadData* data)
+{
+    return data->bench->enabled ? &data->wakeups : NULL;
+}
+
+// and where it counts its channel operations, with -I
+static contentionStats* Contention(threadData* data)
+{
+    return data->instrument ? &data->contention : NULL;
+}
+
+// and for whom a put prints its items, in stdio mode, before they can be read
+static threadData* Echo(threadData* data)
+{
+    return data->traceOutput == TRACE_STDIO ? data : NULL;
+}
+
+// whether a thread's handoffs go into its trace ring
+static bool Recording(const threadData* data)
+{
+    return data->traceOutput == TRACE_TEXT || data->traceOutput == TRACE_BINARY;
+}
+
+static void EchoPut(threadData* echo, size_t pos, const char* values, int n)
+{
+    int i;
+
+    if (echo != NULL)
+        for (i = 0; i < n; i++) ReportHandoff(echo, EVENT_WRITE, pos + i, values[i], 0);
+}
+
+/**
+ * Writer
+ * ------
+ * This is the routine forked by the Writer thread. It will loop until
+ * all data is written. It prepares a batch of data to be written, then waits
+ * for empty buffers to be available to write the data to, after which
+ * it signals that full buffers are ready. A batch that doesn't fit in the
+ * buffers available goes out over several channel operations.
+ */
+
+static void* Writer(void* writerData)
+{
+    int i, done, moved, want;
+    long written = 0, batches = 0;
+    size_t writePt;
+    uint64_t start, at, deadline = UINT64_MAX;
+    char records[MAX_BATCH];
+
+    threadData* data = (threadData*) writerData;
+    benchConfig* bench = data->bench;
+
+    if (bench->enabled) {
+        BenchBegin(bench);
+        deadline = BenchDeadline(bench);
+    }
+
+    while (written < data->count) {
+        if (deadline != UINT64_MAX && ++batches % DEADLINE_CHECK_INTERVAL == 0 && NowNs() >= deadline) break;
+        want = data->count - written < data->batch ? data->count - written : data->batch;
+        PrepareData(writerData, records, want);
+        for (done = 0; done < want; done += moved) {
+            start = bench->enabled ? NowNs() : 0;
+            at = Recording(data) ? NowNs() : 0;
+            moved = ChannelPut(data->channel, records + done, want - done, &writePt, Wakeups(data), Contention(data),
+                               Echo(data));
+            if (bench->enabled) LatencyRecord(&data->latency, NowNs() - start);
+            if (Recording(data))
+                for (i = 0; i < moved; i++) ReportHandoff(data, EVENT_WRITE, writePt + i, records[done + i], at);
+        }
+        written += want;
+    }
+
+    data->ops += written;
+    if (atomic_fetch_sub(data->stageLeft, 1) == 1) ChannelClose(data->channel);
+    return writerData;
+}
+
+/**
+ * Reader
+ * ------
+ * Takes batches from the last link of the pipeline and processes them, or
+ * hands them to the processors, until the link is closed and empty.
+ */
+
+static void* Reader(void* readerData)
+{
+    int got;
+    long read = 0;
+    char records[MAX_BATCH];
+
+    threadData* data = (threadData*) readerData;
+    benchConfig* bench = data->bench;
+
+    if (bench->enabled) BenchBegin(bench);
+
+    while ((got = TakeBatch(data, records, data->batch)) > 0) {
+        if (data->dispatch != NULL) Dispatch(data, records, got);
+        else ProcessData(readerData, records, got);
+        read += got;
+    }
+
+    if (data->dispatch != NULL) FinishDispatch(data);
+    data->doneNs = NowNs();
+    data->ops += read;
+    return readerData;
+}
+
+/**
+ * Transformer
+ * -----------
+ * A thread of one of the stages between the writers and the readers. It
+ * takes a batch from the link before it, pays for transforming it as a
+ * reader pays for processing, and writes it on to the link after it. Once
+ * the link before it is closed and empty, the last thread of the stage to
+ * finish closes the link after it, which it only does with its batch put.
+ */
+
+static void* Transformer(void* transformerData)
+{
+    int got;
+    long moved = 0;
+    char records[MAX_BATCH];
+
+    threadData* data = (threadData*) transformerData;
+    benchConfig* bench = data->bench;
+
+    if (bench->enabled) BenchBegin(bench);
+
+    while ((got = TakeBatch(data, records, data->batch)) > 0) {
+        ProcessData(transformerData, records, got);
+        PutBatch(data, data->output, records, got);
+        moved += got;
+    }
+
+    data->ops += moved;
+    if (atomic_fetch_sub(data->stageLeft, 1) == 1) ChannelClose(data->output);
+    return transformerData;
+}
+
+/**
+ * TakeBatch
+ * ---------
+ * Reads up to want items from the thread's input link, timing the read in
+ * a benchmark. Returns how many were read, which is only 0 once the link
+ * is closed and there is nothing left on it.
+ */
+
+static int TakeBatch(threadData* data, char* records, int want)
+{
+    int i, got;
+    size_t readPt;
+    uint64_t start, at;
+    benchConfig* bench = data->bench;
+
+    if (bench->enabled) SampleOccupancy(data);
+    start = bench->enabled ? NowNs() : 0;
+    got = ChannelGet(data->channel, records, want, &readPt, Wakeups(data), Contention(data));
+    if (bench->enabled) LatencyRecord(&data->latency, NowNs() - start);
+    if (data->traceOutput != TRACE_OFF)
+        for (i = 0, at = NowNs(); i < got; i++) ReportHandoff(data, EVENT_READ, readPt + i, records[i], at);
+    return got;
+}
+
+/**
+ * PutBatch
+ * --------
+ * Writes all n items to ch, over as many channel operations as it takes.
+ */
+
+static void PutBatch(threadData* data, channel* ch, const char* records, int n)
+{
+    int i, done, moved;
+    size_t writePt;
+    uint64_t at;
+
+    for (done = 0; done < n; done += moved) {
+        at = Recording(data) ? NowNs() : 0;
+        moved = ChannelPut(ch, records + done, n - done, &writePt, Wakeups(data), Contention(data), Echo(data));
+        if (Recording(data))
+            for (i = 0; i < moved; i++) ReportHandoff(data, EVENT_WRITE, writePt + i, records[done + i], at);
+    }
+}
+
+/**
+ * RecordWriter
+ * ------------
+ * The writer for the record transport. Every item is one record of a
+ * random size between the configured bounds: it is reserved in the ring,
+ * filled in place by PrepareRecord and committed. The last writer to stop
+ * closes the channel.
+ */
+
+static void* RecordWriter(void* writerData)
+{
+    threadData* data = (threadData*) writerData;
+    benchConfig* bench = data->bench;
+    recordView view;
+    long written = 0;
+    uint32_t length;
+    uint64_t start, at, deadline = UINT64_MAX;
+    size_t pos;
+    char first;
+
+    if (bench->enabled) {
+        BenchBegin(bench);
+        deadline = BenchDeadline(bench);
+    }
+
+    while (written < data->count) {
+        if (deadline != UINT64_MAX && written % DEADLINE_CHECK_INTERVAL == 0 && NowNs() >= deadline) break;
+        length = data->minRecord + RngBelow(&data->rng, data->maxRecord - data->minRecord + 1);
+        start = bench->enabled ? NowNs() : 0;
+        RecordReserve(data->channel, length, &view, Wakeups(data));
+        if (bench->enabled) LatencyRecord(&data->latency, NowNs() - start);
+        PrepareRecord(data, view.data, length);
+        first = view.data[0];
+        if (data->traceOutput == TRACE_STDIO) ReportHandoff(data, EVENT_WRITE, view.pos, first, 0);
+        at = Recording(data) ? NowNs() : 0;
+        pos = RecordCommit(data->channel, &view, &data->epoch);
+        if (Recording(data)) ReportHandoff(data, EVENT_WRITE, pos, first, at);
+        data->bytes += length;
+        written++;
+    }
+
+    data->ops += written;
+    if (atomic_fetch_sub(data->stageLeft, 1) == 1) ChannelClose(data->channel);
+    return writerData;
+}
+
+/**
+ * RecordReader
+ * ------------
+ * Takes records from the ring one at a time and processes them where they
+ * are, or copies them into its slab pool for the processors and gives
+ * their space in the ring back at once, until the channel is closed and
+ * empty.
+ */
+
+static void* RecordReader(void* readerData)
+{
+    threadData* data = (threadData*) readerData;
+    benchConfig* bench = data->bench;
+    recordView view;
+    recordCopy* copy;
+    long read = 0;
+    uint64_t start;
+    bool open;
+
+    if (bench->enabled) BenchBegin(bench);
+
+    for (;;) {
+        if (bench->enabled) SampleOccupancy(data);
+        start = bench->enabled ? NowNs() : 0;
+        open = RecordAcquire(data->channel, &view, Wakeups(data), &data->epoch);
+        if (bench->enabled) LatencyRecord(&data->latency, NowNs() - start);
+        if (!open) break;
+        if (data->traceOutput != TRACE_OFF) ReportHandoff(data, EVENT_READ, view.pos, view.data[0], 0);
+        data->bytes += view.length;
+        read++;
+        if (data->dispatch != NULL) {
+            copy = (recordCopy*) SlabAlloc(&data->copies);
+            copy->owner = &data->copies;
+            copy->length = view.length;
+            memcpy(copy->data, view.data, view.length);
+            RecordRelease(data->channel, &view, &data->epoch);
+            PushWork(data, (int64_t) (intptr_t) copy);
+            SignalWork(data->dispatch);
+        } else {
+            ProcessRecord(data, &view);
+            RecordRelease(data->channel, &view, &data->epoch);
+        }
+    }
+
+    if (data->dispatch != NULL) FinishDispatch(data);
+    data->doneNs = NowNs();
+    data->ops += read;
+    return readerData;
+}
+
+/**
+ * StreamWriter
+ * ------------
+ * Claims the file's chunks in order and copies each from the mapped input
+ * into a record of its own, straight behind the chunk's offset.
+ */
+
+static void* StreamWriter(void* writerData)
+{
+    threadData* data = (threadData*) writerData;
+    fileStream* stream = data->stream;
+    benchConfig* bench = data->bench;
+    recordView view;
+    long written = 0;
+    uint64_t offset, start, at;
+    size_t length, pos;
+
+    if (bench->enabled) BenchBegin(bench);
+
+    while (written < data->count) {
+        offset = (uint64_t) atomic_fetch_add_explicit(&stream->next, 1, memory_order_relaxed) * stream->chunk;
+        length = stream->size - offset < stream->chunk ? stream->size - offset : stream->chunk;
+        start = bench->enabled ? NowNs() : 0;
+        RecordReserve(data->channel, (uint32_t) (STREAM_HEADER + length), &view, Wakeups(data));
+        if (bench->enabled) LatencyRecord(&data->latency, NowNs() - start);
+        memcpy(view.data, &offset, STREAM_HEADER);
+        memcpy(view.data + STREAM_HEADER, stream->map + offset, length);
+        at = data->traceOutput != TRACE_OFF ? NowNs() : 0;
+        pos = RecordCommit(data->channel, &view, &data->epoch);
+        if (data->traceOutput != TRACE_OFF) ReportHandoff(data, EVENT_WRITE, pos, stream->map[offset], at);
+        data->bytes += length;
+        written++;
+    }
+
+    data->ops += written;
+    if (atomic_fetch_sub(data->stageLeft, 1) == 1) ChannelClose(data->channel);
+    return writerData;
+}
+
+/**
+ * StreamReader
+ * ------------
+ * Waits for a chunk, takes whatever more have been committed behind it, up
+ * to a batch, writes them out together and only then releases them, so
+ * their payload goes from the ring to the output without a copy of its
+ * own. A record queue's reader can only hold one node at a time, so from
+ * the nodes transport the batches are single chunks. With -k each chunk
+ * goes through the kernel on its way out.
+ */
+
+static void* StreamReader(void* readerData)
+{
+    threadData* data = (threadData*) readerData;
+    benchConfig* bench = data->bench;
+    recordView views[MAX_BATCH];
+    int held, i, batch = data->channel->transport == TRANSPORT_NODES ? 1 : data->batch;
+    long read = 0;
+    uint64_t start;
+    bool open = true;
+
+    if (bench->enabled) BenchBegin(bench);
+
+    while (open) {
+        for (held = 0; held < batch; held++, read++) {
+            if (held == 0) {
+                if (bench->enabled) SampleOccupancy(data);
+                start = bench->enabled ? NowNs() : 0;
+                open = RecordAcquire(data->channel, views, Wakeups(data), &data->epoch);
+                if (bench->enabled) LatencyRecord(&data->latency, NowNs() - start);
+                if (!open) break;
+            } else if (!RecordTryAcquire(data->channel, views + held)) {
+                break;
+            }
+            if (data->traceOutput != TRACE_OFF)
+                ReportHandoff(data, EVENT_READ, views[held].pos, views[held].data[STREAM_HEADER], 0);
+            data->bytes += views[held].length - STREAM_HEADER;
+            if (data->kernel != NULL) RunKernel(data, views[held].data + STREAM_HEADER, views[held].length - STREAM_HEADER);
+        }
+        StreamWrite(data, views, held);
+        for (i = 0; i < held; i++) RecordRelease(data->channel, views + i, &data->epoch);
+    }
+
+    data->doneNs = NowNs();
+    data->ops += read;
+    return readerData;
+}
+
+// the chunk's offset in the file, which leads its record
+static uint64_t StreamOffset(const recordView* view)
+{
+    uint64_t offset;
+
+    memcpy(&offset, view->data, STREAM_HEADER);
+    return offset;
+}
+
+/**
+ * StreamWrite
+ * -----------
+ * Writes a batch of chunks to their offsets in the output. The batch is
+ * put in file order first, so that chunks that follow on from each other,
+ * which with few readers is most of them, go out in one pwritev.
+ */
+
+static void StreamWrite(threadData* data, recordView* views, int n)
+{
+    struct iovec iov[MAX_BATCH];
+    uint64_t offset, next = 0, first = 0;
+    recordView view;
+    int i, j, count = 0;
+
+    if (data->stream->output < 0) return;
+    for (i = 1; i < n; i++) {
+        view = views[i];
+        offset = StreamOffset(&view);
+        for (j = i - 1; j >= 0 && StreamOffset(views + j) > offset; j--) views[j + 1] = views[j];
+        views[j + 1] = view;
+    }
+    for (i = 0; i < n; i++) {
+        offset = StreamOffset(views + i);
+        if (count > 0 && (offset != next || count == IOV_MAX)) {
+            StreamWritev(data->stream->output, iov, count, first);
+            count = 0;
+        }
+        if (count == 0) first = offset;
+        iov[count].iov_base = views[i].data + STREAM_HEADER;
+        iov[count++].iov_len = views[i].length - STREAM_HEADER;
+        next = offset + views[i].length - STREAM_HEADER;
+    }
+    if (count > 0) StreamWritev(data->stream->output, iov, count, first);
+}
+
+// pwritev that carries on after a short write
+static void StreamWritev(int fd, struct iovec* iov, int count, uint64_t offset)
+{
+    ssize_t wrote;
+
+    while (count > 0) {
+        if ((wrote = pwritev(fd, iov, count, (off_t) offset)) < 0) {
+            printf("ERROR: cannot write the streamed file\n");
+            exit(1);
+        }
+        offset += wrote;
+        for (; count > 0 && (size_t) wrote >= iov->iov_len; iov++, count--) wrote -= iov->iov_len;
+        if (count > 0) {
+            iov->iov_base = (char*) iov->iov_base + wrote;
+            iov->iov_len -= wrote;
+        }
+    }
+}
+
+/**
+ * StreamOpen
+ * ----------
+ * Maps the input for sequential reading, so the kernel reads well ahead
+ * of the writers, and creates the output at its final size, so that every
+ * chunk can be written to its offset as soon as it arrives.
+ */
+
+static void StreamOpen(fileStream* stream, const char* input, const char* output, size_t chunk)
+{
+    struct stat st;
+    int fd;
+
+    memset(stream, 0, sizeof(*stream));
+    stream->chunk = chunk;
+    stream->output = -1;
+    atomic_init(&stream->next, 0);
+    if ((fd = open(input, O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+        printf("ERROR: cannot open input file '%s'\n", input);
+        exit(1);
+    }
+    stream->size = (size_t) st.st_size;
+    stream->chunks = (long) ((stream->size + chunk - 1) / chunk);
+    if (stream->size > 0) {
+        stream->map = (const char*) mmap(NULL, stream->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (stream->map == MAP_FAILED) {
+            printf("ERROR: cannot map input file '%s'\n", input);
+            exit(1);
+        }
+        madvise((void*) stream->map, stream->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    if (output == NULL) return;
+    if ((stream->output = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 ||
+        ftruncate(stream->output, (off_t) stream->size) != 0) {
+        printf("ERROR: cannot create output file '%s'\n", output);
+        exit(1);
+    }
+}
+
+/**
+ * StreamClose
+ * -----------
+ * Reports how fast the file went through, from the moment the first round
+ * started to the moment the last chunk of the last one was written, which
+ * is as far as the page cache, and again with the time it then takes to
+ * get the output onto the disk.
+ */
+
+static void StreamClose(fileStream* stream, long rounds, uint64_t elapsedNs)
+{
+    double bytes = (double) stream->size * rounds;
+    uint64_t syncNs = 0, start;
+
+    if (stream->output >= 0) {
+        start = NowNs();
+        fdatasync(stream->output);
+        syncNs = NowNs() - start;
+        close(stream->output);
+    }
+    if (stream->size > 0) munmap((void*) stream->map, stream->size);
+    printf("stream (%ld chunks of %zu bytes)\n", stream->chunks, stream->chunk);
+    printf("  bytes        %.0f in %ld rounds\n", bytes, rounds);
+    printf("  bandwidth    %.2f GB/s\n", elapsedNs > 0 ? bytes / elapsedNs : 0.0);
+    if (stream->output >= 0)
+        printf("  with sync    %.2f GB/s, %.3f s in fdatasync\n", bytes / (elapsedNs + syncNs), syncNs / 1e9);
+}
+
+/**
+ * RunRole
+ * -------
+ * The task every pool worker is given for a round: thread i is a writer,
+ * a reader, a processor or a transformer, just as it would have been
+ * created as one. The records transport has writers and readers of its
+ * own, and so does a streamed file.
+ */
+
+static void* RunRole(void* roleData)
+{
+    threadData* data = (threadData*) roleData;
+    bool records = data->channel->transport == TRANSPORT_RECORDS || data->channel->transport == TRANSPORT_NODES;
+
+    if (data->stream != NULL) return data->role == ROLE_WRITER ? StreamWriter(roleData) : StreamReader(roleData);
+    switch (data->role) {
+    case ROLE_WRITER:
+        return records ? RecordWriter(roleData) : Writer(roleData);
+    case ROLE_READER:
+        return records ? RecordReader(roleData) : Reader(roleData);
+    case ROLE_TRANSFORMER:
+        return Transformer(roleData);
+    default:
+        return Processor(roleData);
+    }
+}
+
+/**
+ * Dispatch
+ * --------
+ * Pushes a reader's records onto its own deque for the processors to
+ * steal, and wakes them once for the lot.
+ */
+
+static void Dispatch(threadData* data, const char* records, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) PushWork(data, records[i]);
+    SignalWork(data->dispatch);
+}
+
+/**
+ * PushWork
+ * --------
+ * Pushes one item onto the reader's deque. If the deque is full the reader
+ * helps out by processing its most recent item itself, which also slows it
+ * down to the processors' pace.
+ */
+
+static void PushWork(threadData* data, int64_t item)
+{
+    int64_t mine;
+
+    while (!DequePush(data->deque, item))
+        if (DequeTake(data->deque, &mine)) ProcessOne(data, mine);
+}
+
+static void SignalWork(dispatcher* dispatch)
+{
+    atomic_fetch_add(&dispatch->epoch, 1);
+    if (atomic_load(&dispatch->sleepers) > 0) FutexWake(&dispatch->epoch, INT_MAX);
+}
+
+/**
+ * FinishDispatch
+ * --------------
+ * Called by a reader that has read its share: it processes whatever the
+ * processors haven't stolen yet and then tells them it is done. Once every
+ * reader is done and nothing can be stolen, the processors finish too.
+ */
+
+static void FinishDispatch(threadData* data)
+{
+    dispatcher* dispatch = data->dispatch;
+    int64_t item;
+
+    while (DequeTake(data->deque, &item)) ProcessOne(data, item);
+    atomic_fetch_sub(&dispatch->readersLeft, 1);
+    SignalWork(dispatch);
+}
+
+/**
+ * StealWork
+ * ---------
+ * Looks for an item on every other deque, starting from a random one so
+ * that thieves spread out. Having found one it steals up to STEAL_CHUNK - 1
+ * more from the same deque, onto its own, so fewer steals are needed and
+ * other processors can steal them back if this one gets stuck on a slow
+ * item. A steal that loses a race means there may still be work, so the
+ * search goes round again until every deque it looks at is empty.
+ */
+
+static bool StealWork(threadData* data, int64_t* item)
+{
+    dispatcher* dispatch = data->dispatch;
+    workDeque* victim;
+    int64_t extra;
+    int start = (int) RngBelow(&data->rng, dispatch->numDeques);
+    int i, got;
+    bool contended;
+
+    do {
+        contended = false;
+        for (i = 0; i < dispatch->numDeques; i++) {
+            victim = dispatch->deques + (start + i) % dispatch->numDeques;
+            if (victim == data->deque) continue;
+            switch (DequeSteal(victim, item)) {
+            case STEAL_OK:
+                data->steals++;
+                for (got = 1; got < STEAL_CHUNK && DequeSteal(victim, &extra) == STEAL_OK; got++)
+                    if (!DequePush(data->deque, extra)) ProcessOne(data, extra);
+                return true;
+            case STEAL_ABORT:
+                contended = true;
+                break;
+            case STEAL_EMPTY:
+                break;
+            }
+        }
+    } while (contended);
+    return false;
+}
+
+/**
+ * Processor
+ * ---------
+ * Processes items from its own deque, steals when that is empty, and parks
+ * on the epoch when there is nothing to steal either. It reads the epoch
+ * before its last look around, so any work pushed after that look changes
+ * the epoch and it doesn't sleep through it.
+ */
+
+static void* Processor(void* processorData)
+{
+    threadData* data = (threadData*) processorData;
+    dispatcher* dispatch = data->dispatch;
+    int64_t item;
+    int epoch;
+
+    if (data->bench->enabled) BenchBegin(data->bench);
+
+    for (;;) {
+        if (DequeTake(data->deque, &item) || StealWork(data, &item)) {
+            ProcessOne(data, item);
+            continue;
+        }
+        epoch = atomic_load(&dispatch->epoch);
+        if (StealWork(data, &item)) {
+            ProcessOne(data, item);
+            continue;
+        }
+        if (atomic_load(&dispatch->readersLeft) == 0) break;
+        ParkWhile(&dispatch->epoch, epoch, &dispatch->sleepers);
+    }
+    return processorData;
+}
+
+/**
+ * ProcessOne
+ * ----------
+ * An item is the record itself, or for the records transport the address
+ * of a reader's copy of it, which goes back to that reader's pool once it
+ * has been processed.
+ */
+
+static void ProcessOne(threadData* data, int64_t item)
+{
+    char record = (char) item;
+    recordCopy* copy = (recordCopy*) (intptr_t) item;
+    recordView view = {0};
+
+    if (data->channel->transport == TRANSPORT_RECORDS || data->channel->transport == TRANSPORT_NODES) {
+        view.data = copy->data;
+        view.length = copy->length;
+        ProcessRecord(data, &view);
+        if (copy->owner == &data->copies) SlabFree(copy->owner, copy);
+        else SlabReturn(copy->owner, copy);
+    } else {
+        ProcessData(data, &record, 1);
+    }
+    data->processed++;
+}
+
+/**
+ * ReportProcessors
+ * ----------------
+ * How the items were shared out among the processors, how often they had
+ * to steal to get them, and how many the readers ended up processing
+ * themselves. The processors' data follows the readers'.
+ */
+
+static void ReportProcessors(const threadData* readers, int numReaders, int numProcessors)
+{
+    const threadData* processors = readers + numReaders;
+    long total = 0, steals = 0, least = LONG_MAX, most = 0, byReaders = 0;
+    int i;
+
+    for (i = 0; i < numReaders; i++) byReaders += readers[i].processed;
+    for (i = 0; i < numProcessors; i++) {
+        total += processors[i].processed;
+        steals += processors[i].steals;
+        if (processors[i].processed < least) least = processors[i].processed;
+        if (processors[i].processed > most) most = processors[i].processed;
+    }
+    printf("processors (ProcessData)\n");
+    printf("  items        %ld\n", total);
+    printf("  steals       %ld\n", steals);
+    printf("  per thread   min %ld max %ld\n", least, most);
+    printf("  by readers   %ld\n", byReaders);
+}
+
+/**
+ * ChannelOccupancy
+ * ----------------
+ * How many buffers of ch are full right now, or for the records transport
+ * how many bytes of the ring are in use, out of ChannelSpace. Only a
+ * snapshot: the threads at either end keep moving while it is taken.
+ */
+
+static size_t ChannelOccupancy(channel* ch)
+{
+    size_t head, tail;
+    int full;
+
+    switch (ch->transport) {
+    case TRANSPORT_SPSC:
+        head = atomic_load_explicit(&ch->ring->head, memory_order_relaxed);
+        tail = atomic_load_explicit(&ch->ring->tail, memory_order_relaxed);
+        return tail - head;
+    case TRANSPORT_MPMC:
+        head = atomic_load_explicit(&ch->queue->dequeuePos, memory_order_relaxed);
+        tail = atomic_load_explicit(&ch->queue->enqueuePos, memory_order_relaxed);
+        // a reader that claimed its cells before the writer filled them can make this negative
+        return tail <= head ? 0 : tail - head > ch->capacity ? ch->capacity : tail - head;
+    case TRANSPORT_FUTEX:
+    case TRANSPORT_NODES:
+        return (size_t) CounterCount(&ch->fullCount);
+    case TRANSPORT_RECORDS:
+        head = atomic_load_explicit(&ch->records->head, memory_order_relaxed);
+        tail = atomic_load_explicit(&ch->records->tail, memory_order_relaxed);
+        return tail - head;
+    case TRANSPORT_SEM:
+    default:
+        sem_getvalue(&ch->fullBuffers, &full);
+        return full > 0 ? (size_t) full : 0;
+    }
+}
+
+static size_t ChannelSpace(const channel* ch)
+{
+    if (ch->adapt.maxCapacity > 0) return atomic_load_explicit(&ch->adapt.current, memory_order_relaxed);
+    return ch->transport == TRANSPORT_RECORDS ? ch->records->size : ch->capacity;
+}
+
+/**
+ * SampleOccupancy
+ * ---------------
+ * Called by a consumer just before each read, so that its samples show how
+ * much was waiting for it whenever it came back for more.
+ */
+
+static void SampleOccupancy(threadData* data)
+{
+    size_t full = ChannelOccupancy(data->channel);
+
+    data->occupancySum += full;
+    data->occupancySamples++;
+    if (full == 0) data->emptySamples++;
+    else if (full >= ChannelSpace(data->channel)) data->fullSamples++;
+}
+
+/**
+ * ReportContention
+ * ----------------
+ * The -I tables, one for the writers, one for each transform stage and
+ * one for the readers, and with -J the same tables as JSON. The records
+ * transport doesn't count its operations, so its tables stay empty.
+ */
+
+static void ReportContention(const programConfig* config, const threadData* threads, int numThreads,
+                             const int* stageFirst, arena* a)
+{
+    const contentionStats** stats = (const contentionStats**) ArenaCalloc(a, numThreads, sizeof(void*));
+    const char** names = (const char**) ArenaCalloc(a, numThreads, sizeof(char*));
+    FILE* out = NULL;
+    char label[64];
+    int i, stage;
+
+    for (i = 0; i < numThreads; i++) {
+        stats[i] = &threads[i].contention;
+        names[i] = threads[i].name;
+    }
+    if (config->jsonFile != NULL) {
+        if ((out = fopen(config->jsonFile, "w")) == NULL) {
+            printf("ERROR: cannot open JSON file '%s'\n", config->jsonFile);
+            exit(1);
+        }
+        fprintf(out, "{\n  \"program\": \"readerWriter\", \"transport\": \"%s\", \"writers\": %d, \"readers\": %d, "
+                     "\"stages\": %d, \"batch\": %d, \"capacity\": %zu, \"wait\": \"%s\", \"bench\": %s,\n"
+                     "  \"sections\": [\n",
+                transportNames[config->transport], config->numWriters, config->numReaders, config->stages,
+                config->batch, config->capacity, waitNames[config->wait], config->bench.enabled ? "true" : "false");
+    }
+    for (stage = 0; stage < config->stages; stage++) {
+        if (stage == 0) snprintf(label, sizeof(label), "writers (ChannelPut)");
+        else if (stage == config->stages - 1) snprintf(label, sizeof(label), "readers (ChannelGet)");
+        else snprintf(label, sizeof(label), "stage %d transformers (ChannelGet and ChannelPut)", stage + 1);
+        printf("contention: ");
+        ContentionReport(label, stats + stageFirst[stage], names + stageFirst[stage], config->stageThreads[stage]);
+        if (out == NULL) continue;
+        ContentionJson(out, label, stats + stageFirst[stage], names + stageFirst[stage], config->stageThreads[stage]);
+        fprintf(out, "%s\n", stage + 1 < config->stages ? "," : "");
+    }
+    if (out != NULL) {
+        fprintf(out, "  ]\n}\n");
+        fclose(out);
+    }
+}
+
+/**
+ * ReportPipeline
+ * --------------
+ * One line per link of the pipeline with how full it was on average and
+ * how often it was found empty or full, from the samples its consumers
+ * took, and which stage looks like the bottleneck. A stage that cannot
+ * keep up lets the link in front of it fill; if no link is mostly full,
+ * the writers themselves are the limit.
+ */
+
+static void ReportPipeline(const programConfig* config, threadData* const* consumers, const int* numConsumers,
+                           const channel* links, uint64_t elapsedNs)
+{
+    int link, i, bottleneck = 0;
+    double mean, fullest = 0;
+
+    for (link = 0; link < config->stages - 1; link++) {
+        const threadData* stage = consumers[link + 1];
+        uint64_t sum = 0;
+        long samples = 0, empty = 0, full = 0, moved = 0;
+
+        for (i = 0; i < numConsumers[link + 1]; i++) {
+            sum += stage[i].occupancySum;
+            samples += stage[i].occupancySamples;
+            empty += stage[i].emptySamples;
+            full += stage[i].fullSamples;
+            moved += stage[i].ops;
+        }
+        if (samples == 0) continue;
+        mean = (double) sum / samples / ChannelSpace(links + link);
+        printf("link %d -> %d: %.0f items/s, %.1f%% full on average, empty %.1f%%, full %.1f%% of %ld reads\n",
+               link + 1, link + 2, elapsedNs > 0 ? moved * 1e9 / elapsedNs : 0.0, 100 * mean,
+               100.0 * empty / samples, 100.0 * full / samples, samples);
+        if (mean >= 0.5 && mean > fullest) {
+            fullest = mean;
+            bottleneck = link + 1;
+        }
+    }
+    printf("bottleneck: stage %d (%s)\n", bottleneck + 1,
+           bottleneck == 0 ? "writers" : bottleneck == config->stages - 1 ? "readers" : "transform");
+}
+
+/**
+ * ReportHandoff
+ * -------------
+ * Either prints one item's handoff straight away, as this example always
+ * has, or records it in the thread's trace ring to be written out later.
+ * A write is stamped with at, taken just before the item was handed to the
+ * channel, so that a reader cannot be seen taking it before it was put; a
+ * read with an at of 0 is stamped now.
+ */
+
+static void ReportHandoff(threadData* data, handoffEvent kind, size_t pos, char value, uint64_t at)
+{
+    channel* ch = kind == EVENT_WRITE && data->output != NULL ? data->output : data->channel;
+    uint32_t link = (uint32_t) (kind == EVENT_WRITE ? data->stage : data->stage - 1);
+
+    if (data->traceOutput != TRACE_STDIO) {
+        TraceRecordAt(data->trace, at != 0 ? at : NowNs(), HandoffKind(kind, link), (int64_t) (pos & ch->mask),
+                      HandoffValue(pos, value));
+    } else if (kind == EVENT_WRITE) {
+        printf("%s: buffer[%d] = %c\n", data->name, (int) (pos & ch->mask), value);
+    } else {
+        printf("\t\t\t\t%s: buffer[%d] = %c\n", data->name, (int) (pos & ch->mask), value);
+    }
+}
+
+static void FormatHandoff(FILE* out, const char* name, const traceEvent* event)
+{
+    fprintf(out, "[%12.6f] %s%s: buffer[%lld] = %c\n", event->timestamp / 1e9,
+            HandoffEventOf(event->kind) == EVENT_READ ? "\t\t\t\t" : "", name, (long long) event->slot,
+            HandoffItem(event->value));
+}
+
+/**
+ * ProcessData and PrepareData work on a vector of n records at a time.
+ * Each record still costs its own random delay, but the delays for a batch
+ * are served in one go. In a benchmark each record costs the configured
+ * amount of busy-work instead, unless the cost is skewed: then each record
+ * has a one in skew chance of costing skew times as much. PrepareData
+ * draws all the random values a batch needs, one 64-bit value per record,
+ * in a single RngFill.
+ */
+
+static void ProcessData(void* readerData, const char* records, int n)
+{
+    int i;
+    long delay = 0;
+    threadData* data = (threadData*) readerData;
+
+    if (data->kernel != NULL) {
+        RunKernel(data, records, (size_t) n);
+        return;
+    }
+    if (data->bench->enabled) {
+        if (data->skew <= 1) {
+            data->seed = BusyWork(data->bench->work * n, data->seed ^ (uint64_t) records[0]);
+            return;
+        }
+        for (i = 0; i < n; i++) {
+            unsigned long work = data->bench->work;
+            if (RngBelow(&data->rng, data->skew) == 0) work *= data->skew;
+            data->seed = BusyWork(work, data->seed ^ (uint64_t) records[i]);
+        }
+        return;
+    }
+
+    for (i = 0; i < n; i++) delay += 500000 + RngBelow(&data->rng, 1500000);
+    usleep(delay);
+}
+
+static void PrepareData(void* writerData, char* records, int n)
+{
+    int i;
+    long delay = 0;
+    uint64_t values[MAX_BATCH];
+    threadData* data = (threadData*) writerData;
+
+    RngFill(&data->lanes, values, n);
+    if (data->bench->enabled) {
+        for (i = 0; i < n; i++) {
+            data->seed = BusyWork(data->bench->work, data->seed + values[i]);
+            records[i] = (char)(65 + (values[i] >> 32) % 25);
+        }
+        return;
+    }
+
+    // the low half of each value picks the delay, the high half the letter
+    for (i = 0; i < n; i++) {
+        delay += 500000 + (long) (((values[i] & 0xffffffffu) * 1500000) >> 32);
+        records[i] = (char)(65 + (values[i] >> 32) % 25);
+    }
+    usleep(delay);
+}
+
+/**
+ * PrepareRecord and ProcessRecord are PrepareData and ProcessData for a
+ * whole record in the ring: the record's one letter is drawn and paid for
+ * as before, then written across the payload in place; the reader checks
+ * every byte of the payload where it lies. A kernel runs over the whole
+ * payload rather than its first byte.
+ */
+
+static void PrepareRecord(threadData* data, char* payload, uint32_t length)
+{
+    char letter;
+
+    PrepareData(data, &letter, 1);
+    memset(payload, letter, length);
+}
+
+static void ProcessRecord(threadData* data, const recordView* view)
+{
+    uint32_t i;
+
+    for (i = 1; i < view->length; i++) {
+        if (view->data[i] != view->data[0]) {
+            printf("ERROR: %s found a torn record at buffer[%zu]\n", data->name, view->pos);
+            exit(1);
+        }
+    }
+    ProcessData(data, view->data, data->kernel != NULL ? (int) view->length : 1);
+}
+
+/**
+ * RunKernel
+ * ---------
+ * Runs the kernel over n bytes, a skewed item's share of them skew times,
+ * and folds its result into the thread's seed so none of it can be left
+ * out. Only one call in KERNEL_TIMING_INTERVAL reads the clock, twice,
+ * which would otherwise cost more than the kernel itself over a batch of
+ * a few letters, and stands in for the calls around it.
+ */
+
+static void RunKernel(threadData* data, const char* bytes, size_t n)
+{
+    int passes = data->skew > 1 && RngBelow(&data->rng, data->skew) == 0 ? data->skew : 1, i;
+    bool timed = data->kernelCalls++ % KERNEL_TIMING_INTERVAL == 0;
+    uint64_t start = timed ? NowNs() : 0;
+
+    for (i = 0; i < passes; i++) data->seed ^= data->kernel->run((const uint8_t*) bytes, n, data->kernelWork);
+    if (timed) data->kernelNs += (NowNs() - start) * KERNEL_TIMING_INTERVAL;
+    data->kernelBytes += n * passes;
+}
+
+/**
+ * ReportKernel
+ * ------------
+ * How many bytes the kernel went through and how fast while it ran, and,
+ * in a benchmark, what share of its consumers' time it took: near all of
+ * it and the run is bound by the work, near none and it is bound by the
+ * handoffs.
+ */
+
+static void ReportKernel(const byteKernel* kernel, const threadData* threads, int numThreads, uint64_t elapsedNs)
+{
+    uint64_t bytes = 0, ns = 0;
+    int i, consumers = 0;
+
+    for (i = 0; i < numThreads; i++) {
+        if (threads[i].kernel == NULL) continue;
+        bytes += threads[i].kernelBytes;
+        ns += threads[i].kernelNs;
+        consumers++;
+    }
+    printf("kernel %s (%s)\n", kernelNames[kernel->kind], isaNames[kernel->isa]);
+    printf("  bytes        %llu\n", (unsigned long long) bytes);
+    printf("  throughput   %.2f GB/s per thread while running\n", ns > 0 ? (double) bytes / ns : 0.0);
+    if (elapsedNs > 0 && consumers > 0)
+        printf("  share        %.1f%% of %d consumers' time\n", 100.0 * ns / ((double) elapsedNs * consumers), consumers);
 }
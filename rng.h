@@ -0,0 +1,156 @@
+/**
+ * rng.h
+ * -----
+ * A small, fast pseudo-random number generator for the examples' hot
+ * loops, to stand in for glibc's random_r. Each thread carries an rng in
+ * its own data, seeded from a base seed and its own stream number through
+ * splitmix64, so no global state or lock is involved either when seeding
+ * or when drawing. The generator is xoshiro256** (Blackman and Vigna),
+ * which needs four words of state and a handful of shifts, rotates and
+ * multiplies per value.
+ *
+ * A producer that needs many values at once can use an rngLanes instead:
+ * RNG_LANES independent xoshiro256** generators kept side by side, one per
+ * lane, so that RngFill advances all of them with the same operations and
+ * the compiler can turn each step into vector instructions.
+ */
+
+#ifndef _RNG_H
+#define _RNG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#define RNG_LANES 4
+
+typedef struct {
+    uint64_t s[4];
+} rng;
+
+typedef struct {
+    _Alignas(32) uint64_t s[4][RNG_LANES];  // s[word][lane]
+} rngLanes;
+
+static inline uint64_t SplitMix64(uint64_t* x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t RotateLeft(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/**
+ * RngClockSeed
+ * ------------
+ * A base seed taken from the clock, for runs that don't ask for one.
+ */
+
+static inline uint64_t RngClockSeed(void)
+{
+    struct timespec ts;
+    uint64_t x;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    x = (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    return SplitMix64(&x);
+}
+
+/**
+ * RngSeed
+ * -------
+ * Seeds r for the given stream of the base seed. Every (seed, stream) pair
+ * gives an unrelated sequence, so threads can simply use their index.
+ */
+
+static inline void RngSeed(rng* r, uint64_t seed, uint64_t stream)
+{
+    uint64_t x = seed ^ SplitMix64(&stream);
+    int i;
+
+    for (i = 0; i < 4; i++) r->s[i] = SplitMix64(&x);
+}
+
+static inline uint64_t RngNext(rng* r)
+{
+    uint64_t* s = r->s;
+    uint64_t result = RotateLeft(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = RotateLeft(s[3], 45);
+    return result;
+}
+
+/**
+ * RngBelow
+ * --------
+ * A value in [0, bound), by taking the high half of a 32x32-bit product
+ * rather than a division. The bias this leaves is below 2^-32 per value,
+ * far less than the examples can notice.
+ */
+
+static inline uint32_t RngBelow(rng* r, uint32_t bound)
+{
+    return (uint32_t) (((RngNext(r) >> 32) * (uint64_t) bound) >> 32);
+}
+
+// a double in [0, 1), from the top 53 bits
+static inline double RngUnit(rng* r)
+{
+    return (RngNext(r) >> 11) * 0x1.0p-53;
+}
+
+static inline void RngLanesSeed(rngLanes* r, uint64_t seed, uint64_t stream)
+{
+    rng lane;
+    int i, j;
+
+    for (j = 0; j < RNG_LANES; j++) {
+        RngSeed(&lane, seed, stream * RNG_LANES + j);
+        for (i = 0; i < 4; i++) r->s[i][j] = lane.s[i];
+    }
+}
+
+/**
+ * RngFill
+ * -------
+ * Writes n values to out, RNG_LANES at a time. Every line of the loop body
+ * does the same thing to each lane, which is what lets it vectorize; a
+ * final partial step is generated in full and only partly copied.
+ */
+
+static inline void RngFill(rngLanes* r, uint64_t* out, size_t n)
+{
+    uint64_t step[RNG_LANES];
+    size_t done = 0;
+    int j;
+
+    while (done < n) {
+        uint64_t* dest = n - done >= RNG_LANES ? out + done : step;
+        for (j = 0; j < RNG_LANES; j++) {
+            uint64_t t = r->s[1][j] << 17;
+            dest[j] = RotateLeft(r->s[1][j] * 5, 7) * 9;
+            r->s[2][j] ^= r->s[0][j];
+            r->s[3][j] ^= r->s[1][j];
+            r->s[1][j] ^= r->s[2][j];
+            r->s[0][j] ^= r->s[3][j];
+            r->s[2][j] ^= t;
+            r->s[3][j] = RotateLeft(r->s[3][j], 45);
+        }
+        if (dest == step) memcpy(out + done, step, (n - done) * sizeof(uint64_t));
+        done += RNG_LANES;
+    }
+}
+
+#endif
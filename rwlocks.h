@@ -0,0 +1,229 @@
+/**
+ * rwlocks.h
+ * ---------
+ * Locks for data that is read far more often than it is written, behind
+ * one interface in the manner of locks.h:
+ *
+ *   rwlock    a pthread_rwlock_t: readers share it, a writer excludes all
+ *   seqlock   readers take no lock at all; they read, then check that no
+ *             writer was active in the meantime, and retry if one was
+ *   bravo     a pthread_rwlock_t with a reader bias, after Dice and Kogan
+ *             ("BRAVO: Biased Locking for Reader-Writer Locks", USENIX ATC
+ *             2019): while the bias is on, a reader only bumps a counter
+ *             for the CPU it runs on and never touches the shared lock word
+ *
+ * A reader brackets its reads with RwReadBegin and RwReadEnd and repeats
+ * them for as long as RwReadEnd says the read has to be retried, which only
+ * the seqlock ever does:
+ *
+ *     do {
+ *         token = RwReadBegin(&lock);
+ *         value = ...;
+ *     } while (!RwReadEnd(&lock, token));
+ *
+ * Under the seqlock the reads race the writer, so whatever they read has to
+ * be atomic. Writers of every kind exclude each other with the rwlock's
+ * write side.
+ *
+ * A BRAVO writer turns the bias off and waits for every per-CPU counter to
+ * drain before it goes ahead. Readers turn the bias back on from the slow
+ * path, but not before a stretch of BRAVO_INHIBIT times as long as that
+ * wait has gone by, so that frequent writers keep it off and don't pay
+ * that wait on every write.
+ */
+
+#ifndef _RWLOCKS_H
+#define _RWLOCKS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "locks.h"
+
+#define BRAVO_SLOTS 64          // per-CPU reader counters; CPUs beyond share them
+#define BRAVO_INHIBIT 9
+#define RW_SPIN_LIMIT 1024      // pauses before a waiting thread starts yielding its CPU
+
+typedef enum {
+    RW_RWLOCK,
+    RW_SEQLOCK,
+    RW_BRAVO,
+    NUM_RW_KINDS
+} rwKind;
+
+static const char* const rwNames[NUM_RW_KINDS] = {"rwlock", "seqlock", "bravo"};
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_int readers;
+} bravoSlot;
+
+typedef struct {
+    rwKind kind;
+    pthread_rwlock_t rw;
+    _Alignas(CACHE_LINE_SIZE) atomic_uint sequence;     // odd while a seqlock writer is active
+    _Alignas(CACHE_LINE_SIZE) atomic_bool readBias;
+    _Atomic uint64_t inhibitUntil;
+    bravoSlot slots[BRAVO_SLOTS];
+} rwLock;
+
+static inline int RwKindFromName(const char* name)
+{
+    int i;
+
+    for (i = 0; i < NUM_RW_KINDS; i++)
+        if (strcmp(name, rwNames[i]) == 0) return i;
+    return -1;
+}
+
+static inline uint64_t RwNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// one step of waiting for another thread that may have been preempted
+static inline void RwPause(int* spins)
+{
+    if (++*spins < RW_SPIN_LIMIT) CpuRelax();
+    else sched_yield();
+}
+
+static inline void RwInit(rwLock* lock, rwKind kind)
+{
+    int i;
+
+    memset(lock, 0, sizeof(*lock));
+    lock->kind = kind;
+    pthread_rwlock_init(&lock->rw, NULL);
+    atomic_init(&lock->sequence, 0);
+    atomic_init(&lock->readBias, kind == RW_BRAVO);
+    atomic_init(&lock->inhibitUntil, 0);
+    for (i = 0; i < BRAVO_SLOTS; i++) atomic_init(&lock->slots[i].readers, 0);
+}
+
+static inline void RwDestroy(rwLock* lock)
+{
+    pthread_rwlock_destroy(&lock->rw);
+}
+
+/**
+ * RwReadBegin
+ * -----------
+ * Starts a read and returns the token to hand to RwReadEnd: the sequence
+ * the seqlock read started from, or for BRAVO the slot of the reader's CPU
+ * when it took the fast path and -1 when it holds the rwlock instead.
+ *
+ * A BRAVO reader counts itself in its slot before it looks at the bias,
+ * and a writer turns the bias off before it looks at the slots, each with
+ * a full fence in between, so one of them always sees the other.
+ */
+
+static inline long RwReadBegin(rwLock* lock)
+{
+    unsigned int sequence;
+    int cpu, slot, spins = 0;
+
+    switch (lock->kind) {
+    case RW_SEQLOCK:
+        while ((sequence = atomic_load_explicit(&lock->sequence, memory_order_acquire)) & 1)
+            RwPause(&spins);
+        return sequence;
+    case RW_BRAVO:
+        if (atomic_load_explicit(&lock->readBias, memory_order_relaxed)) {
+            cpu = sched_getcpu();
+            slot = (cpu < 0 ? 0 : cpu) % BRAVO_SLOTS;
+            atomic_fetch_add_explicit(&lock->slots[slot].readers, 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (atomic_load_explicit(&lock->readBias, memory_order_relaxed)) return slot;
+            atomic_fetch_sub_explicit(&lock->slots[slot].readers, 1, memory_order_release);
+        }
+        pthread_rwlock_rdlock(&lock->rw);
+        if (!atomic_load_explicit(&lock->readBias, memory_order_relaxed) &&
+            RwNowNs() >= atomic_load_explicit(&lock->inhibitUntil, memory_order_relaxed))
+            atomic_store_explicit(&lock->readBias, true, memory_order_relaxed);
+        return -1;
+    case RW_RWLOCK:
+    default:
+        pthread_rwlock_rdlock(&lock->rw);
+        return 0;
+    }
+}
+
+/**
+ * RwReadEnd
+ * ---------
+ * Ends the read started by RwReadBegin. Returns false if what was read may
+ * be inconsistent and the read has to start over.
+ */
+
+static inline bool RwReadEnd(rwLock* lock, long token)
+{
+    switch (lock->kind) {
+    case RW_SEQLOCK:
+        atomic_thread_fence(memory_order_acquire);
+        return atomic_load_explicit(&lock->sequence, memory_order_relaxed) == (unsigned int) token;
+    case RW_BRAVO:
+        if (token >= 0) {
+            atomic_fetch_sub_explicit(&lock->slots[token].readers, 1, memory_order_release);
+            return true;
+        }
+        pthread_rwlock_unlock(&lock->rw);
+        return true;
+    case RW_RWLOCK:
+    default:
+        pthread_rwlock_unlock(&lock->rw);
+        return true;
+    }
+}
+
+/**
+ * RwWriteLock
+ * -----------
+ * Takes the lock for writing. Returns whether the writer found it taken
+ * and had to wait, for anyone counting contention.
+ */
+
+static inline bool RwWriteLock(rwLock* lock)
+{
+    bool contended = pthread_rwlock_trywrlock(&lock->rw) != 0;
+    uint64_t start, now;
+    int i, spins = 0;
+
+    if (contended) pthread_rwlock_wrlock(&lock->rw);
+    switch (lock->kind) {
+    case RW_SEQLOCK:
+        atomic_store_explicit(&lock->sequence, atomic_load_explicit(&lock->sequence, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        break;
+    case RW_BRAVO:
+        if (!atomic_load_explicit(&lock->readBias, memory_order_relaxed)) break;
+        atomic_store_explicit(&lock->readBias, false, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        start = RwNowNs();
+        for (i = 0; i < BRAVO_SLOTS; i++)
+            while (atomic_load_explicit(&lock->slots[i].readers, memory_order_acquire) != 0)
+                RwPause(&spins);
+        now = RwNowNs();
+        atomic_store_explicit(&lock->inhibitUntil, now + (now - start) * BRAVO_INHIBIT, memory_order_relaxed);
+        break;
+    default:
+        break;
+    }
+    return contended;
+}
+
+static inline void RwWriteUnlock(rwLock* lock)
+{
+    if (lock->kind == RW_SEQLOCK)
+        atomic_store_explicit(&lock->sequence, atomic_load_explicit(&lock->sequence, memory_order_relaxed) + 1,
+                              memory_order_release);
+    pthread_rwlock_unlock(&lock->rw);
+}
+
+#endif
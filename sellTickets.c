@@ -10,88 +10,675 @@
  * thread to access the numTickets variable at a time. Before attempting to
  * sell a ticket, the thread must acquire the lock by waiting on the semaphore
  * and then release the lock when through by signalling the semaphore.
+ *
+ * That is still the default, and -m picks other ways to keep the count
+ * right: an atomic counter (see SellOne), blocks of tickets taken under the
+ * lock and sold without it (see TakeBlock), several tickets granted in one
+ * step (see Reserve) or by flat combining (see ReserveCombined), and a
+ * table of events with striped locks (see SellEvent). The lock itself can
+ * be any of the strategies in locks.h (-l), and query threads (-Q) can read
+ * the count through a read-mostly lock from rwlocks.h (-p, see QueryOne).
+ *
+ * By default every sale is printed as it happens; it can instead be traced
+ * (-T, see trace.h) and repeated on the same customers (-E) for traceReport
+ * to compare. With -B it is a benchmark (see bench.h) that reports the
+ * sales' throughput and latency, -I counts the trips through ticketsLock
+ * (see contention.h) and -F reports how fairly the sellers shared the
+ * sales (see ReportFairness).
+ *
+ * The sellers come from a persistent pool (see pool.h) that can sell
+ * several rounds in a row (-N), can be pinned (-a, see affinity.h), and
+ * each draw from a generator of their own (see rng.h), all set up out of
+ * one arena (see arena.h). Every setting can be given on the command line
+ * or through the ST_* environment variables listed in envOptions.
  */
 
+
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <sched.h>
+#include <math.h>
+#include "locks.h"
+#include "bench.h"
+#include "trace.h"
+#include "traceEvents.h"
+#include "config.h"
+#include "affinity.h"
+#include "rng.h"
+#include "pool.h"
+#include "arena.h"
+#include "contention.h"
+#include "rwlocks.h"
 
-#define NUM_TICKETS 35
+#define NUM_TICKETS 35         // defaults, each of which can be changed at run time
 #define NUM_SELLERS 4
-#define BUFFER_SIZE 32
+#define BLOCK_SIZE 5
+#define CUSTOMER_DELAY_US 500000
+#define MAX_SELLERS 1024
+#define MAX_DRAWS 1000000
+#define MAX_ROUNDS 1000000
+#define MAX_QUANTITY 1000
+#define RESERVE_TRIES 4         // failed compare-and-swaps before a reservation queues on the lock
+#define COMBINE_SPINS 1024      // checks of its slot before a waiting seller starts yielding
+#define NUM_EVENTS 16
+#define NUM_STRIPES 16
+#define MAX_EVENTS (1 << 20)
+
+typedef enum {
+    MODE_LOCK,
+    MODE_ATOMIC,
+    MODE_SHARDED,
+    MODE_RESERVE,
+    MODE_COMBINING,
+    MODE_EVENTS
+} counterMode;
+
+static const char* const modeNames[] = {"lock", "atomic", "sharded", "reserve", "combining", "events"};
+
+typedef enum {
+    LAYOUT_PADDED,
+    LAYOUT_PACKED
+} stateLayout;
+
+/**
+ * Every seller's data, random number generator included, sits in its own
+ * cache-line aligned threadData, so drawing a number in one seller never
+ * touches a line another seller is writing. --layout packed instead keeps
+ * all the generators next to each other in one shared array; together with
+ * a benchmark in which each customer draws several random numbers (-x) it
+ * shows what the false sharing costs.
+ */
 
 typedef struct {
     char* name;
-    struct random_data* buffer;
+    rng* rng;           // rngState, or a slot in the packed array
+    lockNode node;      // this seller's queue node for the MCS lock
+    long numSold;       // over all rounds
+    latencyLog latency;
+    traceRing* trace;
+    rng rngState;
+    long customers;     // over all rounds, in a benchmark
+    long queued;        // reservations that had to queue on the lock
+    long combines;      // passes this seller made as the combiner
+    long combined;      // and the requests it granted in them
+    uint64_t maxGapNs;  // longest time between two sales of this seller, with -F
+    bool query;         // a query thread rather than a seller
+    long queries;       // over all rounds
+    int event;          // events mode: the inventory entry the last customer bought from
+    contentionStats contention;     // ticketsLock, with -I
+    // combining mode: the seller's publication slot, which the combiner answers in place
+    _Alignas(CACHE_LINE_SIZE) atomic_int request;   // tickets wanted, 0 once answered
+    int granted;
+    int left;
 } threadData;
 
+/*
+ * One entry of the events mode inventory, and one of the locks striped
+ * over it: entry e is guarded by stripe e % stripes (-G), so sales of
+ * events on different stripes never wait for each other. -G 0 drops the
+ * locks for a compare-and-swap on each entry, and -G 1 puts every event
+ * back behind a single lock, for comparison.
+ */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_int left;
+    int capacity;       // tickets put on sale each round
+} inventoryEntry;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) strategyLock lock;
+} lockStripe;
+
+/**
+ * The settings that only main needs; the ones the sellers read are the
+ * globals below.
+ */
+
+typedef struct {
+    int numTickets;
+    int rounds;
+    stateLayout layout;
+    traceMode traceOutput;
+    const char* traceFile;
+    bool traceLogger;
+    placement placement;
+    const char* jsonFile;
+    bool seeded;        // -E: start the generators from seed instead of the clock
+    uint64_t seed;
+} programConfig;
+
+static const envOption envOptions[] = {
+    {"ST_MODE", 'm'},
+    {"ST_BLOCK", 'k'},
+    {"ST_LOCK", 'l'},
+    {"ST_SELLERS", 's'},
+    {"ST_TICKETS", 't'},
+    {"ST_DELAY", 'u'},
+    {"ST_BENCH", 'B'},
+    {"ST_WORK", 'W'},
+    {"ST_OPS", 'n'},
+    {"ST_DURATION", 'd'},
+    {"ST_TRACE", 'T'},
+    {"ST_TRACE_FILE", 'o'},
+    {"ST_TRACE_LOGGER", 'L'},
+    {"ST_AFFINITY", 'a'},
+    {"ST_LAYOUT", 'R'},
+    {"ST_DRAWS", 'x'},
+    {"ST_ROUNDS", 'N'},
+    {"ST_QUANTITY", 'q'},
+    {"ST_INSTRUMENT", 'I'},
+    {"ST_JSON", 'J'},
+    {"ST_FAIRNESS", 'F'},
+    {"ST_QUERIES", 'Q'},
+    {"ST_INVENTORY_LOCK", 'p'},
+    {"ST_EVENTS", 'e'},
+    {"ST_ZIPF", 'z'},
+    {"ST_STRIPES", 'G'},
+    {"ST_SEED", 'E'}
+};
+
 static void* SellTickets(void* threadArgs);
+static void* QueryTickets(void* threadArgs);
+static void* SellOrQuery(void* threadArgs);
+static int QueryOne(threadData* threadInfo);
+static void InventoryAcquire(threadData* threadInfo);
+static void InventoryRelease(threadData* threadInfo);
+static bool SellOne(int* ticketsLeft);
+static int TakeBlock(threadData* threadInfo, int blockSize);
+static contentionStats* Contention(threadData* threadInfo);
+static double JainIndex(const threadData* threads, int n);
+static void ReportFairness(const threadData* threads, int n);
+static void WriteJson(const programConfig* config, const contentionStats* const* stats, const char* const* names);
+static bool SellSingle(threadData* threadInfo, int* myBlock);
+static int Reserve(threadData* threadInfo, int want, int* ticketsLeft);
+static int ReserveCombined(threadData* threadInfo, int want, int* ticketsLeft);
+static void Combine(threadData* combiner);
+static void InventoryInit(arena* a, int roundTickets);
+static int PickEvent(threadData* threadInfo);
+static int SellEvent(threadData* threadInfo, int want, int* ticketsLeft);
+static int TakeFromEvent(threadData* threadInfo, int event, int want, int* ticketsLeft);
+static void ReportInventory(void);
+static void ReportSale(threadData* threadInfo, saleEvent kind, int count, int tickets);
+static void FormatSale(FILE* out, const char* name, const traceEvent* event);
+static void Usage(const char* prog);
+static void ApplyOption(void* ctx, int opt, const char* arg);
 
 /**
  * The ticket counter and its associated lock will be accessed
- * by all threads, so made global for easy access
+ * by all threads, so made global for easy access. The counter is atomic so
+ * that atomic mode can update it without the lock; the locked modes only
+ * ever touch it with relaxed loads and stores from inside the critical
+ * section, which cost the same as plain ones.
  */
 
-static int numTickets = NUM_TICKETS;
-static sem_t ticketsLock;
+static atomic_int numTickets = NUM_TICKETS;
+static strategyLock ticketsLock;
+static lockKind lockStrategy = LOCK_SEM;
+static counterMode mode = MODE_LOCK;
+static int blockSize = BLOCK_SIZE;
+static int numSellers = NUM_SELLERS;
+static long customerDelay = CUSTOMER_DELAY_US;
+static long draws = 0;
+static int maxQuantity = 1;
+static bool instrument = false;
+static bool fairness = false;
+static int numQueries = 0;
+static int inventoryKind = -1;  // an rwKind, or -1 for ticketsLock
+static rwLock inventoryLock;
+static atomic_int sellersLeft;  // sellers still selling this round, which the queries run until
+static int numEvents = NUM_EVENTS;
+static double zipfExponent = 0;
+static int numStripes = NUM_STRIPES;   // 0 for per-entry compare-and-swap
+static inventoryEntry* inventory;
+static lockStripe* stripes;
+static double* eventCdf;        // chance that a customer picks an event up to each one, with -z
+static threadData* sellers;     // every seller's slot, for the combiner
+static atomic_bool combinerBusy;
+static benchConfig bench;
+static tracer trace;
 
 /**
  * Our main creates the initial semaphore lock in an unlocked state
  * (one thread can immediately acquire it) and sets up all of the
  * ticket seller threads, and lets them run to completion. They should
- * all finish when all tickets have been sold.
+ * all finish when all tickets have been sold. Every further round puts
+ * the same number of tickets back on sale and runs the sellers again.
  */
 
 void main(int argc, char **argv)
 {
-    pthread_t* threads = (pthread_t*) calloc(NUM_SELLERS, sizeof(pthread_t));
-    threadData* threadArgs = (threadData*) calloc(NUM_SELLERS, sizeof(threadData));
-    struct random_data* rand_states = (struct random_data*) calloc(NUM_SELLERS, sizeof(struct random_data));
-    char* rand_statebufs = (char*) calloc(NUM_SELLERS, BUFFER_SIZE);
+    workerPool pool;
+    void** taskArgs;
+    threadData* threadArgs;
+    int numThreads;
+    rng* packedRngs = NULL;
+    arena setup;
+    uint64_t baseSeed;
     char nameBuffer[32];
-    int i;
-    int rc;
+    int i, round;
+    int rc, opt, roundTickets;
+    uint64_t elapsedNs = 0, roundStart;
+    const latencyLog** logs;
+    const latencyLog* roundLogs[1];
+    latencyLog roundLatency;
+    char label[256];
+    FILE* traceOut = stdout;
+    programConfig config = {
+        .numTickets = NUM_TICKETS,
+        .rounds = 1,
+        .traceOutput = TRACE_STDIO
+    };
+
+    static const struct option longOptions[] = {
+        {"mode", required_argument, NULL, 'm'},
+        {"block", required_argument, NULL, 'k'},
+        {"lock", required_argument, NULL, 'l'},
+        {"sellers", required_argument, NULL, 's'},
+        {"tickets", required_argument, NULL, 't'},
+        {"delay", required_argument, NULL, 'u'},
+        {"bench", no_argument, NULL, 'B'},
+        {"work", required_argument, NULL, 'W'},
+        {"ops", required_argument, NULL, 'n'},
+        {"duration", required_argument, NULL, 'd'},
+        {"trace", required_argument, NULL, 'T'},
+        {"trace-file", required_argument, NULL, 'o'},
+        {"trace-logger", no_argument, NULL, 'L'},
+        {"affinity", required_argument, NULL, 'a'},
+        {"layout", required_argument, NULL, 'R'},
+        {"draws", required_argument, NULL, 'x'},
+        {"rounds", required_argument, NULL, 'N'},
+        {"quantity", required_argument, NULL, 'q'},
+        {"instrument", no_argument, NULL, 'I'},
+        {"json", required_argument, NULL, 'J'},
+        {"fairness", no_argument, NULL, 'F'},
+        {"queries", required_argument, NULL, 'Q'},
+        {"inventory-lock", required_argument, NULL, 'p'},
+        {"events", required_argument, NULL, 'e'},
+        {"zipf", required_argument, NULL, 'z'},
+        {"stripes", required_argument, NULL, 'G'},
+        {"seed", required_argument, NULL, 'E'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    ApplyEnvironment(envOptions, sizeof(envOptions) / sizeof(envOptions[0]), ApplyOption, &config);
+    while ((opt = getopt_long(argc, argv, "m:k:l:s:t:u:BW:n:d:T:o:La:R:x:N:q:IJ:FQ:p:e:z:G:E:h", longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            Usage(argv[0]);
+            exit(0);
+        case '?':
+            Usage(argv[0]);
+            exit(-1);
+        default:
+            ApplyOption(&config, opt, optarg);
+            break;
+        }
+    }
+    baseSeed = config.seeded ? config.seed : RngClockSeed();
+
+    if (inventoryKind >= 0 && mode != MODE_LOCK && mode != MODE_SHARDED) {
+        printf("ERROR: -p only applies to the lock and sharded modes\n");
+        exit(-1);
+    }
+
+    // the sellers come first, then the query threads
+    numThreads = numSellers + numQueries;
+
+    // six arrays, each starting on its own cache line, the names, and the three of the events inventory
+    ArenaInit(&setup, numThreads * (sizeof(threadData) + sizeof(rng) + 4 * sizeof(void*) + sizeof(nameBuffer)) +
+                      6 * CACHE_LINE_SIZE +
+                      (mode == MODE_EVENTS ? numEvents * (sizeof(inventoryEntry) + sizeof(double)) +
+                                             numStripes * sizeof(lockStripe) + 3 * CACHE_LINE_SIZE : 0));
+    taskArgs = (void**) ArenaCalloc(&setup, numThreads, sizeof(void*));
+    threadArgs = (threadData*) ArenaCalloc(&setup, numThreads, sizeof(threadData));
+    sellers = threadArgs;
+    if (config.layout == LAYOUT_PACKED) packedRngs = (rng*) ArenaCalloc(&setup, numThreads, sizeof(rng));
+    logs = (const latencyLog**) ArenaCalloc(&setup, numThreads, sizeof(latencyLog*));
+    roundTickets = config.numTickets;
+
+    /**
+     * A benchmark sells the requested number of tickets, or when it is
+     * timed has an effectively bottomless supply and stops at the deadline,
+     * in every round.
+     */
+    if (bench.enabled) {
+        if (bench.ops > 0) roundTickets = (int) bench.ops;
+        else if (bench.duration > 0) roundTickets = INT_MAX;
+        BenchInit(&bench, numThreads);
+        LatencyInit(&roundLatency, baseSeed);
+    }
+    if (mode == MODE_EVENTS) InventoryInit(&setup, roundTickets);
+
+    // a benchmark never prints from the hot path
+    if (bench.enabled && config.traceOutput == TRACE_STDIO) config.traceOutput = TRACE_OFF;
+    if (config.traceFile != NULL && (traceOut = fopen(config.traceFile, "wb")) == NULL) {
+        printf("ERROR: cannot open trace file '%s'\n", config.traceFile);
+        exit(-1);
+    }
+    TracerInit(&trace, config.traceOutput, traceOut, numThreads, FormatSale);
 
-    void* status;
     pthread_attr_t attr;
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 
-    sem_init(&ticketsLock, 0, 1);
-    for (i = 0; i < NUM_SELLERS; i++) {
-        initstate_r(random(), rand_statebufs + i, BUFFER_SIZE, rand_states + i);
-        sprintf(nameBuffer, "Seller #%d", i + 1);
-        (threadArgs + i)->name = strdup(nameBuffer);
-        (threadArgs + i)->buffer = rand_states + i;
-        rc = pthread_create(threads + i, NULL, SellTickets, (void *) (threadArgs + i));
-        if (rc != 0) {
-            printf("ERROR: pthread_create() failed with return code %d\n", rc);
-            exit(-1);
+    LockInit(&ticketsLock, lockStrategy);
+    if (inventoryKind >= 0) RwInit(&inventoryLock, (rwKind) inventoryKind);
+    for (i = 0; i < numThreads; i++) {
+        if (i < numSellers) sprintf(nameBuffer, "Seller #%d", i + 1);
+        else sprintf(nameBuffer, "Query #%d", i - numSellers + 1);
+        (threadArgs + i)->trace = TraceRingFor(&trace, i, nameBuffer);
+    }
+    TracerDescribe(&trace, "sellTickets", baseSeed);
+    TracerStart(&trace, config.traceLogger);
+    for (i = 0; i < numThreads; i++) {
+        (threadArgs + i)->rng = config.layout == LAYOUT_PACKED ? packedRngs + i : &(threadArgs + i)->rngState;
+        RngSeed((threadArgs + i)->rng, baseSeed, i);
+        if (i < numSellers) sprintf(nameBuffer, "Seller #%d", i + 1);
+        else sprintf(nameBuffer, "Query #%d", i - numSellers + 1);
+        (threadArgs + i)->name = ArenaStrdup(&setup, nameBuffer);
+        (threadArgs + i)->query = i >= numSellers;
+        if (bench.enabled) LatencyInit(&(threadArgs + i)->latency, RngNext((threadArgs + i)->rng));
+        taskArgs[i] = threadArgs + i;
+    }
+    rc = PoolInit(&pool, numThreads, &attr, &config.placement);
+    if (rc != 0) {
+        printf("ERROR: pthread_create() failed with return code %d\n", rc);
+        exit(-1);
+    }
+    pthread_attr_destroy(&attr);
+
+    for (round = 0; round < config.rounds; round++) {
+        if (!bench.enabled && config.rounds > 1) printf("Round %d\n", round + 1);
+        atomic_store(&numTickets, roundTickets);
+        if (mode == MODE_EVENTS)
+            for (i = 0; i < numEvents; i++) atomic_store(&inventory[i].left, inventory[i].capacity);
+        atomic_store(&sellersLeft, numSellers);
+        roundStart = NowNs();
+        PoolSubmit(&pool, SellOrQuery, taskArgs);
+        if (bench.enabled) {
+            bench.startNs = NowNs();
+            BenchBegin(&bench);
+        }
+        PoolWait(&pool);
+        if (bench.enabled) {
+            elapsedNs += NowNs() - bench.startNs;
+            LatencyRecord(&roundLatency, NowNs() - roundStart);
         }
     }
+    PoolDestroy(&pool);
 
-    pthread_attr_destroy(&attr);
-    for (i = 0; i < NUM_SELLERS; i++) {
-        rc = pthread_join(threads[i], &status);
-        if (rc != 0) {
-            printf("ERROR: pthread_join() failed with a return code %d\n", rc);
+    TracerFinish(&trace);
+    if (traceOut != stdout) fclose(traceOut);
+
+    if (fairness) ReportFairness(threadArgs, numSellers);
+    if (instrument) {
+        const contentionStats** stats = (const contentionStats**) ArenaCalloc(&setup, numSellers, sizeof(void*));
+        const char** names = (const char**) ArenaCalloc(&setup, numSellers, sizeof(char*));
+
+        for (i = 0; i < numSellers; i++) {
+            stats[i] = &(threadArgs + i)->contention;
+            names[i] = (threadArgs + i)->name;
+        }
+        ContentionReport(mode == MODE_EVENTS ? "inventory stripe contention (ns)" : "ticketsLock contention (ns)",
+                         stats, names, numSellers);
+        if (config.jsonFile != NULL) WriteJson(&config, stats, names);
+    }
+
+    if (bench.enabled) {
+        long totalSold = 0, customers = 0, queued = 0, combines = 0, combined = 0, queries = 0;
+
+        for (i = 0; i < numThreads; i++) {
+            totalSold += (threadArgs + i)->numSold;
+            customers += (threadArgs + i)->customers;
+            queued += (threadArgs + i)->queued;
+            combines += (threadArgs + i)->combines;
+            combined += (threadArgs + i)->combined;
+            queries += (threadArgs + i)->queries;
+            logs[i] = &(threadArgs + i)->latency;
+        }
+        snprintf(label, sizeof(label), "benchmark: sellTickets mode=%s lock=%s sellers=%d quantity=%d queries=%d inventory=%s rounds=%d work=%lu draws=%ld layout=%s affinity=%s seed=%llu",
+                 modeNames[mode], lockNames[lockStrategy], numSellers, maxQuantity, numQueries,
+                 inventoryKind < 0 ? "exclusive" : rwNames[inventoryKind], config.rounds, bench.work, draws,
+                 config.layout == LAYOUT_PACKED ? "packed" : "padded", placementNames[config.placement.kind],
+                 (unsigned long long) baseSeed);
+        // whatever the mode, no round may sell more tickets than it put up for sale
+        if (totalSold > (long) roundTickets * config.rounds) {
+            printf("ERROR: sold %ld tickets, but only %ld were for sale\n", totalSold, (long) roundTickets * config.rounds);
             exit(-1);
         }
+        BenchReport(label, totalSold, elapsedNs, logs, numSellers);
+        printf("  jain index   %.4f over %d sellers (1 is even, %.4f is one seller selling all)\n",
+               JainIndex(threadArgs, numSellers), numSellers, 1.0 / numSellers);
+        printf("  customers    %ld (%.2f tickets each)\n", customers, customers > 0 ? (double) totalSold / customers : 0.0);
+        if (mode == MODE_RESERVE)
+            printf("  queued       %ld of %ld reservations (%.1f%%)\n", queued, customers,
+                   customers > 0 ? 100.0 * queued / customers : 0.0);
+        if (mode == MODE_COMBINING)
+            printf("  combining    %ld passes, %.2f requests each\n", combines,
+                   combines > 0 ? (double) combined / combines : 0.0);
+        if (mode == MODE_EVENTS) ReportInventory();
+        if (numQueries > 0) {
+            BenchReport("queries (tickets left)", queries, elapsedNs, logs + numSellers, numQueries);
+            printf("  reads/write  %.2f queries per sale\n", totalSold > 0 ? (double) queries / totalSold : 0.0);
+        }
+        if (config.rounds > 1) {
+            roundLogs[0] = &roundLatency;
+            BenchReport("rounds (submitted to last seller done)", config.rounds, elapsedNs, roundLogs, 1);
+        }
+        LatencyDestroy(&roundLatency);
+        for (i = 0; i < numThreads; i++) LatencyDestroy(&(threadArgs + i)->latency);
+        pthread_barrier_destroy(&bench.start);
     }
 
-    sem_destroy(&ticketsLock);
-    for (i = 0; i < NUM_SELLERS; i++) free((threadArgs + i)->name);
-    free(rand_states);
-    free(rand_statebufs);    
-    free(threadArgs);
-    free(threads);
-    printf("All done!\n");
+    LockDestroy(&ticketsLock);
+    for (i = 0; mode == MODE_EVENTS && i < numStripes; i++) LockDestroy(&stripes[i].lock);
+    if (inventoryKind >= 0) RwDestroy(&inventoryLock);
+    ArenaDestroy(&setup);
+    if (!bench.enabled) printf("All done!\n");
     pthread_exit(NULL);
 }
 
+static void Usage(const char* prog)
+{
+    printf("usage: %s [-m lock|atomic|sharded|reserve|combining|events] [-k block] [-l lock] [-s sellers] [-t tickets]\n", prog);
+    printf("       [-u delay] [-B [-W work] [-n ops | -d seconds]]\n");
+    printf("       [-T stdio|text|binary|off [-o file] [-L]] [-a none|compact|scatter|list:CPUS|numa[:N]]\n");
+    printf("       [-R padded|packed] [-x draws] [-N rounds] [-q quantity] [-I] [-J file] [-F]\n");
+    printf("       [-Q queries [-p exclusive|rwlock|seqlock|bravo]] [-e events] [-z exponent] [-G stripes]\n");
+    printf("  -m, --mode    lock: every sale inside the ticketsLock critical section (default)\n");
+    printf("                atomic: lock-free sales on an atomic counter\n");
+    printf("                sharded: sellers take blocks of tickets under the lock\n");
+    printf("                reserve: a customer's tickets granted in one compare-and-swap,\n");
+    printf("                queueing on the lock when contended (best with -l ticket or mcs)\n");
+    printf("                combining: requests granted in batches by one seller at a time\n");
+    printf("                events: many events, each customer buying for one of them\n");
+    printf("  -e, --events  number of events in events mode; the tickets are split between\n");
+    printf("                them (default %d)\n", NUM_EVENTS);
+    printf("  -z, --zipf    pick events with a Zipfian distribution of this exponent, such\n");
+    printf("                as 0.99; 0 picks them uniformly (default)\n");
+    printf("  -G, --stripes locks striped over the events, each guarding every stripes-th\n");
+    printf("                one, or 0 for a compare-and-swap per event (default %d)\n", NUM_STRIPES);
+    printf("  -q, --quantity  most tickets one customer buys; each wants 1 to this many\n");
+    printf("                (default 1)\n");
+    printf("  -k, --block   tickets per block in sharded mode (default %d)\n", BLOCK_SIZE);
+    printf("  -l, --lock    sem (default), mutex, adaptive, spin, ticket or mcs\n");
+    printf("  -s, --sellers number of seller threads, or auto for one per CPU (default %d)\n", NUM_SELLERS);
+    printf("  -t, --tickets tickets to sell (default %d)\n", NUM_TICKETS);
+    printf("  -u, --delay   shortest customer delay in microseconds; the longest is four times\n");
+    printf("                that (default %d)\n", CUSTOMER_DELAY_US);
+    printf("  -B, --bench   run as a benchmark and report throughput and latency\n");
+    printf("  -W, --work    busy-work iterations per customer in a benchmark (default 0)\n");
+    printf("  -x, --draws   random numbers each customer draws in a benchmark (default 0)\n");
+    printf("  -n, --ops     tickets to sell in a benchmark (default: as -t)\n");
+    printf("  -d, --duration  run a benchmark for this many seconds instead\n");
+    printf("  -N, --rounds  sell this many rounds of tickets with the same sellers (default 1)\n");
+    printf("  -E, --seed    seed the customers' delays, quantities and events with this instead\n");
+    printf("                of the clock, so that a run can be repeated on the same input\n");
+    printf("  -T, --trace   stdio: print each sale as it happens (default, off in a benchmark)\n");
+    printf("                text, binary: record sales in per-thread rings and write them out\n");
+    printf("                at the end; off: no output\n");
+    printf("  -o, --trace-file  write the trace here instead of to stdout\n");
+    printf("  -L, --trace-logger  drain the trace rings from a background thread as it runs\n");
+    printf("  -a, --affinity  where to pin sellers: none (default), compact, scatter,\n");
+    printf("                list:CPUS such as list:0,2,4-7, or numa[:N] for one node\n");
+    printf("  -I, --instrument  count acquisitions, contention, wait and hold times of\n");
+    printf("                ticketsLock per seller and print them as a table\n");
+    printf("  -J, --json    also write that table to this file as JSON (implies -I)\n");
+    printf("  -F, --fairness  time each seller's longest wait between two sales and print every\n");
+    printf("                seller's share of the tickets\n");
+    printf("  -Q, --queries number of query threads reading the tickets left (default 0)\n");
+    printf("  -p, --inventory-lock  in lock and sharded modes, what queries read under:\n");
+    printf("                exclusive: ticketsLock, like a sale (default); rwlock: a pthread\n");
+    printf("                rwlock; seqlock: no lock, retried if a sale got in between;\n");
+    printf("                bravo: a reader-biased rwlock with per-CPU reader counters\n");
+    printf("  -R, --layout  padded: each seller's generator in its own cache lines (default)\n");
+    printf("                packed: all generators side by side, sharing cache lines\n");
+    printf("Each option can also be set with the environment variable listed here;\n");
+    printf("the command line wins when both are given:\n ");
+    for (size_t i = 0; i < sizeof(envOptions) / sizeof(envOptions[0]); i++)
+        printf(" %s (-%c)", envOptions[i].name, envOptions[i].opt);
+    printf("\n");
+}
+
+/**
+ * ApplyOption
+ * -----------
+ * Applies one setting, from the command line or the environment, either
+ * to the globals the sellers read or to the programConfig in ctx.
+ */
+
+static void ApplyOption(void* ctx, int opt, const char* arg)
+{
+    programConfig* config = (programConfig*) ctx;
+    int kind;
+
+    switch (opt) {
+    case 'm':
+        if (strcmp(arg, "lock") == 0) mode = MODE_LOCK;
+        else if (strcmp(arg, "atomic") == 0) mode = MODE_ATOMIC;
+        else if (strcmp(arg, "sharded") == 0) mode = MODE_SHARDED;
+        else if (strcmp(arg, "reserve") == 0) mode = MODE_RESERVE;
+        else if (strcmp(arg, "combining") == 0) mode = MODE_COMBINING;
+        else if (strcmp(arg, "events") == 0) mode = MODE_EVENTS;
+        else {
+            printf("ERROR: unknown mode '%s'\n", arg);
+            exit(-1);
+        }
+        break;
+    case 'k':
+        blockSize = (int) ParseLong(arg, "block size", 1, INT_MAX);
+        break;
+    case 'l':
+        kind = LockKindFromName(arg);
+        if (kind < 0) {
+            printf("ERROR: unknown lock strategy '%s'\n", arg);
+            exit(-1);
+        }
+        lockStrategy = (lockKind) kind;
+        break;
+    case 's':
+        numSellers = ParseThreadCount(arg, "sellers", OnlineCpus(), MAX_SELLERS);
+        break;
+    case 't':
+        config->numTickets = (int) ParseLong(arg, "tickets", 0, INT_MAX);
+        break;
+    case 'u':
+        customerDelay = ParseLong(arg, "delay", 0, 1000000);
+        break;
+    case 'B':
+        bench.enabled = arg == NULL || strcmp(arg, "0") != 0;
+        break;
+    case 'W':
+        bench.work = (unsigned long) ParseLong(arg, "work", 0, LONG_MAX);
+        break;
+    case 'n':
+        bench.ops = ParseLong(arg, "ops", 1, INT_MAX);
+        break;
+    case 'd':
+        bench.duration = ParseDuration(arg, "duration");
+        break;
+    case 'T':
+        if (!TraceModeFromName(arg, &config->traceOutput)) {
+            printf("ERROR: unknown trace output '%s'\n", arg);
+            exit(-1);
+        }
+        break;
+    case 'o':
+        config->traceFile = arg;
+        break;
+    case 'L':
+        config->traceLogger = arg == NULL || strcmp(arg, "0") != 0;
+        break;
+    case 'a':
+        if (!PlacementFromSpec(arg, &config->placement)) {
+            printf("ERROR: unknown or unusable affinity '%s'\n", arg);
+            exit(-1);
+        }
+        break;
+    case 'R':
+        if (strcmp(arg, "padded") == 0) config->layout = LAYOUT_PADDED;
+        else if (strcmp(arg, "packed") == 0) config->layout = LAYOUT_PACKED;
+        else {
+            printf("ERROR: unknown layout '%s'\n", arg);
+            exit(-1);
+        }
+        break;
+    case 'x':
+        draws = ParseLong(arg, "draws", 0, MAX_DRAWS);
+        break;
+    case 'N':
+        config->rounds = (int) ParseLong(arg, "rounds", 1, MAX_ROUNDS);
+        break;
+    case 'q':
+        maxQuantity = (int) ParseLong(arg, "quantity", 1, MAX_QUANTITY);
+        break;
+    case 'I':
+        instrument = arg == NULL || strcmp(arg, "0") != 0;
+        break;
+    case 'J':
+        config->jsonFile = arg;
+        instrument = true;
+        break;
+    case 'F':
+        fairness = arg == NULL || strcmp(arg, "0") != 0;
+        break;
+    case 'Q':
+        numQueries = (int) ParseLong(arg, "queries", 0, MAX_SELLERS);
+        break;
+    case 'p':
+        kind = strcmp(arg, "exclusive") == 0 ? -1 : RwKindFromName(arg);
+        if (kind < 0 && strcmp(arg, "exclusive") != 0) {
+            printf("ERROR: unknown inventory lock '%s'\n", arg);
+            exit(-1);
+        }
+        inventoryKind = kind;
+        break;
+    case 'E':
+        config->seeded = true;
+        config->seed = ParseSeed(arg);
+        break;
+    case 'e':
+        numEvents = (int) ParseLong(arg, "events", 1, MAX_EVENTS);
+        break;
+    case 'z':
+        zipfExponent = ParseDouble(arg, "Zipf exponent", 0);
+        break;
+    case 'G':
+        numStripes = (int) ParseLong(arg, "stripes", 0, MAX_EVENTS);
+        break;
+    }
+}
+
 /**
  * SellTickets
  * -----------
@@ -99,40 +686,654 @@ void main(int argc, char **argv)
  * will loop selling tickets until there are no more tickets left to
  * sell. Before access the global numTickets variable, it acquires the
  * ticketsLock to ensure that our threads don't step on one another and
- * oversell on the number of tickets
+ * oversell on the number of tickets. In sharded mode the seller only does
+ * that when the block of tickets it holds runs out. A customer who wants
+ * several tickets either buys them one by one or, in reserve, combining
+ * and events modes, has them all granted at once; when the tickets run out
+ * the last customer takes however many are left.
  */
 
 static void* SellTickets(void* threadArgs)
 {
     // loval vars are unique to each thread
     bool done = false;
-    int numSoldByThisThread = 0;
+    int numSoldByThisThread = 0, customers = 0;
+    int ticketsLeft, myBlock = 0, want, got;
+    uint64_t seed = 0, saleStart = 0, deadline = UINT64_MAX, lastSale, now;
     threadData* threadInfo = (threadData*) threadArgs;
 
+    if (bench.enabled) {
+        BenchBegin(&bench);
+        deadline = BenchDeadline(&bench);
+        seed = (uint64_t) (uintptr_t) threadInfo;
+    }
+    lastSale = fairness ? NowNs() : 0;
+
     while (!done) {
-        /**
-         * imagine some code here which does something independent of
-         * the other hreads such as working with a customer to determine
-         * which tickets they want. Simulate with a small random delay
-         * to get random variations in output patters.
-         */
-        int result;
-        random_r(threadInfo->buffer, &result);
-        usleep(500000 + result % 1500000);
+        if (bench.enabled) {
+            seed = BusyWork(bench.work, seed);
+            for (long d = 0; d < draws; d++) seed += RngNext(threadInfo->rng);
+            if (customers % DEADLINE_CHECK_INTERVAL == 0 && NowNs() >= deadline) break;
+            saleStart = NowNs();
+        } else {
+            /**
+             * imagine some code here which does something independent of
+             * the other hreads such as working with a customer to determine
+             * which tickets they want. Simulate with a small random delay
+             * to get random variations in output patters.
+             */
+            if (customerDelay > 0) usleep(customerDelay + RngBelow(threadInfo->rng, 3 * customerDelay));
+        }
 
-        // ENTER CRITICAL SECTION
-        sem_wait(&ticketsLock);
-        if (numTickets == 0) {
-            done = true;
+        want = maxQuantity > 1 ? 1 + (int) RngBelow(threadInfo->rng, maxQuantity) : 1;
+        ReportSale(threadInfo, EVENT_CUSTOMER, want, 0);
+        if (mode == MODE_EVENTS) {
+            got = SellEvent(threadInfo, want, &ticketsLeft);
+            if (got > 0) ReportSale(threadInfo, EVENT_EVENT_GRANT, ticketsLeft, got);
+        } else if (mode == MODE_RESERVE || mode == MODE_COMBINING) {
+            got = mode == MODE_RESERVE ? Reserve(threadInfo, want, &ticketsLeft)
+                                       : ReserveCombined(threadInfo, want, &ticketsLeft);
+            if (got > 0) ReportSale(threadInfo, EVENT_GRANT, ticketsLeft, got);
         } else {
-            numTickets--;
-            numSoldByThisThread++;
-            printf("%s sold one (%d left)\n", threadInfo->name, numTickets);
+            for (got = 0; got < want && SellSingle(threadInfo, &myBlock); got++)
+                ;
+        }
+
+        if (got > 0) {
+            numSoldByThisThread += got;
+            customers++;
+            if (fairness) {
+                now = NowNs();
+                if (now - lastSale > threadInfo->maxGapNs) threadInfo->maxGapNs = now - lastSale;
+                lastSale = now;
+            }
+            if (bench.enabled) LatencyRecord(&threadInfo->latency, NowNs() - saleStart);
+        } else {
+            done = true;
+        }
+    }
+
+    // a seller that sold nothing more before the tickets ran out waited from its last sale to the end
+    if (fairness && (now = NowNs()) - lastSale > threadInfo->maxGapNs) threadInfo->maxGapNs = now - lastSale;
+    threadInfo->numSold += numSoldByThisThread;
+    threadInfo->customers += customers;
+    atomic_fetch_sub_explicit(&sellersLeft, 1, memory_order_release);
+    if (!bench.enabled) ReportSale(threadInfo, EVENT_SOLD_OUT, numSoldByThisThread, 0);
+    return threadArgs;
+}
+
+/**
+ * SellSingle
+ * ----------
+ * Sells one ticket the way the lock, atomic and sharded modes do, and
+ * returns false once there are none left to sell.
+ */
+
+static bool SellSingle(threadData* threadInfo, int* myBlock)
+{
+    int ticketsLeft;
+    bool sold;
+
+    if (mode == MODE_ATOMIC) {
+        sold = SellOne(&ticketsLeft);
+        if (sold) ReportSale(threadInfo, EVENT_SALE, ticketsLeft, 1);
+    } else if (mode == MODE_SHARDED) {
+        if (*myBlock == 0) *myBlock = TakeBlock(threadInfo, blockSize);
+        sold = *myBlock > 0;
+        if (sold) {
+            (*myBlock)--;
+            ReportSale(threadInfo, EVENT_BLOCK_SALE, *myBlock, 1);
+        }
+    } else {
+        // ENTER CRITICAL SECTION
+        InventoryAcquire(threadInfo);
+        ticketsLeft = atomic_load_explicit(&numTickets, memory_order_relaxed);
+        sold = ticketsLeft > 0;
+        if (sold) {
+            atomic_store_explicit(&numTickets, --ticketsLeft, memory_order_relaxed);
+            ReportSale(threadInfo, EVENT_SALE, ticketsLeft, 1);
         }
         // LEAVE CRITICAL SECTION
-        sem_post(&ticketsLock);
+        InventoryRelease(threadInfo);
+    }
+    return sold;
+}
+
+/**
+ * QueryTickets
+ * ------------
+ * The routine of a query thread: it keeps looking up how many tickets are
+ * left, with its own customer's delay or busy-work in between, until the
+ * last seller is done.
+ */
+
+static void* QueryTickets(void* threadArgs)
+{
+    threadData* threadInfo = (threadData*) threadArgs;
+    long queries = 0;
+    uint64_t seed = (uint64_t) (uintptr_t) threadInfo, queryStart = 0;
+    int left;
+
+    if (bench.enabled) BenchBegin(&bench);
+
+    while (atomic_load_explicit(&sellersLeft, memory_order_acquire) > 0) {
+        if (bench.enabled) {
+            seed = BusyWork(bench.work, seed);
+            queryStart = NowNs();
+        } else if (customerDelay > 0) {
+            usleep(customerDelay + RngBelow(threadInfo->rng, 3 * customerDelay));
+        }
+        left = QueryOne(threadInfo);
+        queries++;
+        if (bench.enabled) LatencyRecord(&threadInfo->latency, NowNs() - queryStart);
+        else ReportSale(threadInfo, EVENT_QUERY, left, 0);
+    }
+
+    threadInfo->queries += queries;
+    return threadArgs;
+}
+
+// the pool's task: each worker is a seller or a query thread
+static void* SellOrQuery(void* threadArgs)
+{
+    return ((threadData*) threadArgs)->query ? QueryTickets(threadArgs) : SellTickets(threadArgs);
+}
+
+/**
+ * QueryOne
+ * --------
+ * Reads the tickets left under the inventory lock. The lock-free modes
+ * never need a lock to read their counter, and only the lock and sharded
+ * modes guard it with one: ticketsLock, as for a sale, or with -p a
+ * pthread rwlock, a seqlock or a BRAVO lock, whose readers normally touch
+ * nothing but a per-CPU counter. In events mode a query looks up one
+ * event, picked the way customers pick them.
+ */
+
+static int QueryOne(threadData* threadInfo)
+{
+    long token;
+    int left;
+
+    if (mode == MODE_EVENTS) {
+        threadInfo->event = PickEvent(threadInfo);
+        return atomic_load_explicit(&inventory[threadInfo->event].left, memory_order_relaxed);
+    }
+    if (mode != MODE_LOCK && mode != MODE_SHARDED) return atomic_load_explicit(&numTickets, memory_order_relaxed);
+    if (inventoryKind < 0) {
+        LockAcquire(&ticketsLock, &threadInfo->node);
+        left = atomic_load_explicit(&numTickets, memory_order_relaxed);
+        LockRelease(&ticketsLock, &threadInfo->node);
+        return left;
+    }
+    do {
+        token = RwReadBegin(&inventoryLock);
+        left = atomic_load_explicit(&numTickets, memory_order_relaxed);
+    } while (!RwReadEnd(&inventoryLock, token));
+    return left;
+}
+
+/**
+ * InventoryAcquire and InventoryRelease
+ * -------------------------------------
+ * The sellers' side of the inventory lock: ticketsLock, or the write side
+ * of the read-mostly lock picked with -p, counted with -I either way.
+ */
+
+static void InventoryAcquire(threadData* threadInfo)
+{
+    contentionStats* c = Contention(threadInfo);
+    uint64_t start;
+
+    if (inventoryKind < 0) {
+        ContentionAcquire(&ticketsLock, &threadInfo->node, c);
+        return;
+    }
+    start = ContentionStart(c);
+    ContentionAcquired(c, start, RwWriteLock(&inventoryLock));
+}
+
+static void InventoryRelease(threadData* threadInfo)
+{
+    if (inventoryKind < 0) {
+        ContentionRelease(&ticketsLock, &threadInfo->node, Contention(threadInfo));
+        return;
+    }
+    ContentionReleased(Contention(threadInfo));
+    RwWriteUnlock(&inventoryLock);
+}
+
+/**
+ * ReportSale
+ * ----------
+ * Either prints the event straight away, as this example always has, or
+ * records it in the seller's trace ring to be written out later, which
+ * keeps stdio's lock from being a second serialization point inside the
+ * critical section. tickets is how many the event sold, which only a
+ * grant can make more than one. A customer only goes into the trace, for
+ * traceReport to compare runs by.
+ */
+
+static void ReportSale(threadData* threadInfo, saleEvent kind, int count, int tickets)
+{
+    if (trace.mode != TRACE_STDIO) {
+        TraceRecord(threadInfo->trace, kind,
+                    kind == EVENT_GRANT ? tickets : kind == EVENT_EVENT_GRANT ? SaleSlot(threadInfo->event, tickets) : -1,
+                    count);
+        return;
+    }
+    switch (kind) {
+    case EVENT_SALE:
+        printf("%s sold one (%d left)\n", threadInfo->name, count);
+        break;
+    case EVENT_BLOCK_SALE:
+        printf("%s sold one (%d left in my block)\n", threadInfo->name, count);
+        break;
+    case EVENT_SOLD_OUT:
+        printf("%s noticed all tickets sold! (I sold %d myself)\n", threadInfo->name, count);
+        break;
+    case EVENT_GRANT:
+        printf("%s sold %d (%d left)\n", threadInfo->name, tickets, count);
+        break;
+    case EVENT_QUERY:
+        printf("%s sees %d left\n", threadInfo->name, count);
+        break;
+    case EVENT_EVENT_GRANT:
+        printf("%s sold %d for event #%d (%d left)\n", threadInfo->name, tickets, threadInfo->event + 1, count);
+        break;
+    case EVENT_CUSTOMER:
+        break;
+    }
+}
+
+static void FormatSale(FILE* out, const char* name, const traceEvent* event)
+{
+    fprintf(out, "[%12.6f] ", event->timestamp / 1e9);
+    switch (event->kind) {
+    case EVENT_SALE:
+        fprintf(out, "%s sold one (%lld left)\n", name, (long long) event->value);
+        break;
+    case EVENT_BLOCK_SALE:
+        fprintf(out, "%s sold one (%lld left in my block)\n", name, (long long) event->value);
+        break;
+    case EVENT_SOLD_OUT:
+        fprintf(out, "%s noticed all tickets sold! (I sold %lld myself)\n", name, (long long) event->value);
+        break;
+    case EVENT_GRANT:
+        fprintf(out, "%s sold %lld (%lld left)\n", name, (long long) event->slot, (long long) event->value);
+        break;
+    case EVENT_QUERY:
+        fprintf(out, "%s sees %lld left\n", name, (long long) event->value);
+        break;
+    case EVENT_EVENT_GRANT:
+        fprintf(out, "%s sold %d for event #%d (%lld left)\n", name, SaleSlotTickets(event->slot),
+                SaleSlotEvent(event->slot) + 1, (long long) event->value);
+        break;
+    case EVENT_CUSTOMER:
+        fprintf(out, "%s has a customer for %lld\n", name, (long long) event->value);
+        break;
+    }
+}
+
+/**
+ * SellOne
+ * -------
+ * Sells one ticket from the atomic counter without taking the lock, and
+ * reports how many are left through *ticketsLeft. Returns false once the
+ * tickets are gone. The compare-and-swap only ever decrements a value it
+ * has just seen to be positive, so however the sellers interleave the
+ * counter never goes below zero.
+ */
+
+static bool SellOne(int* ticketsLeft)
+{
+    int left = atomic_load_explicit(&numTickets, memory_order_relaxed);
+
+    while (left > 0) {
+        if (atomic_compare_exchange_weak_explicit(&numTickets, &left, left - 1,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            *ticketsLeft = left - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * TakeBlock
+ * ---------
+ * Moves up to blockSize tickets from the global pool to the calling
+ * seller inside the ticketsLock critical section, and returns how many it
+ * got: zero means the pool is empty.
+ */
+
+static int TakeBlock(threadData* threadInfo, int blockSize)
+{
+    int left, taken;
+
+    // ENTER CRITICAL SECTION
+    InventoryAcquire(threadInfo);
+    left = atomic_load_explicit(&numTickets, memory_order_relaxed);
+    taken = left < blockSize ? left : blockSize;
+    atomic_store_explicit(&numTickets, left - taken, memory_order_relaxed);
+    // LEAVE CRITICAL SECTION
+    InventoryRelease(threadInfo);
+    return taken;
+}
+
+/**
+ * Reserve
+ * -------
+ * Grants up to want tickets in one step and reports how many are left
+ * through *ticketsLeft; returns how many were granted, zero once they are
+ * gone. A compare-and-swap only fails when another seller changed the
+ * counter in between, so after RESERVE_TRIES failures the pool counts as
+ * contended. The seller then queues behind ticketsLock and makes its
+ * attempts from the head of the queue, racing only the sellers that have
+ * not given up yet instead of all of them.
+ */
+
+static int Reserve(threadData* threadInfo, int want, int* ticketsLeft)
+{
+    int left = atomic_load_explicit(&numTickets, memory_order_relaxed);
+    int taken, tries;
+
+    for (tries = 0; left > 0 && tries < RESERVE_TRIES; tries++) {
+        taken = left < want ? left : want;
+        if (atomic_compare_exchange_weak_explicit(&numTickets, &left, left - taken,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            *ticketsLeft = left - taken;
+            return taken;
+        }
+    }
+    if (left <= 0) return 0;
+
+    threadInfo->queued++;
+    // ENTER CRITICAL SECTION
+    ContentionAcquire(&ticketsLock, &threadInfo->node, Contention(threadInfo));
+    left = atomic_load_explicit(&numTickets, memory_order_relaxed);
+    do {
+        taken = left < want ? left : want;
+    } while (left > 0 && !atomic_compare_exchange_weak_explicit(&numTickets, &left, left - taken,
+                                                                memory_order_relaxed, memory_order_relaxed));
+    // LEAVE CRITICAL SECTION
+    ContentionRelease(&ticketsLock, &threadInfo->node, Contention(threadInfo));
+    if (left <= 0) return 0;
+    *ticketsLeft = left - taken;
+    return taken;
+}
+
+/**
+ * ReserveCombined
+ * ---------------
+ * Reserve by flat combining. The seller publishes its request in its own
+ * slot and then waits for it to be answered. While it waits it keeps
+ * trying to become the combiner. Whoever succeeds answers every request
+ * that is pending, its own included, so the counter is only ever touched
+ * by the combiner. Its cache line stays with the combiner instead of
+ * bouncing between sockets, and every slot is on a line of its own.
+ */
+
+static int ReserveCombined(threadData* threadInfo, int want, int* ticketsLeft)
+{
+    int spins = 0;
+
+    atomic_store_explicit(&threadInfo->request, want, memory_order_release);
+    while (atomic_load_explicit(&threadInfo->request, memory_order_acquire) != 0) {
+        if (!atomic_load_explicit(&combinerBusy, memory_order_relaxed) &&
+            !atomic_exchange_explicit(&combinerBusy, true, memory_order_acquire)) {
+            Combine(threadInfo);
+            atomic_store_explicit(&combinerBusy, false, memory_order_release);
+        } else if (++spins < COMBINE_SPINS) {
+            CpuRelax();
+        } else {
+            sched_yield();
+        }
+    }
+    *ticketsLeft = threadInfo->left;
+    return threadInfo->granted;
+}
+
+/**
+ * Combine
+ * -------
+ * One pass over every seller's slot by the holder of combinerBusy,
+ * granting each pending request from a private copy of the counter that
+ * is written back once at the end. The flag's acquire and release order
+ * one combiner's updates before the next one's.
+ */
+
+static void Combine(threadData* combiner)
+{
+    int left = atomic_load_explicit(&numTickets, memory_order_relaxed);
+    int i, want, granted;
+    long answered = 0;
+
+    for (i = 0; i < numSellers; i++) {
+        threadData* seller = sellers + i;
+
+        want = atomic_load_explicit(&seller->request, memory_order_acquire);
+        if (want == 0) continue;
+        granted = left < want ? left : want;
+        left -= granted;
+        seller->granted = granted;
+        seller->left = left;
+        atomic_store_explicit(&seller->request, 0, memory_order_release);
+        answered++;
+    }
+    atomic_store_explicit(&numTickets, left, memory_order_relaxed);
+    combiner->combines++;
+    combiner->combined += answered;
+}
+
+/**
+ * InventoryInit
+ * -------------
+ * Sets up the events mode inventory from arena a: the entries, with the
+ * round's tickets split between them as evenly as they go, the stripe
+ * locks, and for -z the cumulative distribution customers pick events by,
+ * in which event i is chosen with a weight of 1 / (i + 1)^exponent.
+ */
+
+static void InventoryInit(arena* a, int roundTickets)
+{
+    double total = 0;
+    int i;
+
+    inventory = (inventoryEntry*) ArenaCalloc(a, numEvents, sizeof(inventoryEntry));
+    for (i = 0; i < numEvents; i++)
+        inventory[i].capacity = roundTickets / numEvents + (i < roundTickets % numEvents);
+    if (numStripes > 0) {
+        stripes = (lockStripe*) ArenaCalloc(a, numStripes, sizeof(lockStripe));
+        for (i = 0; i < numStripes; i++) LockInit(&stripes[i].lock, lockStrategy);
+    }
+    if (zipfExponent > 0) {
+        eventCdf = (double*) ArenaCalloc(a, numEvents, sizeof(double));
+        for (i = 0; i < numEvents; i++) eventCdf[i] = total += pow(i + 1, -zipfExponent);
+        for (i = 0; i < numEvents; i++) eventCdf[i] /= total;
+    }
+}
+
+// the event one customer wants, by binary search of the distribution for -z
+static int PickEvent(threadData* threadInfo)
+{
+    double u;
+    int low = 0, high = numEvents - 1, middle;
+
+    if (eventCdf == NULL) return (int) RngBelow(threadInfo->rng, numEvents);
+    u = RngUnit(threadInfo->rng);
+    while (low < high) {
+        middle = (low + high) / 2;
+        if (eventCdf[middle] > u) high = middle;
+        else low = middle + 1;
     }
+    return low;
+}
+
+/**
+ * SellEvent
+ * ---------
+ * Sells a customer up to want tickets for the event they pick, or for the
+ * next one that still has any if it is sold out, and returns how many,
+ * zero once every event is sold out. The event goes in threadInfo->event
+ * and what is left of it in *ticketsLeft.
+ */
+
+static int SellEvent(threadData* threadInfo, int want, int* ticketsLeft)
+{
+    int event = PickEvent(threadInfo), tries, taken;
+
+    for (tries = 0; tries < numEvents; tries++) {
+        if (atomic_load_explicit(&inventory[event].left, memory_order_relaxed) > 0 &&
+            (taken = TakeFromEvent(threadInfo, event, want, ticketsLeft)) > 0) {
+            threadInfo->event = event;
+            return taken;
+        }
+        if (++event == numEvents) event = 0;
+    }
+    return 0;
+}
+
+/**
+ * TakeFromEvent
+ * -------------
+ * Takes up to want tickets from one entry, under its stripe lock or with
+ * a compare-and-swap when there are no stripes.
+ */
+
+static int TakeFromEvent(threadData* threadInfo, int event, int want, int* ticketsLeft)
+{
+    inventoryEntry* entry = inventory + event;
+    strategyLock* lock;
+    int left, taken;
+
+    if (numStripes == 0) {
+        left = atomic_load_explicit(&entry->left, memory_order_relaxed);
+        do {
+            taken = left < want ? left : want;
+        } while (left > 0 && !atomic_compare_exchange_weak_explicit(&entry->left, &left, left - taken,
+                                                                    memory_order_relaxed, memory_order_relaxed));
+        if (left <= 0) return 0;
+        *ticketsLeft = left - taken;
+        return taken;
+    }
+
+    lock = &stripes[event % numStripes].lock;
+    // ENTER CRITICAL SECTION
+    ContentionAcquire(lock, &threadInfo->node, Contention(threadInfo));
+    left = atomic_load_explicit(&entry->left, memory_order_relaxed);
+    taken = left < want ? left : want;
+    atomic_store_explicit(&entry->left, left - taken, memory_order_relaxed);
+    // LEAVE CRITICAL SECTION
+    ContentionRelease(lock, &threadInfo->node, Contention(threadInfo));
+    *ticketsLeft = left - taken;
+    return taken;
+}
+
+/**
+ * ReportInventory
+ * ---------------
+ * The events mode part of a benchmark report: how the sales spread over
+ * the events in the last round, and how much of them went to the hottest.
+ */
+
+static void ReportInventory(void)
+{
+    long sold, total = 0, hottest = 0;
+    int i, hot = 0, soldOut = 0;
 
-    printf("%s noticed all tickets sold! (I sold %d myself)\n", threadInfo->name, numSoldByThisThread);
-    pthread_exit((void*) threadArgs);
+    for (i = 0; i < numEvents; i++) {
+        sold = inventory[i].capacity - atomic_load_explicit(&inventory[i].left, memory_order_relaxed);
+        total += sold;
+        if (sold > hottest) {
+            hottest = sold;
+            hot = i;
+        }
+        if (atomic_load_explicit(&inventory[i].left, memory_order_relaxed) == 0) soldOut++;
+    }
+    if (zipfExponent > 0) printf("  events       %d, picked by zipf %.2f", numEvents, zipfExponent);
+    else printf("  events       %d, picked uniformly", numEvents);
+    if (numStripes > 0) printf(", %d lock stripes\n", numStripes);
+    else printf(", compare-and-swap per event\n");
+    printf("  hottest      event #%d sold %ld (%.1f%% of the round), %d of %d sold out\n", hot + 1, hottest,
+           total > 0 ? 100.0 * hottest / total : 0.0, soldOut, numEvents);
+}
+
+// where a seller counts its trips through ticketsLock, if anywhere
+static contentionStats* Contention(threadData* threadInfo)
+{
+    return instrument ? &threadInfo->contention : NULL;
+}
+
+/**
+ * WriteJson
+ * ---------
+ * Writes the run's settings and the ticketsLock table to config->jsonFile.
+ */
+
+static void WriteJson(const programConfig* config, const contentionStats* const* stats, const char* const* names)
+{
+    FILE* out = fopen(config->jsonFile, "w");
+
+    if (out == NULL) {
+        printf("ERROR: cannot open JSON file '%s'\n", config->jsonFile);
+        exit(-1);
+    }
+    fprintf(out, "{\n  \"program\": \"sellTickets\", \"mode\": \"%s\", \"lock\": \"%s\", \"sellers\": %d, "
+                 "\"rounds\": %d, \"bench\": %s,\n  \"sections\": [\n",
+            modeNames[mode], lockNames[lockStrategy], numSellers, config->rounds, bench.enabled ? "true" : "false");
+    ContentionJson(out, "ticketsLock", stats, names, numSellers);
+    fprintf(out, "\n  ]\n}\n");
+    fclose(out);
+}
+
+/**
+ * JainIndex
+ * ---------
+ * Jain's fairness index over the tickets each seller sold,
+ * (sum x)^2 / (n * sum x^2).
+ */
+
+static double JainIndex(const threadData* threads, int n)
+{
+    double sum = 0, squares = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        sum += threads[i].numSold;
+        squares += (double) threads[i].numSold * threads[i].numSold;
+    }
+    return squares > 0 ? sum * sum / (n * squares) : 1.0;
+}
+
+/**
+ * ReportFairness
+ * --------------
+ * Every seller's share of the sales and the longest it went without one,
+ * counted from the start of a round to the end, then the index and the extremes. A
+ * gap includes the seller's own time with its customer, so in a benchmark
+ * with no work it is all time spent waiting for the counter.
+ */
+
+static void ReportFairness(const threadData* threads, int n)
+{
+    long total = 0, fewest = LONG_MAX, most = 0;
+    uint64_t longest = 0;
+    int i, starved = 0;
+
+    for (i = 0; i < n; i++) total += threads[i].numSold;
+    printf("fairness\n");
+    for (i = 0; i < n; i++) {
+        printf("  %-16s sold %10ld (%5.1f%%), longest gap %llu ns\n", threads[i].name, threads[i].numSold,
+               total > 0 ? 100.0 * threads[i].numSold / total : 0.0, (unsigned long long) threads[i].maxGapNs);
+        if (threads[i].numSold < fewest) fewest = threads[i].numSold;
+        if (threads[i].numSold > most) most = threads[i].numSold;
+        if (threads[i].maxGapNs > longest) {
+            longest = threads[i].maxGapNs;
+            starved = i;
+        }
+    }
+    printf("  jain index   %.4f\n", JainIndex(threads, n));
+    printf("  min/max      %ld / %ld sold (%.3f)\n", fewest, most, most > 0 ? (double) fewest / most : 1.0);
+    printf("  longest gap  %llu ns (%s)\n", (unsigned long long) longest, threads[starved].name);
 }
@@ -0,0 +1,188 @@
+/**
+ * shm.h
+ * -----
+ * A POSIX shared memory segment (shm_open and mmap) that a fixed number of
+ * processes meet in. Whichever opens the name first creates the segment,
+ * sets up what goes in it and declares it ready with ShmReady; the others
+ * wait for that and then map it too. The one that is last to leave
+ * unlinks the name again.
+ *
+ * Every process maps the segment at the same address, the one the creator
+ * got, so whatever the creator leaves in it can point into it: a ring and
+ * its buffers, say, exactly as they would be laid out in private memory.
+ * An attacher asks for that address with MAP_FIXED_NOREPLACE and gives up
+ * if something of its own is already there, which with address space
+ * randomization is rare, rather than map the segment anywhere else.
+ *
+ * The creator also records a key, a short string describing the
+ * contents, and a process that attaches with a different key is turned
+ * away, so two sides started with settings that don't fit together fail
+ * at once instead of misreading each other's memory. Anything shared in
+ * the segment that locks or waits has to be process-shared: semaphores
+ * with a pshared of 1, mutexes with PTHREAD_PROCESS_SHARED, and no private
+ * futexes.
+ */
+
+#ifndef _SHM_H
+#define _SHM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define SHM_MAGIC 0x73686d6368616e31ull     // "shmchan1"
+#define SHM_KEY_LENGTH 192
+#define SHM_POLL_US 1000
+
+typedef struct {
+    uint64_t magic;
+    atomic_int ready;
+    atomic_int attached;
+    atomic_int left;
+    int processes;
+    uintptr_t base;             // where every process maps the segment
+    size_t size;
+    char key[SHM_KEY_LENGTH];
+} shmHeader;
+
+typedef struct {
+    char name[256];             // with the leading slash shm_open wants
+    shmHeader* header;
+    size_t size;
+    bool creator;
+    bool last;                  // was the last to leave, and unlinks the name
+} shmSegment;
+
+// the header takes up whole cache lines, so the data after it starts on one
+#define SHM_HEADER_SIZE ((sizeof(shmHeader) + CACHE_LINE_SIZE - 1) & ~(size_t) (CACHE_LINE_SIZE - 1))
+
+static inline void* ShmData(const shmSegment* s)
+{
+    return (char*) s->header + SHM_HEADER_SIZE;
+}
+
+/**
+ * ShmAttach
+ * ---------
+ * Opens the segment called name, with or without its leading slash, with
+ * size bytes after the header, for one of the given number of processes.
+ * Returns true in the process that created it, which must fill it in and
+ * then call ShmReady; any other returns once the creator has done so.
+ * Exits if the segment cannot be had, was made with a different key, or
+ * already has all its processes.
+ */
+
+static inline bool ShmAttach(shmSegment* s, const char* name, size_t size, const char* key, int processes)
+{
+    struct stat st;
+    shmHeader* header;
+    int fd;
+
+    memset(s, 0, sizeof(*s));
+    snprintf(s->name, sizeof(s->name), "%s%s", name[0] == '/' ? "" : "/", name);
+    name = s->name;
+    s->size = SHM_HEADER_SIZE + size;
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0) {
+        s->creator = true;
+        if (ftruncate(fd, (off_t) s->size) != 0 ||
+            (s->header = (shmHeader*) mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+            printf("ERROR: cannot size or map shared memory segment '%s'\n", name);
+            shm_unlink(name);
+            exit(1);
+        }
+        close(fd);
+        s->header->magic = SHM_MAGIC;
+        s->header->processes = processes;
+        s->header->base = (uintptr_t) s->header;
+        s->header->size = s->size;
+        snprintf(s->header->key, sizeof(s->header->key), "%s", key);
+        atomic_init(&s->header->left, 0);
+        atomic_init(&s->header->attached, 1);
+        atomic_init(&s->header->ready, 0);
+        return true;
+    }
+    if (errno != EEXIST || (fd = shm_open(name, O_RDWR, 0600)) < 0) {
+        printf("ERROR: cannot open shared memory segment '%s'\n", name);
+        exit(1);
+    }
+
+    // the creator may not have sized it yet, let alone filled it in
+    while (fstat(fd, &st) == 0 && (size_t) st.st_size < sizeof(shmHeader)) usleep(SHM_POLL_US);
+    header = (shmHeader*) mmap(NULL, sizeof(shmHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        printf("ERROR: cannot map shared memory segment '%s'\n", name);
+        exit(1);
+    }
+    while (atomic_load(&header->ready) == 0) usleep(SHM_POLL_US);
+    if (header->magic != SHM_MAGIC || header->size != s->size || strcmp(header->key, key) != 0) {
+        printf("ERROR: shared memory segment '%s' was set up as '%s', not '%s'\n", name,
+               header->magic == SHM_MAGIC ? header->key : "something else", key);
+        exit(1);
+    }
+    s->header = (shmHeader*) mmap((void*) header->base, s->size, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (s->header != (shmHeader*) header->base) {
+        printf("ERROR: cannot map shared memory segment '%s' at %p, where its other processes have it\n", name,
+               (void*) header->base);
+        exit(1);
+    }
+    munmap(header, sizeof(shmHeader));
+    close(fd);
+    if (atomic_fetch_add(&s->header->attached, 1) >= s->header->processes) {
+        printf("ERROR: shared memory segment '%s' already has its %d processes; remove it if it is stale\n",
+               name, s->header->processes);
+        exit(1);
+    }
+    return false;
+}
+
+// the creator has filled the segment in
+static inline void ShmReady(shmSegment* s)
+{
+    atomic_store(&s->header->ready, 1);
+}
+
+// waits for every process to have attached
+static inline void ShmAwaitPeers(shmSegment* s)
+{
+    while (atomic_load(&s->header->attached) < s->header->processes) usleep(SHM_POLL_US);
+}
+
+/**
+ * ShmLeave
+ * --------
+ * Announces that this process is done with the segment. Returns whether
+ * it was the last one, which may then tear down what is in it before
+ * ShmDetach.
+ */
+
+static inline bool ShmLeave(shmSegment* s)
+{
+    s->last = atomic_fetch_add(&s->header->left, 1) + 1 == s->header->processes;
+    return s->last;
+}
+
+static inline void ShmDetach(shmSegment* s)
+{
+    munmap(s->header, s->size);
+    if (s->last) shm_unlink(s->name);
+    s->header = NULL;
+}
+
+#endif
@@ -0,0 +1,684 @@
+/**
+ * sweep.c
+ * -------
+ * A scalability sweep over both examples. It runs readerWriter and
+ * sellTickets as benchmarks (-B) over a matrix of configurations:
+ *
+ *   readerWriter  every count of writers and of readers in the thread list,
+ *                 every capacity in the capacity list and every batch size
+ *                 up to it, on one transport (mpmc unless -t says otherwise)
+ *   sellTickets   every count of sellers in the thread list with every lock
+ *                 strategy of locks.h, or the ones -l lists
+ *
+ * Each point is run several times (-R), each time as a fresh process, and
+ * the reported throughput of every run goes into the point's median and
+ * standard deviation. Around every run the sweep opens perf_event_open
+ * counters on the child: cache misses, context switches and CPU
+ * migrations over all of its threads. The counters are opened before the
+ * program is exec'd and only start counting at the exec itself, so they
+ * see nothing of the sweep. Counters the kernel won't open, for lack of a
+ * PMU or of permission (see /proc/sys/kernel/perf_event_paranoid), are left
+ * out, and the sweep carries on with the throughput alone.
+ *
+ * Every point is printed as it completes, and the whole matrix goes to a
+ * CSV file (-o) with one row per point and, with -J, to a JSON file, ready
+ * to plot throughput against cores. The programs are found by path (-p and
+ * -q), so the sweep measures whatever build of them is given. A run that
+ * takes longer than the timeout (-x) is killed and counted as failed, which
+ * keeps a spinning lock on too few CPUs from stalling the whole sweep.
+ *
+ * Settings can come from the SW_* environment variables in envOptions as
+ * well, as in the examples themselves.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "config.h"
+#include "locks.h"
+
+#define MAX_LIST 32             // values in one list option
+#define MAX_REPEATS 100
+#define DEFAULT_REPEATS 5
+#define DEFAULT_OPS 200000
+#define DEFAULT_TIMEOUT 60
+#define MAX_TIMEOUT 86400
+#define MAX_THREADS 1024
+#define MAX_CAPACITY 65536
+#define MAX_ARGS 32
+#define OUTPUT_LIMIT (1 << 20)  // bytes of a run's output kept for parsing
+
+typedef enum {
+    COUNTER_CACHE_MISSES,
+    COUNTER_CONTEXT_SWITCHES,
+    COUNTER_CPU_MIGRATIONS,
+    NUM_COUNTERS
+} counterKind;
+
+static const char* const counterNames[NUM_COUNTERS] = {"cache_misses", "context_switches", "cpu_migrations"};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} counterEvents[NUM_COUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS}
+};
+
+typedef struct {
+    int values[MAX_LIST];
+    int n;
+} intList;
+
+typedef struct {
+    const char* readerWriter;   // the programs' paths
+    const char* sellTickets;
+    bool runReaderWriter;
+    bool runSellTickets;
+    intList threads;
+    intList capacities;
+    intList batches;
+    const char* transport;
+    const char* mode;           // sellTickets' -m
+    int locks[NUM_LOCK_KINDS];
+    int numLocks;
+    int repeats;
+    long ops;
+    int timeout;                // seconds per run
+    const char* csvFile;
+    const char* jsonFile;
+} sweepConfig;
+
+/**
+ * One point of the matrix: which program, with what settings, and what
+ * its runs measured. A run that failed has a NaN throughput; a counter
+ * that could not be opened has counted[k] false.
+ */
+
+typedef struct {
+    const char* program;        // "readerWriter" or "sellTickets"
+    const char* variant;        // the transport or lock strategy
+    int producers;              // writers, or sellers
+    int consumers;              // readers, or 0
+    int capacity;               // 0 for sellTickets
+    int batch;
+    int runs;
+    int failed;
+    double throughput[MAX_REPEATS];
+    uint64_t counts[NUM_COUNTERS][MAX_REPEATS];
+    bool counted[NUM_COUNTERS];
+    double median;
+    double stddev;
+    double counterMedian[NUM_COUNTERS];
+} sweepPoint;
+
+static const envOption envOptions[] = {
+    {"SW_READER_WRITER", 'p'},
+    {"SW_SELL_TICKETS", 'q'},
+    {"SW_WORKLOAD", 'w'},
+    {"SW_THREADS", 'T'},
+    {"SW_CAPACITIES", 'c'},
+    {"SW_BATCHES", 'b'},
+    {"SW_TRANSPORT", 't'},
+    {"SW_MODE", 'm'},
+    {"SW_LOCKS", 'l'},
+    {"SW_REPEATS", 'R'},
+    {"SW_OPS", 'n'},
+    {"SW_TIMEOUT", 'x'},
+    {"SW_CSV", 'o'},
+    {"SW_JSON", 'J'}
+};
+
+static void SweepReaderWriter(const sweepConfig* config, FILE* csv, FILE* json, bool* first);
+static void SweepSellTickets(const sweepConfig* config, FILE* csv, FILE* json, bool* first);
+static void RunPoint(const sweepConfig* config, sweepPoint* point, char* const* args, const char* section);
+static bool RunOnce(const sweepConfig* config, char* const* args, const char* section, double* throughput,
+                    uint64_t* counts, bool* counted);
+static int OpenCounter(counterKind kind, pid_t pid);
+static double ParseThroughput(const char* output, const char* section);
+static void Summarize(sweepPoint* point);
+static double Median(double* values, int n);
+static int CompareDoubles(const void* a, const void* b);
+static void WritePoint(const sweepPoint* point, FILE* csv, FILE* json, bool* first);
+static void ParseList(const char* arg, const char* what, intList* list, long min, long max);
+static void DefaultThreads(intList* list);
+static void Usage(const char* prog);
+static void ApplyOption(void* ctx, int opt, const char* arg);
+
+/**
+ * Sets up the matrix from the options, opens the output files and runs
+ * each workload's part of the sweep in turn.
+ */
+
+int main(int argc, char **argv)
+{
+    FILE *csv, *json = NULL;
+    bool first = true;
+    int opt, i;
+    sweepConfig config = {
+        .readerWriter = "./readerWriter",
+        .sellTickets = "./sellTickets",
+        .runReaderWriter = true,
+        .runSellTickets = true,
+        .capacities = {{1, 16, 256, 4096, 65536}, 5},
+        .batches = {{1, 16, 256}, 3},
+        .transport = "mpmc",
+        .mode = "lock",
+        .repeats = DEFAULT_REPEATS,
+        .ops = DEFAULT_OPS,
+        .timeout = DEFAULT_TIMEOUT,
+        .csvFile = "sweep.csv"
+    };
+
+    static const struct option longOptions[] = {
+        {"reader-writer", required_argument, NULL, 'p'},
+        {"sell-tickets", required_argument, NULL, 'q'},
+        {"workload", required_argument, NULL, 'w'},
+        {"threads", required_argument, NULL, 'T'},
+        {"capacities", required_argument, NULL, 'c'},
+        {"batches", required_argument, NULL, 'b'},
+        {"transport", required_argument, NULL, 't'},
+        {"mode", required_argument, NULL, 'm'},
+        {"locks", required_argument, NULL, 'l'},
+        {"repeats", required_argument, NULL, 'R'},
+        {"ops", required_argument, NULL, 'n'},
+        {"timeout", required_argument, NULL, 'x'},
+        {"csv", required_argument, NULL, 'o'},
+        {"json", required_argument, NULL, 'J'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    DefaultThreads(&config.threads);
+    for (i = 0; i < NUM_LOCK_KINDS; i++) config.locks[i] = i;
+    config.numLocks = NUM_LOCK_KINDS;
+
+    ApplyEnvironment(envOptions, sizeof(envOptions) / sizeof(envOptions[0]), ApplyOption, &config);
+    while ((opt = getopt_long(argc, argv, "p:q:w:T:c:b:t:m:l:R:n:x:o:J:h", longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            Usage(argv[0]);
+            exit(0);
+        case '?':
+            Usage(argv[0]);
+            exit(1);
+        default:
+            ApplyOption(&config, opt, optarg);
+        }
+    }
+
+    if ((csv = fopen(config.csvFile, "w")) == NULL) {
+        printf("ERROR: cannot open CSV file '%s'\n", config.csvFile);
+        exit(1);
+    }
+    fprintf(csv, "program,variant,producers,consumers,capacity,batch,runs,failed,median_ops_per_s,stddev_ops_per_s");
+    for (i = 0; i < NUM_COUNTERS; i++) fprintf(csv, ",%s", counterNames[i]);
+    fprintf(csv, "\n");
+    if (config.jsonFile != NULL) {
+        if ((json = fopen(config.jsonFile, "w")) == NULL) {
+            printf("ERROR: cannot open JSON file '%s'\n", config.jsonFile);
+            exit(1);
+        }
+        fprintf(json, "{\n  \"program\": \"sweep\", \"repeats\": %d, \"ops\": %ld, \"cpus\": %d,\n  \"points\": [\n",
+                config.repeats, config.ops, OnlineCpus());
+    }
+
+    // a child that dies without reading all its output must not take the sweep with it
+    signal(SIGPIPE, SIG_IGN);
+    if (config.runReaderWriter) SweepReaderWriter(&config, csv, json, &first);
+    if (config.runSellTickets) SweepSellTickets(&config, csv, json, &first);
+
+    fclose(csv);
+    if (json != NULL) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    printf("All done!\n");
+    return 0;
+}
+
+static void Usage(const char* prog)
+{
+    printf("usage: %s [-p readerWriter] [-q sellTickets] [-w both|readerWriter|sellTickets]\n", prog);
+    printf("       [-T threads,...] [-c capacities,...] [-b batches,...] [-t transport]\n");
+    printf("       [-m mode] [-l locks,...] [-R repeats] [-n ops] [-x seconds] [-o file] [-J file]\n");
+    printf("  -p, --reader-writer  path of the readerWriter program (default ./readerWriter)\n");
+    printf("  -q, --sell-tickets   path of the sellTickets program (default ./sellTickets)\n");
+    printf("  -w, --workload    which programs to sweep (default both)\n");
+    printf("  -T, --threads     thread counts to try, for writers and readers alike and for\n");
+    printf("                    sellers (default 1, 2, 4, ... up to the online CPUs)\n");
+    printf("  -c, --capacities  readerWriter buffer capacities, powers of two up to %d\n", MAX_CAPACITY);
+    printf("                    (default 1,16,256,4096,65536)\n");
+    printf("  -b, --batches     readerWriter batch sizes; those above a capacity are skipped\n");
+    printf("                    (default 1,16,256)\n");
+    printf("  -t, --transport   readerWriter transport (default mpmc; spsc only runs 1:1 points)\n");
+    printf("  -m, --mode        sellTickets mode (default lock)\n");
+    printf("  -l, --locks       sellTickets lock strategies (default all of them)\n");
+    printf("  -R, --repeats     runs per point, for the median and deviation (default %d)\n", DEFAULT_REPEATS);
+    printf("  -n, --ops         items or tickets per run (default %d)\n", DEFAULT_OPS);
+    printf("  -x, --timeout     seconds before a run is killed and counted as failed (default %d)\n",
+           DEFAULT_TIMEOUT);
+    printf("  -o, --csv         where to write the results as CSV (default sweep.csv)\n");
+    printf("  -J, --json        also write them to this file as JSON\n");
+    printf("Each option can also be set with the environment variable listed here;\n");
+    printf("the command line wins when both are given:\n ");
+    for (size_t i = 0; i < sizeof(envOptions) / sizeof(envOptions[0]); i++)
+        printf(" %s (-%c)", envOptions[i].name, envOptions[i].opt);
+    printf("\n");
+}
+
+/**
+ * ApplyOption
+ * -----------
+ * Applies one setting, from the command line or the environment, to the
+ * sweepConfig in ctx.
+ */
+
+static void ApplyOption(void* ctx, int opt, const char* arg)
+{
+    sweepConfig* config = (sweepConfig*) ctx;
+    char names[256], *name, *save;
+    int kind, i;
+
+    switch (opt) {
+    case 'p':
+        config->readerWriter = arg;
+        break;
+    case 'q':
+        config->sellTickets = arg;
+        break;
+    case 'w':
+        config->runReaderWriter = strcmp(arg, "both") == 0 || strcmp(arg, "readerWriter") == 0;
+        config->runSellTickets = strcmp(arg, "both") == 0 || strcmp(arg, "sellTickets") == 0;
+        if (!config->runReaderWriter && !config->runSellTickets) {
+            printf("ERROR: unknown workload '%s'\n", arg);
+            exit(1);
+        }
+        break;
+    case 'T':
+        ParseList(arg, "threads", &config->threads, 1, MAX_THREADS);
+        break;
+    case 'c':
+        ParseList(arg, "capacity", &config->capacities, 1, MAX_CAPACITY);
+        for (i = 0; i < config->capacities.n; i++) {
+            if ((config->capacities.values[i] & (config->capacities.values[i] - 1)) != 0) {
+                printf("ERROR: capacity must be a power of two, got %d\n", config->capacities.values[i]);
+                exit(1);
+            }
+        }
+        break;
+    case 'b':
+        ParseList(arg, "batch", &config->batches, 1, 1024);
+        break;
+    case 't':
+        config->transport = arg;
+        break;
+    case 'm':
+        config->mode = arg;
+        break;
+    case 'l':
+        snprintf(names, sizeof(names), "%s", arg);
+        config->numLocks = 0;
+        for (name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+            if ((kind = LockKindFromName(name)) < 0) {
+                printf("ERROR: unknown lock strategy '%s'\n", name);
+                exit(1);
+            }
+            if (config->numLocks < NUM_LOCK_KINDS) config->locks[config->numLocks++] = kind;
+        }
+        break;
+    case 'R':
+        config->repeats = (int) ParseLong(arg, "repeats", 1, MAX_REPEATS);
+        break;
+    case 'n':
+        config->ops = ParseLong(arg, "ops", 1, INT32_MAX);
+        break;
+    case 'x':
+        config->timeout = (int) ParseLong(arg, "timeout", 1, MAX_TIMEOUT);
+        break;
+    case 'o':
+        config->csvFile = arg;
+        break;
+    case 'J':
+        config->jsonFile = arg;
+        break;
+    }
+}
+
+/**
+ * ParseList
+ * ---------
+ * Parses a comma-separated list of whole numbers, each between min and max.
+ */
+
+static void ParseList(const char* arg, const char* what, intList* list, long min, long max)
+{
+    char values[256], *value, *save;
+
+    snprintf(values, sizeof(values), "%s", arg);
+    list->n = 0;
+    for (value = strtok_r(values, ",", &save); value != NULL; value = strtok_r(NULL, ",", &save)) {
+        if (list->n == MAX_LIST) {
+            printf("ERROR: at most %d values of %s\n", MAX_LIST, what);
+            exit(1);
+        }
+        list->values[list->n++] = (int) ParseLong(value, what, min, max);
+    }
+    if (list->n == 0) {
+        printf("ERROR: no values of %s given\n", what);
+        exit(1);
+    }
+}
+
+// 1, 2, 4, ... and the number of online CPUs itself if it isn't a power of two
+static void DefaultThreads(intList* list)
+{
+    int cpus = OnlineCpus(), n;
+
+    list->n = 0;
+    for (n = 1; n < cpus && list->n < MAX_LIST - 1; n *= 2) list->values[list->n++] = n;
+    list->values[list->n++] = cpus;
+}
+
+/**
+ * SweepReaderWriter
+ * -----------------
+ * One point for each count of writers and of readers, each capacity and
+ * each batch that fits in it.
+ */
+
+static void SweepReaderWriter(const sweepConfig* config, FILE* csv, FILE* json, bool* first)
+{
+    char writers[16], readers[16], capacity[16], batch[16], ops[24];
+    char* args[] = {(char*) config->readerWriter, "-B", "-t", (char*) config->transport, "-w", writers,
+                    "-r", readers, "-c", capacity, "-b", batch, "-n", ops, NULL};
+    sweepPoint point;
+    int w, r, c, b;
+
+    snprintf(ops, sizeof(ops), "%ld", config->ops);
+    for (w = 0; w < config->threads.n; w++) {
+        for (r = 0; r < config->threads.n; r++) {
+            if (strcmp(config->transport, "spsc") == 0 &&
+                (config->threads.values[w] != 1 || config->threads.values[r] != 1))
+                continue;
+            for (c = 0; c < config->capacities.n; c++) {
+                for (b = 0; b < config->batches.n; b++) {
+                    if (config->batches.values[b] > config->capacities.values[c]) continue;
+                    memset(&point, 0, sizeof(point));
+                    point.program = "readerWriter";
+                    point.variant = config->transport;
+                    point.producers = config->threads.values[w];
+                    point.consumers = config->threads.values[r];
+                    point.capacity = config->capacities.values[c];
+                    point.batch = config->batches.values[b];
+                    snprintf(writers, sizeof(writers), "%d", point.producers);
+                    snprintf(readers, sizeof(readers), "%d", point.consumers);
+                    snprintf(capacity, sizeof(capacity), "%d", point.capacity);
+                    snprintf(batch, sizeof(batch), "%d", point.batch);
+                    RunPoint(config, &point, args, "readers (ChannelGet)");
+                    WritePoint(&point, csv, json, first);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * SweepSellTickets
+ * ----------------
+ * One point for each count of sellers with each lock strategy.
+ */
+
+static void SweepSellTickets(const sweepConfig* config, FILE* csv, FILE* json, bool* first)
+{
+    char sellers[16], ops[24];
+    char* args[] = {(char*) config->sellTickets, "-B", "-m", (char*) config->mode, "-l", NULL, "-s", sellers,
+                    "-n", ops, NULL};
+    sweepPoint point;
+    int s, l;
+
+    snprintf(ops, sizeof(ops), "%ld", config->ops);
+    for (s = 0; s < config->threads.n; s++) {
+        for (l = 0; l < config->numLocks; l++) {
+            memset(&point, 0, sizeof(point));
+            point.program = "sellTickets";
+            point.variant = lockNames[config->locks[l]];
+            point.producers = config->threads.values[s];
+            point.batch = 1;
+            args[5] = (char*) point.variant;
+            snprintf(sellers, sizeof(sellers), "%d", point.producers);
+            RunPoint(config, &point, args, "benchmark: sellTickets");
+            WritePoint(&point, csv, json, first);
+        }
+    }
+}
+
+/**
+ * RunPoint
+ * --------
+ * Runs one point config->repeats times and sums it up. section is the
+ * heading in the program's report whose throughput is the one to take.
+ */
+
+static void RunPoint(const sweepConfig* config, sweepPoint* point, char* const* args, const char* section)
+{
+    bool counted[NUM_COUNTERS];
+    uint64_t counts[NUM_COUNTERS];
+    int run, k;
+
+    for (k = 0; k < NUM_COUNTERS; k++) point->counted[k] = true;
+    for (run = 0; run < config->repeats; run++) {
+        if (!RunOnce(config, args, section, &point->throughput[run], counts, counted)) point->failed++;
+        for (k = 0; k < NUM_COUNTERS; k++) {
+            point->counts[k][run] = counts[k];
+            point->counted[k] = point->counted[k] && counted[k];
+        }
+        point->runs++;
+    }
+    Summarize(point);
+
+    printf("%s %s %d:%d capacity %d batch %d: %.0f ops/s median, %.1f%% stddev", point->program, point->variant,
+           point->producers, point->consumers, point->capacity, point->batch, point->median,
+           point->median > 0 ? 100 * point->stddev / point->median : 0.0);
+    for (k = 0; k < NUM_COUNTERS; k++)
+        if (point->counted[k]) printf(", %s %.0f", counterNames[k], point->counterMedian[k]);
+    if (point->failed > 0) printf(" (%d of %d runs failed)", point->failed, point->runs);
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * RunOnce
+ * -------
+ * Runs the program in args once, as a child whose output comes back
+ * through a pipe. The child waits on a second pipe until the counters are
+ * open on it, then execs; enable_on_exec starts them at that moment and
+ * inherit makes them count every thread the program creates. Returns false
+ * if the run was killed, exited with an error or printed no throughput, in
+ * which case *throughput is NaN.
+ */
+
+static bool RunOnce(const sweepConfig* config, char* const* args, const char* section, double* throughput,
+                    uint64_t* counts, bool* counted)
+{
+    int out[2], go[2], fds[NUM_COUNTERS], status, k;
+    char *output, ready = 0;
+    size_t length = 0;
+    ssize_t got;
+    pid_t child;
+
+    *throughput = NAN;
+    if (pipe(out) != 0 || pipe(go) != 0) {
+        printf("ERROR: cannot create a pipe for a run\n");
+        exit(1);
+    }
+    if ((child = fork()) < 0) {
+        printf("ERROR: cannot fork a run\n");
+        exit(1);
+    }
+    if (child == 0) {
+        close(out[0]);
+        close(go[1]);
+        dup2(out[1], STDOUT_FILENO);
+        close(out[1]);
+        if (read(go[0], &ready, 1) != 1) _exit(127);
+        close(go[0]);
+        // the alarm survives the exec and ends a run that hangs
+        alarm(config->timeout);
+        execv(args[0], args);
+        fprintf(stderr, "ERROR: cannot run '%s'\n", args[0]);
+        _exit(127);
+    }
+    close(out[1]);
+    close(go[0]);
+
+    for (k = 0; k < NUM_COUNTERS; k++) fds[k] = OpenCounter((counterKind) k, child);
+    if (write(go[1], &ready, 1) != 1) {
+        printf("ERROR: cannot start a run\n");
+        exit(1);
+    }
+    close(go[1]);
+
+    output = (char*) malloc(OUTPUT_LIMIT + 1);
+    while ((got = read(out[0], output + length, OUTPUT_LIMIT - length)) > 0)
+        if ((length += got) == OUTPUT_LIMIT) break;
+    output[length] = '\0';
+    close(out[0]);
+    waitpid(child, &status, 0);
+
+    for (k = 0; k < NUM_COUNTERS; k++) {
+        counts[k] = 0;
+        counted[k] = fds[k] >= 0 && read(fds[k], counts + k, sizeof(counts[k])) == sizeof(counts[k]);
+        if (fds[k] >= 0) close(fds[k]);
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 127) *throughput = ParseThroughput(output, section);
+    free(output);
+    return !isnan(*throughput);
+}
+
+/**
+ * OpenCounter
+ * -----------
+ * Opens one counter on the child, disabled until it execs. Kernel time is
+ * left out when the kernel will only count user space. Returns -1 if the
+ * counter cannot be had at all.
+ */
+
+static int OpenCounter(counterKind kind, pid_t pid)
+{
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counterEvents[kind].type;
+    attr.config = counterEvents[kind].config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    fd = (int) syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+    if (fd < 0) {
+        attr.exclude_kernel = 1;
+        fd = (int) syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+    }
+    return fd;
+}
+
+// the "throughput" figure that follows the first line starting with section, or NaN
+static double ParseThroughput(const char* output, const char* section)
+{
+    const char* at = strstr(output, section);
+    double value;
+
+    if (at == NULL || (at = strstr(at, "throughput")) == NULL) return NAN;
+    return sscanf(at, "throughput %lf", &value) == 1 ? value : NAN;
+}
+
+/**
+ * Summarize
+ * ---------
+ * The median and sample standard deviation of the runs that succeeded,
+ * and the median of each counter over all of them.
+ */
+
+static void Summarize(sweepPoint* point)
+{
+    double values[MAX_REPEATS], sum = 0, squares = 0, mean;
+    int i, k, n = 0;
+
+    for (i = 0; i < point->runs; i++)
+        if (!isnan(point->throughput[i])) values[n++] = point->throughput[i];
+    for (i = 0; i < n; i++) sum += values[i];
+    mean = n > 0 ? sum / n : 0;
+    for (i = 0; i < n; i++) squares += (values[i] - mean) * (values[i] - mean);
+    point->median = Median(values, n);
+    point->stddev = n > 1 ? sqrt(squares / (n - 1)) : 0;
+    for (k = 0; k < NUM_COUNTERS; k++) {
+        for (i = 0; i < point->runs; i++) values[i] = (double) point->counts[k][i];
+        point->counterMedian[k] = Median(values, point->runs);
+    }
+}
+
+static double Median(double* values, int n)
+{
+    if (n == 0) return 0;
+    qsort(values, n, sizeof(double), CompareDoubles);
+    return n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+static int CompareDoubles(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * WritePoint
+ * ----------
+ * Appends one point to the CSV file, and to the JSON file if there is
+ * one. A counter that could not be opened is an empty CSV field and a JSON
+ * null.
+ */
+
+static void WritePoint(const sweepPoint* point, FILE* csv, FILE* json, bool* first)
+{
+    int k;
+
+    fprintf(csv, "%s,%s,%d,%d,%d,%d,%d,%d,%.0f,%.0f", point->program, point->variant, point->producers,
+            point->consumers, point->capacity, point->batch, point->runs, point->failed, point->median, point->stddev);
+    for (k = 0; k < NUM_COUNTERS; k++) {
+        if (point->counted[k]) fprintf(csv, ",%.0f", point->counterMedian[k]);
+        else fprintf(csv, ",");
+    }
+    fprintf(csv, "\n");
+    fflush(csv);
+    if (json == NULL) return;
+
+    fprintf(json, "%s    {\"program\": \"%s\", \"variant\": \"%s\", \"producers\": %d, \"consumers\": %d, "
+                  "\"capacity\": %d, \"batch\": %d, \"runs\": %d, \"failed\": %d, \"median_ops_per_s\": %.0f, "
+                  "\"stddev_ops_per_s\": %.0f",
+            *first ? "" : ",\n", point->program, point->variant, point->producers, point->consumers,
+            point->capacity, point->batch, point->runs, point->failed, point->median, point->stddev);
+    for (k = 0; k < NUM_COUNTERS; k++) {
+        if (point->counted[k]) fprintf(json, ", \"%s\": %.0f", counterNames[k], point->counterMedian[k]);
+        else fprintf(json, ", \"%s\": null", counterNames[k]);
+    }
+    fprintf(json, "}");
+    *first = false;
+}
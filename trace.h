@@ -0,0 +1,331 @@
+/**
+ * trace.h
+ * -------
+ * Low-overhead event tracing for the examples. Calling printf() from a hot
+ * loop, let alone from inside a critical section, takes stdio's own lock
+ * and makes the output path a second point of serialization. Instead each
+ * thread gets its own preallocated traceRing and TraceRecord just stores a
+ * fixed-size event (thread, timestamp, slot, value) into it. The rings are
+ * emptied either when the threads are done (TracerFinish) or all along by
+ * a background logger thread, and the events are written out merged in
+ * timestamp order, as text, as binary records, or not at all.
+ *
+ * Each ring has exactly one producer, its thread, and one consumer,
+ * whoever is draining, so the same acquire/release head and tail scheme
+ * as an SPSC queue is all it needs. A thread never waits on a full ring:
+ * the event is dropped and counted instead, and TracerFinish reports how
+ * many were lost.
+ *
+ * The binary format is a traceFileHeader, one traceThreadInfo per thread
+ * and then a stream of traceEvent records. Since version 2 the header also
+ * names the program that wrote the trace and the seed its run was started
+ * with (see TracerDescribe), so that traceReport can tell what the events
+ * mean and a run can be repeated with the same input.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "bench.h"
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#define TRACE_RING_EVENTS (1 << 16)
+#define TRACE_LOGGER_PERIOD_US 1000
+#define TRACE_MAGIC "PTTR"
+#define TRACE_VERSION 2
+#define TRACE_NAME_LENGTH 32
+#define TRACE_PROGRAM_LENGTH 16
+#define TRACE_V1_HEADER_SIZE 16     // magic, version, numThreads and eventSize
+
+typedef enum {
+    TRACE_STDIO,        // no tracing; print each event as it happens, as the examples always have
+    TRACE_TEXT,
+    TRACE_BINARY,
+    TRACE_OFF
+} traceMode;
+
+typedef struct {
+    uint64_t timestamp; // ns since the tracer was set up
+    uint32_t thread;
+    uint32_t kind;      // meaning is up to the program
+    int64_t slot;
+    int64_t value;
+} traceEvent;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t numThreads;
+    uint32_t eventSize;
+    uint64_t seed;      // version 2 on
+    char program[TRACE_PROGRAM_LENGTH];
+} traceFileHeader;
+
+typedef struct {
+    uint32_t thread;
+    char name[TRACE_NAME_LENGTH];
+} traceThreadInfo;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t tail;  // stored by the recording thread
+    size_t cachedHead;
+    uint64_t dropped;
+    traceEvent* events;
+    uint32_t thread;
+    uint64_t startNs;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t head;  // stored by the drainer
+    char name[TRACE_NAME_LENGTH];
+} traceRing;
+
+typedef void (*traceFormatter)(FILE* out, const char* threadName, const traceEvent* event);
+
+typedef struct {
+    traceMode mode;
+    FILE* out;
+    traceRing* rings;
+    int numRings;
+    traceFormatter format;
+    const char* program;
+    uint64_t seed;
+    bool recording;     // text or binary: the rings are in use
+    uint64_t startNs;
+    bool useLogger;
+    atomic_bool stopLogger;
+    pthread_t logger;
+} tracer;
+
+static inline bool TraceModeFromName(const char* name, traceMode* mode)
+{
+    if (strcmp(name, "stdio") == 0) *mode = TRACE_STDIO;
+    else if (strcmp(name, "text") == 0) *mode = TRACE_TEXT;
+    else if (strcmp(name, "binary") == 0) *mode = TRACE_BINARY;
+    else if (strcmp(name, "off") == 0) *mode = TRACE_OFF;
+    else return false;
+    return true;
+}
+
+/**
+ * TracerInit
+ * ----------
+ * Allocates one ring per thread. The event arrays are written once here so
+ * their pages are already faulted in when the threads start recording.
+ * Rings are only set up for the text and binary modes; in the other modes
+ * TraceRecord sees a ring without events and does nothing.
+ */
+
+static inline void TracerInit(tracer* t, traceMode mode, FILE* out, int numThreads, traceFormatter format)
+{
+    int i;
+
+    memset(t, 0, sizeof(*t));
+    t->mode = mode;
+    t->out = out;
+    t->numRings = numThreads;
+    t->format = format;
+    t->startNs = NowNs();
+    atomic_init(&t->stopLogger, false);
+    t->rings = (traceRing*) aligned_alloc(CACHE_LINE_SIZE, numThreads * sizeof(traceRing));
+    memset(t->rings, 0, numThreads * sizeof(traceRing));
+    for (i = 0; i < numThreads; i++) {
+        traceRing* ring = t->rings + i;
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        ring->thread = i;
+        ring->startNs = t->startNs;
+        if (mode == TRACE_TEXT || mode == TRACE_BINARY) {
+            ring->events = (traceEvent*) malloc(TRACE_RING_EVENTS * sizeof(traceEvent));
+            memset(ring->events, 0, TRACE_RING_EVENTS * sizeof(traceEvent));
+        }
+    }
+    t->recording = mode == TRACE_TEXT || mode == TRACE_BINARY;
+}
+
+// what goes into a binary trace's header about the run
+static inline void TracerDescribe(tracer* t, const char* program, uint64_t seed)
+{
+    t->program = program;
+    t->seed = seed;
+}
+
+static inline traceRing* TraceRingFor(tracer* t, int thread, const char* name)
+{
+    traceRing* ring = t->rings + thread;
+    size_t length = strlen(name);
+
+    if (length >= sizeof(ring->name)) length = sizeof(ring->name) - 1;
+    memcpy(ring->name, name, length);
+    ring->name[length] = '\0';
+    return ring;
+}
+
+/**
+ * TraceRecordAt and TraceRecord
+ * -----------------------------
+ * Append one event to the calling thread's ring, stamped with the given
+ * time from NowNs or with the current time. Only ever called by the ring's
+ * own thread.
+ */
+
+static inline void TraceRecordAt(traceRing* ring, uint64_t ns, uint32_t kind, int64_t slot, int64_t value)
+{
+    size_t tail;
+    traceEvent* event;
+
+    if (ring->events == NULL) return;
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - ring->cachedHead == TRACE_RING_EVENTS) {
+        ring->cachedHead = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail - ring->cachedHead == TRACE_RING_EVENTS) {
+            ring->dropped++;
+            return;
+        }
+    }
+    event = ring->events + (tail & (TRACE_RING_EVENTS - 1));
+    event->timestamp = ns - ring->startNs;
+    event->thread = ring->thread;
+    event->kind = kind;
+    event->slot = slot;
+    event->value = value;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static inline void TraceRecord(traceRing* ring, uint32_t kind, int64_t slot, int64_t value)
+{
+    if (ring->events != NULL) TraceRecordAt(ring, NowNs(), kind, slot, value);
+}
+
+static inline int CompareEvents(const void* a, const void* b)
+{
+    const traceEvent* x = (const traceEvent*) a;
+    const traceEvent* y = (const traceEvent*) b;
+
+    if (x->timestamp != y->timestamp) return x->timestamp < y->timestamp ? -1 : 1;
+    return x->thread < y->thread ? -1 : x->thread > y->thread;
+}
+
+/**
+ * TracerDrain
+ * -----------
+ * Moves everything currently in the rings to the output, sorted by time.
+ * Events recorded while a drain is running are picked up by the next one,
+ * so with a background logger the output is in order within each pass.
+ * The drainer takes a snapshot of every tail first, so it knows how much
+ * room the merged copy needs.
+ */
+
+static inline void TracerDrain(tracer* t)
+{
+    size_t count = 0, i, head;
+    size_t* tails;
+    traceEvent* merged;
+    int r;
+
+    if (!t->recording) return;
+    tails = (size_t*) malloc(t->numRings * sizeof(size_t));
+    for (r = 0; r < t->numRings; r++) {
+        tails[r] = atomic_load_explicit(&t->rings[r].tail, memory_order_acquire);
+        count += tails[r] - atomic_load_explicit(&t->rings[r].head, memory_order_relaxed);
+    }
+    merged = (traceEvent*) malloc((count > 0 ? count : 1) * sizeof(traceEvent));
+    count = 0;
+    for (r = 0; r < t->numRings; r++) {
+        traceRing* ring = t->rings + r;
+        for (head = atomic_load_explicit(&ring->head, memory_order_relaxed); head != tails[r]; head++)
+            merged[count++] = ring->events[head & (TRACE_RING_EVENTS - 1)];
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+    }
+    qsort(merged, count, sizeof(traceEvent), CompareEvents);
+    if (t->mode == TRACE_BINARY) {
+        fwrite(merged, sizeof(traceEvent), count, t->out);
+    } else {
+        for (i = 0; i < count; i++) t->format(t->out, t->rings[merged[i].thread].name, merged + i);
+    }
+    free(merged);
+    free(tails);
+}
+
+static inline void* TraceLogger(void* arg)
+{
+    tracer* t = (tracer*) arg;
+
+    while (!atomic_load(&t->stopLogger)) {
+        usleep(TRACE_LOGGER_PERIOD_US);
+        TracerDrain(t);
+    }
+    return NULL;
+}
+
+/**
+ * TracerStart
+ * -----------
+ * Called once every thread's ring has been named and the run described:
+ * writes the binary header and, if asked for, starts the background
+ * logger.
+ */
+
+static inline void TracerStart(tracer* t, bool useLogger)
+{
+    traceFileHeader header;
+    traceThreadInfo info;
+    int i;
+
+    if (t->mode == TRACE_BINARY) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.numThreads = t->numRings;
+        header.eventSize = sizeof(traceEvent);
+        header.seed = t->seed;
+        if (t->program != NULL) strncpy(header.program, t->program, sizeof(header.program) - 1);
+        fwrite(&header, sizeof(header), 1, t->out);
+        for (i = 0; i < t->numRings; i++) {
+            memset(&info, 0, sizeof(info));
+            info.thread = i;
+            memcpy(info.name, t->rings[i].name, sizeof(info.name));
+            fwrite(&info, sizeof(info), 1, t->out);
+        }
+    }
+    if (useLogger && t->recording) {
+        t->useLogger = true;
+        pthread_create(&t->logger, NULL, TraceLogger, t);
+    }
+}
+
+/**
+ * TracerFinish
+ * ------------
+ * Called after the traced threads have been joined: stops the logger,
+ * writes out whatever is left and reports any events that were dropped.
+ */
+
+static inline void TracerFinish(tracer* t)
+{
+    uint64_t dropped = 0;
+    int i;
+
+    if (t->useLogger) {
+        atomic_store(&t->stopLogger, true);
+        pthread_join(t->logger, NULL);
+    }
+    TracerDrain(t);
+    fflush(t->out);
+    for (i = 0; i < t->numRings; i++) {
+        dropped += t->rings[i].dropped;
+        free(t->rings[i].events);
+    }
+    if (dropped > 0) fprintf(stderr, "trace: %llu events dropped on full rings\n", (unsigned long long) dropped);
+    free(t->rings);
+}
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * traceEvents.h
+ * -------------
+ * What readerWriter and sellTickets put into a traceEvent's kind, slot and
+ * value. The programs write their events with these and traceReport reads
+ * them back with the same, so neither side can change the encoding without
+ * the other.
+ *
+ * In readerWriter each handoff also says which link between stages it was
+ * on, in the kind's upper half, and its value carries the item's position
+ * in that link's channel above the item itself, so that traceReport can
+ * pair every write with the read that took the same item. The slot is the
+ * buffer the item went through.
+ *
+ * In sellTickets the value is the count the event is about (see
+ * saleEvent) and the slot says how many tickets a grant sold and, in
+ * events mode, for which event. Every customer is recorded too, with the
+ * tickets it wants, since those are what the run's seed decides.
+ */
+
+#ifndef _TRACE_EVENTS_H
+#define _TRACE_EVENTS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    EVENT_WRITE,
+    EVENT_READ
+} handoffEvent;
+
+#define HANDOFF_LINK_SHIFT 16
+#define HANDOFF_KIND_MASK 0xffff
+#define HANDOFF_ITEM_BITS 8
+
+static inline uint32_t HandoffKind(handoffEvent kind, uint32_t link)
+{
+    return (uint32_t) kind | link << HANDOFF_LINK_SHIFT;
+}
+
+static inline handoffEvent HandoffEventOf(uint32_t kind)
+{
+    return (handoffEvent) (kind & HANDOFF_KIND_MASK);
+}
+
+static inline uint32_t HandoffLink(uint32_t kind)
+{
+    return kind >> HANDOFF_LINK_SHIFT;
+}
+
+static inline int64_t HandoffValue(size_t pos, char item)
+{
+    return (int64_t) ((uint64_t) pos << HANDOFF_ITEM_BITS | (uint8_t) item);
+}
+
+static inline uint64_t HandoffPos(int64_t value)
+{
+    return (uint64_t) value >> HANDOFF_ITEM_BITS;
+}
+
+static inline char HandoffItem(int64_t value)
+{
+    return (char) (uint8_t) value;
+}
+
+typedef enum {
+    EVENT_SALE,         // value is the number of tickets left
+    EVENT_BLOCK_SALE,   // value is the number left in the seller's block
+    EVENT_SOLD_OUT,     // value is the number this seller sold
+    EVENT_GRANT,        // value is the number of tickets left, slot the number granted
+    EVENT_QUERY,        // value is the number of tickets a query saw left
+    EVENT_EVENT_GRANT,  // value is the number left for the event, slot SaleSlot(event, granted)
+    EVENT_CUSTOMER      // value is the number of tickets the customer wants; only traced
+} saleEvent;
+
+#define SALE_EVENT_SHIFT 32
+
+static inline int64_t SaleSlot(int event, int tickets)
+{
+    return (int64_t) event << SALE_EVENT_SHIFT | (uint32_t) tickets;
+}
+
+static inline int SaleSlotEvent(int64_t slot)
+{
+    return (int) (slot >> SALE_EVENT_SHIFT);
+}
+
+static inline int SaleSlotTickets(int64_t slot)
+{
+    return (int) (slot & 0xffffffff);
+}
+
+#endif
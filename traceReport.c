@@ -0,0 +1,624 @@
+/**
+ * traceReport.c
+ * -------------
+ * Turns the binary traces that readerWriter and sellTickets write with
+ * -T binary into reports. The trace header says which program wrote it
+ * and with what seed (see trace.h), and the events are read accordingly:
+ *
+ *   readerWriter  every write is paired with the read that took the same
+ *                 item, by the link between stages and the item's position
+ *                 in that link's channel, and the time between the two is
+ *                 the item's enqueue-to-dequeue latency, summed up per link
+ *                 as percentiles and a log2 histogram
+ *   sellTickets   the sales in the order they were made: each seller's
+ *                 share, how long the sellers kept the tickets to
+ *                 themselves before another got a turn, and a histogram
+ *                 of the gaps between one sale and the next
+ *
+ * Either way a timeline follows, one row per thread, showing when over
+ * the run each thread was busy handing off.
+ *
+ * Given two traces, say one from each of two builds run with the same -E
+ * seed, both are reported and then compared: the percentiles side by
+ * side, how much of the sale order the runs share, and whether they saw
+ * the same input at all. The input is what the seed decides, each
+ * writer's letters or each seller's quantities, so two runs with the same
+ * seed should match there however differently their threads interleaved.
+ *
+ * readerWriter stamps a write just before it hands the item over and a
+ * read just after it has the item, so the latency takes in any wait for
+ * room in the channel. A read stamped before its write, which a trace
+ * from before version 2 can have, is counted as early and taken to have
+ * a latency of 0. Those traces don't name their program either, which -p
+ * then has to.
+ *
+ * Settings can come from the TR_* environment variables in envOptions as
+ * well, as in the examples themselves.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include "config.h"
+#include "trace.h"
+#include "traceEvents.h"
+
+#define DEFAULT_WIDTH 64        // timeline columns
+#define MAX_WIDTH 512
+#define HISTOGRAM_BUCKETS 64
+#define HISTOGRAM_BAR 40
+#define MAX_LINKS 16
+
+typedef enum {
+    PROGRAM_UNKNOWN,
+    PROGRAM_READER_WRITER,
+    PROGRAM_SELL_TICKETS
+} traceProgram;
+
+static const char* const programNames[] = {"unknown", "readerWriter", "sellTickets"};
+
+typedef struct {
+    const char* path;
+    uint32_t version;
+    traceProgram program;
+    uint64_t seed;
+    int numThreads;
+    char (*names)[TRACE_NAME_LENGTH];
+    traceEvent* events;
+    size_t numEvents;
+    uint64_t endNs;             // the last event's timestamp
+    uint64_t** inputs;          // per thread, the input it saw, in order
+    size_t* numInputs;
+} traceFile;
+
+typedef struct {
+    uint64_t* samples;          // sorted
+    size_t count;
+} sampleSet;
+
+/**
+ * What one trace comes to, kept for the comparison: the latencies per link
+ * for readerWriter, the gaps between sales and the order of the sellers
+ * for sellTickets.
+ */
+
+typedef struct {
+    int numLinks;
+    sampleSet links[MAX_LINKS];
+    sampleSet gaps;
+    uint32_t* order;            // the thread of each sale, in order
+    size_t numSales;
+} traceSummary;
+
+typedef struct {
+    int width;
+    traceProgram program;       // -p: for traces that don't say
+} reportConfig;
+
+// one handoff of an item, for pairing writes with reads
+typedef struct {
+    uint32_t link;
+    uint64_t pos;
+    uint64_t timestamp;
+} handoff;
+
+static const envOption envOptions[] = {
+    {"TR_WIDTH", 'w'},
+    {"TR_PROGRAM", 'p'}
+};
+
+static void LoadTrace(traceFile* trace, const char* path, const reportConfig* config);
+static void CollectInputs(traceFile* trace);
+static void ReportReaderWriter(const traceFile* trace, traceSummary* summary);
+static void ReportSellTickets(const traceFile* trace, traceSummary* summary);
+static void PrintTimeline(const traceFile* trace, int width);
+static void PrintSamples(const char* label, const sampleSet* set);
+static void PrintHistogram(const sampleSet* set);
+static void Compare(const traceFile* a, const traceSummary* x, const traceFile* b, const traceSummary* y);
+static uint64_t Percentile(const sampleSet* set, double quantile);
+static int CompareHandoffs(const void* a, const void* b);
+static void Usage(const char* prog);
+static void ApplyOption(void* ctx, int opt, const char* arg);
+
+/**
+ * Reports each trace given and, if there are two, compares them.
+ */
+
+int main(int argc, char **argv)
+{
+    traceFile traces[2];
+    traceSummary summaries[2];
+    int opt, numTraces, i;
+    reportConfig config = {
+        .width = DEFAULT_WIDTH,
+        .program = PROGRAM_UNKNOWN
+    };
+
+    static const struct option longOptions[] = {
+        {"width", required_argument, NULL, 'w'},
+        {"program", required_argument, NULL, 'p'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    ApplyEnvironment(envOptions, sizeof(envOptions) / sizeof(envOptions[0]), ApplyOption, &config);
+    while ((opt = getopt_long(argc, argv, "w:p:h", longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            Usage(argv[0]);
+            exit(0);
+        case '?':
+            Usage(argv[0]);
+            exit(1);
+        default:
+            ApplyOption(&config, opt, optarg);
+        }
+    }
+    numTraces = argc - optind;
+    if (numTraces < 1 || numTraces > 2) {
+        Usage(argv[0]);
+        exit(1);
+    }
+
+    memset(summaries, 0, sizeof(summaries));
+    for (i = 0; i < numTraces; i++) {
+        LoadTrace(traces + i, argv[optind + i], &config);
+        printf("trace %s: %s, seed %llu, version %u, %d threads, %zu events over %.3f ms\n", traces[i].path,
+               programNames[traces[i].program], (unsigned long long) traces[i].seed, traces[i].version,
+               traces[i].numThreads, traces[i].numEvents, traces[i].endNs / 1e6);
+        if (traces[i].program == PROGRAM_READER_WRITER) ReportReaderWriter(traces + i, summaries + i);
+        else if (traces[i].program == PROGRAM_SELL_TICKETS) ReportSellTickets(traces + i, summaries + i);
+        else printf("  the trace does not say what wrote it; -p readerWriter or -p sellTickets\n");
+        PrintTimeline(traces + i, config.width);
+        printf("\n");
+    }
+    if (numTraces == 2) {
+        if (traces[0].program != traces[1].program) {
+            printf("ERROR: cannot compare a %s trace with a %s trace\n", programNames[traces[0].program],
+                   programNames[traces[1].program]);
+            exit(1);
+        }
+        Compare(traces, summaries, traces + 1, summaries + 1);
+    }
+    return 0;
+}
+
+/**
+ * LoadTrace
+ * ---------
+ * Reads a whole trace into memory: the header, which is shorter before
+ * version 2, the thread names and every event, sorted by time again since
+ * a background logger only keeps each of its passes in order.
+ */
+
+static void LoadTrace(traceFile* trace, const char* path, const reportConfig* config)
+{
+    traceFileHeader header;
+    traceThreadInfo info;
+    size_t capacity = 1 << 16;
+    FILE* in;
+    int i;
+
+    memset(trace, 0, sizeof(*trace));
+    trace->path = path;
+    if ((in = fopen(path, "rb")) == NULL) {
+        printf("ERROR: cannot open trace '%s'\n", path);
+        exit(1);
+    }
+    memset(&header, 0, sizeof(header));
+    if (fread(&header, TRACE_V1_HEADER_SIZE, 1, in) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version < 1 || header.version > TRACE_VERSION) {
+        printf("ERROR: '%s' is not a binary trace of version 1 to %d\n", path, TRACE_VERSION);
+        exit(1);
+    }
+    if (header.eventSize != sizeof(traceEvent)) {
+        printf("ERROR: '%s' has %u-byte events, not %zu\n", path, header.eventSize, sizeof(traceEvent));
+        exit(1);
+    }
+    if (header.version >= 2 && fread((char*) &header + TRACE_V1_HEADER_SIZE, sizeof(header) - TRACE_V1_HEADER_SIZE, 1, in) != 1) {
+        printf("ERROR: '%s' ends inside its header\n", path);
+        exit(1);
+    }
+    trace->version = header.version;
+    trace->seed = header.seed;
+    header.program[sizeof(header.program) - 1] = '\0';
+    for (i = 1; i < (int) (sizeof(programNames) / sizeof(programNames[0])); i++)
+        if (strcmp(header.program, programNames[i]) == 0) trace->program = (traceProgram) i;
+    if (trace->program == PROGRAM_UNKNOWN) trace->program = config->program;
+
+    trace->numThreads = (int) header.numThreads;
+    trace->names = calloc(trace->numThreads > 0 ? trace->numThreads : 1, TRACE_NAME_LENGTH);
+    for (i = 0; i < trace->numThreads; i++) {
+        if (fread(&info, sizeof(info), 1, in) != 1 || info.thread >= header.numThreads) {
+            printf("ERROR: '%s' ends inside its thread names\n", path);
+            exit(1);
+        }
+        memcpy(trace->names[info.thread], info.name, TRACE_NAME_LENGTH);
+        trace->names[info.thread][TRACE_NAME_LENGTH - 1] = '\0';
+    }
+
+    trace->events = (traceEvent*) malloc(capacity * sizeof(traceEvent));
+    for (;;) {
+        if (trace->numEvents == capacity) {
+            capacity *= 2;
+            trace->events = (traceEvent*) realloc(trace->events, capacity * sizeof(traceEvent));
+        }
+        if (fread(trace->events + trace->numEvents, sizeof(traceEvent), 1, in) != 1) break;
+        if (trace->events[trace->numEvents].thread >= header.numThreads) {
+            printf("ERROR: '%s' has an event of thread %u out of %u\n", path,
+                   trace->events[trace->numEvents].thread, header.numThreads);
+            exit(1);
+        }
+        trace->numEvents++;
+    }
+    fclose(in);
+    qsort(trace->events, trace->numEvents, sizeof(traceEvent), CompareEvents);
+    if (trace->numEvents > 0) trace->endNs = trace->events[trace->numEvents - 1].timestamp;
+    CollectInputs(trace);
+}
+
+/**
+ * CollectInputs
+ * -------------
+ * The part of each thread's events that the seed decides, in order: the
+ * letters a writer wrote, or the tickets each of a seller's customers
+ * wanted. Readers and queries, whose events depend on the interleaving,
+ * have none.
+ */
+
+static void CollectInputs(traceFile* trace)
+{
+    const traceEvent* event;
+    size_t i;
+    int t, n = trace->numThreads > 0 ? trace->numThreads : 1, pass;
+
+    trace->inputs = (uint64_t**) calloc(n, sizeof(uint64_t*));
+    trace->numInputs = (size_t*) calloc(n, sizeof(size_t));
+    // the first pass counts each thread's inputs, the second copies them
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1)
+            for (t = 0; t < trace->numThreads; t++) {
+                trace->inputs[t] = (uint64_t*) malloc((trace->numInputs[t] + 1) * sizeof(uint64_t));
+                trace->numInputs[t] = 0;
+            }
+        for (i = 0; i < trace->numEvents; i++) {
+            event = trace->events + i;
+            if (event->thread >= (uint32_t) trace->numThreads) continue;
+            if (trace->program == PROGRAM_READER_WRITER) {
+                if (HandoffEventOf(event->kind) != EVENT_WRITE || HandoffLink(event->kind) != 0) continue;
+            } else if (trace->program != PROGRAM_SELL_TICKETS || event->kind != EVENT_CUSTOMER) {
+                continue;
+            }
+            if (pass == 1)
+                trace->inputs[event->thread][trace->numInputs[event->thread]] =
+                    trace->program == PROGRAM_READER_WRITER ? (uint8_t) HandoffItem(event->value) : (uint64_t) event->value;
+            trace->numInputs[event->thread]++;
+        }
+    }
+}
+
+/**
+ * ReportReaderWriter
+ * ------------------
+ * Pairs the writes and reads of each link. Once both are sorted by link,
+ * position and time, the k-th write of a position goes with its k-th read,
+ * which keeps the pairing right when later rounds start over from position
+ * 0. A write without a read is an item still in the channel when the
+ * trace ended, or one whose event was dropped.
+ */
+
+static void ReportReaderWriter(const traceFile* trace, traceSummary* summary)
+{
+    handoff *writes, *reads;
+    size_t numWrites = 0, numReads = 0, i, w, r;
+    size_t unread[MAX_LINKS] = {0}, unwritten[MAX_LINKS] = {0}, early[MAX_LINKS] = {0};
+    const traceEvent* event;
+    handoff h;
+    char label[64];
+    int l;
+
+    writes = (handoff*) malloc((trace->numEvents + 1) * sizeof(handoff));
+    reads = (handoff*) malloc((trace->numEvents + 1) * sizeof(handoff));
+    for (i = 0; i < trace->numEvents; i++) {
+        event = trace->events + i;
+        h.link = HandoffLink(event->kind);
+        h.pos = HandoffPos(event->value);
+        h.timestamp = event->timestamp;
+        if (h.link >= MAX_LINKS) continue;
+        if ((int) h.link >= summary->numLinks) summary->numLinks = (int) h.link + 1;
+        if (HandoffEventOf(event->kind) == EVENT_WRITE) writes[numWrites++] = h;
+        else reads[numReads++] = h;
+    }
+    qsort(writes, numWrites, sizeof(handoff), CompareHandoffs);
+    qsort(reads, numReads, sizeof(handoff), CompareHandoffs);
+
+    for (l = 0; l < summary->numLinks; l++)
+        summary->links[l].samples = (uint64_t*) malloc((numReads + 1) * sizeof(uint64_t));
+    for (w = r = 0; w < numWrites || r < numReads;) {
+        int order = w == numWrites ? 1 : r == numReads ? -1 :
+                    writes[w].link != reads[r].link ? (writes[w].link < reads[r].link ? -1 : 1) :
+                    writes[w].pos != reads[r].pos ? (writes[w].pos < reads[r].pos ? -1 : 1) : 0;
+
+        if (order < 0) {
+            unread[writes[w++].link]++;
+        } else if (order > 0) {
+            unwritten[reads[r++].link]++;
+        } else {
+            sampleSet* set = summary->links + writes[w].link;
+
+            if (reads[r].timestamp < writes[w].timestamp) early[writes[w].link]++;
+            set->samples[set->count++] = reads[r].timestamp < writes[w].timestamp ? 0 :
+                                         reads[r].timestamp - writes[w].timestamp;
+            w++;
+            r++;
+        }
+    }
+
+    for (l = 0; l < summary->numLinks; l++) {
+        sampleSet* set = summary->links + l;
+
+        qsort(set->samples, set->count, sizeof(uint64_t), CompareSamples);
+        if (summary->numLinks == 1) snprintf(label, sizeof(label), "writers to readers");
+        else snprintf(label, sizeof(label), "link %d (stage %d to %d)", l + 1, l + 1, l + 2);
+        printf("  %s: %zu items handed off, %zu early, %zu never read, %zu read without a write\n", label,
+               set->count, early[l], unread[l], unwritten[l]);
+        PrintSamples("enqueue to dequeue", set);
+        PrintHistogram(set);
+    }
+    free(writes);
+    free(reads);
+}
+
+/**
+ * ReportSellTickets
+ * -----------------
+ * Takes the sales in the order they were stamped, which within the lock's
+ * critical section is the order the sellers got it in.
+ */
+
+static void ReportSellTickets(const traceFile* trace, traceSummary* summary)
+{
+    uint64_t *sales, *tickets, totalTickets = 0, last = 0;
+    size_t i, runs = 0, run = 0, longest = 0;
+    const traceEvent* event;
+    int t;
+
+    sales = (uint64_t*) calloc(trace->numThreads + 1, sizeof(uint64_t));
+    tickets = (uint64_t*) calloc(trace->numThreads + 1, sizeof(uint64_t));
+    summary->order = (uint32_t*) malloc((trace->numEvents + 1) * sizeof(uint32_t));
+    summary->gaps.samples = (uint64_t*) malloc((trace->numEvents + 1) * sizeof(uint64_t));
+    for (i = 0; i < trace->numEvents; i++) {
+        event = trace->events + i;
+        if (event->kind != EVENT_SALE && event->kind != EVENT_BLOCK_SALE && event->kind != EVENT_GRANT &&
+            event->kind != EVENT_EVENT_GRANT)
+            continue;
+        sales[event->thread]++;
+        tickets[event->thread] += event->kind == EVENT_GRANT ? (uint64_t) event->slot :
+                                  event->kind == EVENT_EVENT_GRANT ? (uint64_t) SaleSlotTickets(event->slot) : 1;
+        if (summary->numSales > 0) {
+            summary->gaps.samples[summary->gaps.count++] = event->timestamp - last;
+            if (summary->order[summary->numSales - 1] == event->thread) {
+                run++;
+            } else {
+                runs++;
+                run = 1;
+            }
+        } else {
+            runs = run = 1;
+        }
+        if (run > longest) longest = run;
+        last = event->timestamp;
+        summary->order[summary->numSales++] = event->thread;
+    }
+    for (t = 0; t < trace->numThreads; t++) totalTickets += tickets[t];
+    qsort(summary->gaps.samples, summary->gaps.count, sizeof(uint64_t), CompareSamples);
+
+    printf("  %zu sales of %llu tickets, in runs by one seller of %.2f sales on average and %zu at most\n",
+           summary->numSales, (unsigned long long) totalTickets, runs > 0 ? (double) summary->numSales / runs : 0.0,
+           longest);
+    for (t = 0; t < trace->numThreads; t++) {
+        if (sales[t] == 0) continue;
+        printf("  %-24s %8llu sales %8llu tickets  %5.1f%%\n", trace->names[t], (unsigned long long) sales[t],
+               (unsigned long long) tickets[t], totalTickets > 0 ? 100.0 * tickets[t] / totalTickets : 0.0);
+    }
+    PrintSamples("gap between sales", &summary->gaps);
+    PrintHistogram(&summary->gaps);
+    free(sales);
+    free(tickets);
+}
+
+/**
+ * PrintTimeline
+ * -------------
+ * One row per thread and width columns over the run, each column showing
+ * how many of the thread's events fell into that stretch of time, from
+ * ' ' for none up to '#' for as many as the busiest column of any thread.
+ */
+
+static void PrintTimeline(const traceFile* trace, int width)
+{
+    static const char shades[] = " .:-=+*#";
+    uint32_t* counts;
+    uint32_t busiest = 0;
+    size_t i;
+    int t, c;
+
+    if (trace->numEvents == 0) return;
+    counts = (uint32_t*) calloc((size_t) trace->numThreads * width, sizeof(uint32_t));
+    for (i = 0; i < trace->numEvents; i++) {
+        const traceEvent* event = trace->events + i;
+        int column = trace->endNs > 0 ? (int) ((double) event->timestamp / trace->endNs * (width - 1)) : 0;
+        uint32_t* count = counts + (size_t) event->thread * width + column;
+
+        if (++*count > busiest) busiest = *count;
+    }
+    printf("  timeline, %.3f ms per column, busiest %u events:\n", trace->endNs / 1e6 / width, busiest);
+    for (t = 0; t < trace->numThreads; t++) {
+        printf("  %16.16s |", trace->names[t]);
+        for (c = 0; c < width; c++) {
+            uint32_t count = counts[(size_t) t * width + c];
+            putchar(count == 0 ? ' ' : shades[1 + (int) ((uint64_t) (count - 1) * (sizeof(shades) - 2) / busiest)]);
+        }
+        printf("|\n");
+    }
+    free(counts);
+}
+
+static uint64_t Percentile(const sampleSet* set, double quantile)
+{
+    return set->count > 0 ? set->samples[(size_t) (quantile * (set->count - 1))] : 0;
+}
+
+static void PrintSamples(const char* label, const sampleSet* set)
+{
+    if (set->count == 0) return;
+    printf("    %s: p50 %llu ns  p90 %llu ns  p99 %llu ns  p999 %llu ns  max %llu ns\n", label,
+           (unsigned long long) Percentile(set, 0.5), (unsigned long long) Percentile(set, 0.9),
+           (unsigned long long) Percentile(set, 0.99), (unsigned long long) Percentile(set, 0.999),
+           (unsigned long long) set->samples[set->count - 1]);
+}
+
+/**
+ * PrintHistogram
+ * --------------
+ * Buckets of powers of two, [2^k, 2^k+1) ns, from the first one with a
+ * sample to the last.
+ */
+
+static void PrintHistogram(const sampleSet* set)
+{
+    size_t buckets[HISTOGRAM_BUCKETS] = {0}, most = 0, i;
+    int first = HISTOGRAM_BUCKETS, last = -1, b;
+
+    for (i = 0; i < set->count; i++) {
+        b = set->samples[i] == 0 ? 0 : 64 - __builtin_clzll(set->samples[i]);
+        if (b >= HISTOGRAM_BUCKETS) b = HISTOGRAM_BUCKETS - 1;
+        if (++buckets[b] > most) most = buckets[b];
+        if (b < first) first = b;
+        if (b > last) last = b;
+    }
+    for (b = first; b <= last; b++) {
+        int bar = (int) (buckets[b] * HISTOGRAM_BAR / most);
+
+        printf("    %12llu ns %10zu %5.1f%% ", b == 0 ? 0ull : 1ull << (b - 1), buckets[b], 100.0 * buckets[b] / set->count);
+        while (bar-- > 0) putchar('#');
+        printf("\n");
+    }
+}
+
+/**
+ * Compare
+ * -------
+ * The second trace against the first: whether the seeded input was the
+ * same for every thread, the latency or gap percentiles of both with the
+ * change in percent, and for sellTickets how often the same seller made
+ * the same sale. How many customers a seller gets depends on the
+ * interleaving, so the inputs are compared as far as both traces have
+ * them; a thread that has none in either is left out.
+ */
+
+static void Compare(const traceFile* a, const traceSummary* x, const traceFile* b, const traceSummary* y)
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    static const char* const names[] = {"p50", "p90", "p99", "p999"};
+    size_t i, same = 0, shorter, n;
+    int t, l, q, numSets, differ = 0, recorded = 0;
+
+    printf("comparison: %s against %s\n", b->path, a->path);
+    if (a->numThreads != b->numThreads) {
+        printf("  input: differs, %d threads against %d\n", b->numThreads, a->numThreads);
+    } else {
+        for (t = 0; t < a->numThreads; t++) {
+            n = a->numInputs[t] < b->numInputs[t] ? a->numInputs[t] : b->numInputs[t];
+            if (n == 0) continue;
+            recorded++;
+            differ += memcmp(a->inputs[t], b->inputs[t], n * sizeof(uint64_t)) != 0;
+        }
+        if (recorded == 0) printf("  input: not recorded\n");
+        else if (differ == 0) printf("  input: the same for all %d threads that recorded any%s\n", recorded,
+                                     a->seed == b->seed ? " (same seed)" : "");
+        else printf("  input: differs for %d of the %d threads that recorded any%s\n", differ, recorded,
+                    a->seed == b->seed ? "" : " (different seeds)");
+    }
+
+    // sellTickets has the one set of gaps, readerWriter a set per link the two have in common
+    numSets = a->program == PROGRAM_SELL_TICKETS ? 1 : x->numLinks < y->numLinks ? x->numLinks : y->numLinks;
+    for (l = 0; l < numSets; l++) {
+        const sampleSet* before = a->program == PROGRAM_SELL_TICKETS ? &x->gaps : x->links + l;
+        const sampleSet* after = a->program == PROGRAM_SELL_TICKETS ? &y->gaps : y->links + l;
+
+        if (a->program == PROGRAM_SELL_TICKETS) printf("  gap between sales, %zu against %zu:\n", after->count, before->count);
+        else printf("  link %d enqueue to dequeue, %zu items against %zu:\n", l + 1, after->count, before->count);
+        if (before->count == 0 || after->count == 0) continue;
+        for (q = 0; q < (int) (sizeof(quantiles) / sizeof(quantiles[0])); q++) {
+            uint64_t was = Percentile(before, quantiles[q]), is = Percentile(after, quantiles[q]);
+
+            printf("    %-5s %12llu ns %12llu ns", names[q], (unsigned long long) was, (unsigned long long) is);
+            if (was > 0) printf("  %+7.1f%%", 100.0 * ((double) is - (double) was) / was);
+            printf("\n");
+        }
+    }
+
+    if (a->program == PROGRAM_SELL_TICKETS) {
+        shorter = x->numSales < y->numSales ? x->numSales : y->numSales;
+        for (i = 0; i < shorter; i++) same += x->order[i] == y->order[i];
+        for (i = 0; i < shorter && x->order[i] == y->order[i]; i++)
+            ;
+        printf("  sale order: the same seller made %zu of %zu sales (%.1f%%), the first %zu in a row\n", same,
+               shorter, shorter > 0 ? 100.0 * same / shorter : 0.0, i);
+    }
+}
+
+static int CompareHandoffs(const void* a, const void* b)
+{
+    const handoff* x = (const handoff*) a;
+    const handoff* y = (const handoff*) b;
+
+    if (x->link != y->link) return x->link < y->link ? -1 : 1;
+    if (x->pos != y->pos) return x->pos < y->pos ? -1 : 1;
+    return x->timestamp < y->timestamp ? -1 : x->timestamp > y->timestamp;
+}
+
+static void Usage(const char* prog)
+{
+    printf("usage: %s [-w width] [-p program] trace [other-trace]\n", prog);
+    printf("  -w, --width       columns of the timeline (default %d)\n", DEFAULT_WIDTH);
+    printf("  -p, --program     readerWriter or sellTickets, for a trace from before version 2\n");
+    printf("                    that does not say which wrote it\n");
+    printf("Given two traces, both are reported and the second is compared with the first.\n");
+    printf("Each option can also be set with the environment variable listed here;\n");
+    printf("the command line wins when both are given:\n ");
+    for (size_t i = 0; i < sizeof(envOptions) / sizeof(envOptions[0]); i++)
+        printf(" %s (-%c)", envOptions[i].name, envOptions[i].opt);
+    printf("\n");
+}
+
+/**
+ * ApplyOption
+ * -----------
+ * Applies one setting, from the command line or the environment.
+ */
+
+static void ApplyOption(void* ctx, int opt, const char* arg)
+{
+    reportConfig* config = (reportConfig*) ctx;
+
+    switch (opt) {
+    case 'w':
+        config->width = (int) ParseLong(arg, "width", 1, MAX_WIDTH);
+        break;
+    case 'p':
+        if (strcmp(arg, "readerWriter") == 0) config->program = PROGRAM_READER_WRITER;
+        else if (strcmp(arg, "sellTickets") == 0) config->program = PROGRAM_SELL_TICKETS;
+        else {
+            printf("ERROR: unknown program '%s'\n", arg);
+            exit(1);
+        }
+        break;
+    }
+}
@@ -0,0 +1,230 @@
+/**
+ * wait.h
+ * ------
+ * What a thread does while it waits for a buffer to fill or empty. Each
+ * strategy trades CPU for wake-up latency in its own way:
+ *
+ *   spin         re-check as fast as the CPU allows, with a pause between
+ *                checks; never gives up the CPU
+ *   yield        spin for the spin budget, then keep re-checking with a
+ *                sched_yield in between
+ *   spin-futex   spin for the spin budget, then sleep in the kernel until
+ *                woken
+ *   block        sleep in the kernel straight away
+ *
+ * Sleeping needs someone to do the waking. An eventCount is the word a
+ * sleeper sleeps on: a waiter registers itself in sleepers before its last
+ * look at the condition, and whoever changes the condition calls
+ * EventNotify afterwards. EventNotify only makes a system call when there
+ * is somebody to wake. Under the spinning strategies nobody ever sleeps,
+ * so EventNotify costs nothing at all; under the others it costs one full
+ * fence, which is what makes the registration and the change impossible
+ * to miss each other.
+ *
+ * In a timed run, whoever changes the condition also stamps the
+ * eventCount with the time. A waiter that had to wait then records how
+ * long it took from that stamp until it was running again, which is the
+ * wake-up latency of its strategy.
+ */
+
+#ifndef _WAIT_H
+#define _WAIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "futex.h"
+#include "locks.h"
+#include "bench.h"
+
+#define WAIT_SPIN_BUDGET 4096
+#define MAX_SPIN_BUDGET (1 << 30)
+
+typedef enum {
+    WAIT_SPIN,
+    WAIT_YIELD,
+    WAIT_SPIN_FUTEX,
+    WAIT_BLOCK
+} waitStrategy;
+
+static const char* const waitNames[] = {"spin", "yield", "spin-futex", "block"};
+
+typedef struct {
+    waitStrategy strategy;
+    int spinBudget;     // checks before yielding or sleeping
+    bool timed;         // stamp notifications and record wake-up latency
+} waitPolicy;
+
+typedef struct {
+    atomic_int epoch;       // bumped by EventNotify when anyone sleeps
+    atomic_int sleepers;
+    _Atomic uint64_t stamp; // when the condition last changed, in a timed run
+} eventCount;
+
+typedef struct {
+    const waitPolicy* policy;
+    eventCount* event;
+    int spins;
+    int epoch;
+    bool armed;         // counted in event->sleepers
+    uint64_t since;
+} waiter;
+
+static inline bool WaitStrategyFromName(const char* name, waitStrategy* strategy)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(waitNames) / sizeof(waitNames[0]); i++)
+        if (strcmp(name, waitNames[i]) == 0) {
+            *strategy = (waitStrategy) i;
+            return true;
+        }
+    return false;
+}
+
+static inline void EventInit(eventCount* ev)
+{
+    atomic_init(&ev->epoch, 0);
+    atomic_init(&ev->sleepers, 0);
+    atomic_init(&ev->stamp, 0);
+}
+
+static inline void EventStamp(eventCount* ev, const waitPolicy* p)
+{
+    if (p->timed) atomic_store_explicit(&ev->stamp, NowNs(), memory_order_relaxed);
+}
+
+/**
+ * EventNotify
+ * -----------
+ * Called after the condition waiters of ev are waiting for has changed.
+ */
+
+static inline void EventNotify(eventCount* ev, const waitPolicy* p)
+{
+    EventStamp(ev, p);
+    if (p->strategy == WAIT_SPIN || p->strategy == WAIT_YIELD) return;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ev->sleepers, memory_order_relaxed) > 0) {
+        atomic_fetch_add(&ev->epoch, 1);
+        FutexWake(&ev->epoch, INT_MAX);
+    }
+}
+
+/**
+ * WaitBegin, WaitPause and WaitEnd
+ * --------------------------------
+ * A wait is written as
+ *
+ *     WaitBegin(&w, policy, event);
+ *     while (!condition) WaitPause(&w);
+ *     WaitEnd(&w, wakeups);
+ *
+ * WaitPause does one step of the strategy. When the strategy calls for
+ * sleeping, the first WaitPause only registers the waiter and returns, so
+ * the condition is checked once more before it actually sleeps.
+ * WaitEnd records the wake-up latency in wakeups if there is a log, the
+ * run is timed, and the condition changed after the wait began.
+ */
+
+static inline void WaitBegin(waiter* w, const waitPolicy* p, eventCount* ev)
+{
+    w->policy = p;
+    w->event = ev;
+    w->spins = 0;
+    w->epoch = 0;
+    w->armed = false;
+    w->since = p->timed ? NowNs() : 0;
+}
+
+// true once the strategy would rather sleep than check again
+static inline bool WaitWouldSleep(const waiter* w)
+{
+    return w->policy->strategy == WAIT_BLOCK ||
+           (w->policy->strategy == WAIT_SPIN_FUTEX && w->spins >= w->policy->spinBudget);
+}
+
+static inline void WaitPause(waiter* w)
+{
+    const waitPolicy* p = w->policy;
+
+    if (p->strategy == WAIT_SPIN || (!WaitWouldSleep(w) && w->spins < p->spinBudget)) {
+        w->spins++;
+        CpuRelax();
+    } else if (p->strategy == WAIT_YIELD) {
+        sched_yield();
+    } else if (!w->armed) {
+        atomic_fetch_add(&w->event->sleepers, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        w->epoch = atomic_load(&w->event->epoch);
+        w->armed = true;
+    } else {
+        FutexWait(&w->event->epoch, w->epoch);
+        w->epoch = atomic_load(&w->event->epoch);
+    }
+}
+
+static inline void WaitEnd(waiter* w, latencyLog* wakeups)
+{
+    uint64_t stamp, now;
+
+    if (w->armed) atomic_fetch_sub(&w->event->sleepers, 1);
+    if (wakeups == NULL || !w->policy->timed) return;
+    now = NowNs();
+    stamp = atomic_load_explicit(&w->event->stamp, memory_order_relaxed);
+    if (stamp >= w->since && stamp <= now) LatencyRecord(wakeups, now - stamp);
+}
+
+/**
+ * SemWait
+ * -------
+ * sem_wait under a wait strategy. The semaphore does its own sleeping, so
+ * the strategy only decides how long to keep trying sem_trywait first;
+ * ev just carries the stamp for the wake-up latency. Returns whether the
+ * semaphore was taken straight away, without waiting.
+ */
+
+static inline bool SemWait(sem_t* s, const waitPolicy* p, eventCount* ev, latencyLog* wakeups)
+{
+    waiter w;
+
+    if (sem_trywait(s) == 0) return true;
+    WaitBegin(&w, p, ev);
+    while (sem_trywait(s) != 0) {
+        if (WaitWouldSleep(&w)) {
+            while (sem_wait(s) != 0)
+                ;
+            break;
+        }
+        WaitPause(&w);
+    }
+    WaitEnd(&w, wakeups);
+    return false;
+}
+
+/**
+ * CounterWait
+ * -----------
+ * CounterTake under a wait strategy, which like SemWait only decides how
+ * to wait for the count to become non-zero before the counter's own futex
+ * takes over. Returns 0 once the counter is closed and empty.
+ */
+
+static inline int CounterWait(futexCounter* c, int max, const waitPolicy* p, eventCount* ev, latencyLog* wakeups)
+{
+    waiter w;
+    int taken;
+
+    if (atomic_load_explicit(&c->value, memory_order_relaxed) != 0) return CounterTake(c, max);
+    WaitBegin(&w, p, ev);
+    while (atomic_load_explicit(&c->value, memory_order_relaxed) == 0 && !WaitWouldSleep(&w)) WaitPause(&w);
+    taken = CounterTake(c, max);
+    WaitEnd(&w, wakeups);
+    return taken;
+}
+
+#endif